@@ -11,10 +11,10 @@ SET PATH=%PATH%;%CL_PATH%;%VSDEVCMD_PATH%
 call VsDevCmd.bat
 
 :: compile the code
-cl.exe /EHsc /O1 src\fileops.cpp
+cl.exe /EHsc /O1 /Fe:fileops.exe src\*.cpp
 
-:: delete the intermediate object file and ignore any errors
-del fileops.obj 2>nul
+:: delete the intermediate object files and ignore any errors
+del *.obj 2>nul
 
 :: create the bin folder if it doesn't exist
 if not exist "bin" mkdir "bin"
@@ -0,0 +1,270 @@
+#include "hash.h"
+#include "priority.h"
+
+#include <algorithm>
+#include <functional>
+#include <string.h>
+#include <thread>
+
+static const size_t BLOCK_LENGTH = 64;
+static const size_t CHUNK_LENGTH = 1024;
+
+// Inputs with at least this many whole chunks have them hashed in parallel
+static const size_t PARALLEL_MIN_CHUNKS = 256;
+
+enum Blake3Flags : UINT32 {
+  CHUNK_START = 1 << 0,
+  CHUNK_END = 1 << 1,
+  PARENT = 1 << 2,
+  ROOT = 1 << 3,
+};
+
+static const UINT32 IV[8] = {0x6A09E667U, 0xBB67AE85U, 0x3C6EF372U,
+                             0xA54FF53AU, 0x510E527FU, 0x9B05688CU,
+                             0x1F83D9ABU, 0x5BE0CD19U};
+
+static const size_t MESSAGE_PERMUTATION[16] = {2, 6,  3,  10, 7, 0,  4,  13,
+                                               1, 11, 12, 5,  9, 14, 15, 8};
+
+static inline UINT32 rotateRight(UINT32 value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+static inline void mix(UINT32 *state, size_t a, size_t b, size_t c, size_t d,
+                       UINT32 x, UINT32 y) {
+  state[a] = state[a] + state[b] + x;
+  state[d] = rotateRight(state[d] ^ state[a], 16);
+  state[c] = state[c] + state[d];
+  state[b] = rotateRight(state[b] ^ state[c], 12);
+  state[a] = state[a] + state[b] + y;
+  state[d] = rotateRight(state[d] ^ state[a], 8);
+  state[c] = state[c] + state[d];
+  state[b] = rotateRight(state[b] ^ state[c], 7);
+}
+
+/**
+ * The BLAKE3 compression function, giving all 16 words of output
+ */
+static void compress(const UINT32 *chainingValue, const UINT32 *blockWords,
+                     ULONGLONG counter, UINT32 blockLength, UINT32 flags,
+                     UINT32 *out) {
+  UINT32 state[16] = {
+      chainingValue[0], chainingValue[1], chainingValue[2], chainingValue[3],
+      chainingValue[4], chainingValue[5], chainingValue[6], chainingValue[7],
+      IV[0],            IV[1],            IV[2],            IV[3],
+      (UINT32)counter,  (UINT32)(counter >> 32), blockLength, flags,
+  };
+
+  UINT32 message[16];
+  memcpy(message, blockWords, sizeof(message));
+
+  for (int round = 0; round < 7; round++) {
+    mix(state, 0, 4, 8, 12, message[0], message[1]);
+    mix(state, 1, 5, 9, 13, message[2], message[3]);
+    mix(state, 2, 6, 10, 14, message[4], message[5]);
+    mix(state, 3, 7, 11, 15, message[6], message[7]);
+    mix(state, 0, 5, 10, 15, message[8], message[9]);
+    mix(state, 1, 6, 11, 12, message[10], message[11]);
+    mix(state, 2, 7, 8, 13, message[12], message[13]);
+    mix(state, 3, 4, 9, 14, message[14], message[15]);
+
+    UINT32 permuted[16];
+    for (size_t i = 0; i < 16; i++) {
+      permuted[i] = message[MESSAGE_PERMUTATION[i]];
+    }
+    memcpy(message, permuted, sizeof(message));
+  }
+
+  for (size_t i = 0; i < 8; i++) {
+    out[i] = state[i] ^ state[i + 8];
+    out[i + 8] = state[i + 8] ^ chainingValue[i];
+  }
+}
+
+static void loadWords(const BYTE *bytes, UINT32 *words) {
+  for (size_t i = 0; i < 16; i++) {
+    words[i] = (UINT32)bytes[4 * i] | ((UINT32)bytes[4 * i + 1] << 8) |
+               ((UINT32)bytes[4 * i + 2] << 16) |
+               ((UINT32)bytes[4 * i + 3] << 24);
+  }
+}
+
+/**
+ * The chaining value of a parent node from its two children
+ */
+static void parentValue(const UINT32 *left, const UINT32 *right, UINT32 *out) {
+  UINT32 block[16];
+  memcpy(block, left, 8 * sizeof(UINT32));
+  memcpy(block + 8, right, 8 * sizeof(UINT32));
+
+  UINT32 full[16];
+  compress(IV, block, 0, BLOCK_LENGTH, PARENT, full);
+  memcpy(out, full, 8 * sizeof(UINT32));
+}
+
+/**
+ * The chaining value of a whole chunk that isn't the root
+ */
+static void chunkValueOf(const BYTE *chunk, ULONGLONG counter, UINT32 *out) {
+  UINT32 value[8];
+  memcpy(value, IV, sizeof(value));
+
+  for (size_t i = 0; i < CHUNK_LENGTH / BLOCK_LENGTH; i++) {
+    UINT32 flags = (i == 0 ? CHUNK_START : 0) |
+                   (i == CHUNK_LENGTH / BLOCK_LENGTH - 1 ? CHUNK_END : 0);
+
+    UINT32 words[16];
+    UINT32 full[16];
+    loadWords(chunk + i * BLOCK_LENGTH, words);
+    compress(value, words, counter, BLOCK_LENGTH, flags, full);
+    memcpy(value, full, sizeof(value));
+  }
+
+  memcpy(out, value, sizeof(value));
+}
+
+Blake3Hasher::Blake3Hasher() : chunkCounter(0), blockLength(0), blocksDone(0) {
+  memcpy(chunkValue, IV, sizeof(chunkValue));
+  memset(block, 0, sizeof(block));
+}
+
+void Blake3Hasher::addChunkValue(const UINT32 *value) {
+  UINT32 merged[8];
+  memcpy(merged, value, sizeof(merged));
+
+  // Each completed pair of subtrees of the same size is merged into their
+  // parent, which the number of chunks so far tells us
+  for (ULONGLONG total = chunkCounter + 1; (total & 1) == 0; total >>= 1) {
+    parentValue(stack.data() + stack.size() - 8, merged, merged);
+    stack.resize(stack.size() - 8);
+  }
+
+  stack.insert(stack.end(), merged, merged + 8);
+}
+
+void Blake3Hasher::finishChunk() {
+  UINT32 words[16];
+  UINT32 full[16];
+  loadWords(block, words);
+  compress(chunkValue, words, chunkCounter, (UINT32)blockLength,
+           (blocksDone == 0 ? CHUNK_START : 0) | CHUNK_END, full);
+
+  addChunkValue(full);
+
+  chunkCounter++;
+  memcpy(chunkValue, IV, sizeof(chunkValue));
+  memset(block, 0, sizeof(block));
+  blockLength = 0;
+  blocksDone = 0;
+}
+
+void Blake3Hasher::update(const void *data, size_t length) {
+  const BYTE *input = (const BYTE *)data;
+
+  while (length > 0) {
+    // A chunk is only finished once there's input after it, since the last
+    // chunk may turn out to be the root
+    if (blocksDone * BLOCK_LENGTH + blockLength == CHUNK_LENGTH) {
+      finishChunk();
+    }
+
+    // Whole chunks followed by more input can be hashed independently, and
+    // then added to the tree in order
+    size_t wholeChunks = (length - 1) / CHUNK_LENGTH;
+    if (blocksDone == 0 && blockLength == 0 &&
+        wholeChunks >= PARALLEL_MIN_CHUNKS) {
+      std::vector<UINT32> values(wholeChunks * 8);
+
+      size_t threadCount = std::min<size_t>(
+          std::max(1U, std::thread::hardware_concurrency()),
+          wholeChunks / (PARALLEL_MIN_CHUNKS / 4));
+      size_t perThread = (wholeChunks + threadCount - 1) / threadCount;
+
+      auto worker = [&](size_t first) {
+        size_t last = std::min(wholeChunks, first + perThread);
+        for (size_t i = first; i < last; i++) {
+          chunkValueOf(input + i * CHUNK_LENGTH, chunkCounter + i,
+                       values.data() + i * 8);
+        }
+      };
+
+      std::vector<std::thread> threads;
+      for (size_t i = 1; i < threadCount; i++) {
+        threads.push_back(startWorker(std::bind(worker, i * perThread)));
+      }
+      worker(0);
+
+      for (std::thread &thread : threads) {
+        thread.join();
+      }
+
+      for (size_t i = 0; i < wholeChunks; i++) {
+        addChunkValue(values.data() + i * 8);
+        chunkCounter++;
+      }
+
+      input += wholeChunks * CHUNK_LENGTH;
+      length -= wholeChunks * CHUNK_LENGTH;
+      continue;
+    }
+
+    // Likewise, a full block is only compressed once there's more input
+    if (blockLength == BLOCK_LENGTH) {
+      UINT32 words[16];
+      UINT32 full[16];
+      loadWords(block, words);
+      compress(chunkValue, words, chunkCounter, BLOCK_LENGTH,
+               blocksDone == 0 ? CHUNK_START : 0, full);
+      memcpy(chunkValue, full, sizeof(chunkValue));
+      memset(block, 0, sizeof(block));
+      blockLength = 0;
+      blocksDone++;
+    }
+
+    size_t take = std::min(BLOCK_LENGTH - blockLength, length);
+    memcpy(block + blockLength, input, take);
+    blockLength += take;
+    input += take;
+    length -= take;
+  }
+}
+
+std::string Blake3Hasher::digest() const {
+  // Start with the output of the current chunk, then fold in the subtrees
+  // on the stack from the right
+  UINT32 inputValue[8];
+  UINT32 words[16];
+  ULONGLONG counter = chunkCounter;
+  UINT32 length = (UINT32)blockLength;
+  UINT32 flags = (blocksDone == 0 ? CHUNK_START : 0) | CHUNK_END;
+
+  memcpy(inputValue, chunkValue, sizeof(inputValue));
+  loadWords(block, words);
+
+  for (size_t i = stack.size() / 8; i-- > 0;) {
+    UINT32 full[16];
+    compress(inputValue, words, counter, length, flags, full);
+
+    memcpy(words, stack.data() + i * 8, 8 * sizeof(UINT32));
+    memcpy(words + 8, full, 8 * sizeof(UINT32));
+    memcpy(inputValue, IV, sizeof(inputValue));
+    counter = 0;
+    length = BLOCK_LENGTH;
+    flags = PARENT;
+  }
+
+  UINT32 root[16];
+  compress(inputValue, words, counter, length, flags | ROOT, root);
+
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  for (size_t i = 0; i < 8; i++) {
+    for (int byte = 0; byte < 4; byte++) {
+      BYTE value = (BYTE)(root[i] >> (8 * byte));
+      hex += digits[value >> 4];
+      hex += digits[value & 0xF];
+    }
+  }
+
+  return hex;
+}
@@ -0,0 +1,158 @@
+#include "conflict.h"
+#include "walker.h"
+
+#include <algorithm>
+
+// How many numbered names to try before giving up on renaming
+static const int MAX_RENAME_ATTEMPTS = 10000;
+
+bool parseConflictPolicy(const std::string &value, ConflictPolicy &policy) {
+  if (value == "overwrite") {
+    policy = ConflictPolicy::Overwrite;
+  } else if (value == "skip") {
+    policy = ConflictPolicy::Skip;
+  } else if (value == "rename") {
+    policy = ConflictPolicy::Rename;
+  } else if (value == "newer") {
+    policy = ConflictPolicy::Newer;
+  } else if (value == "larger") {
+    policy = ConflictPolicy::Larger;
+  } else if (value == "fail") {
+    policy = ConflictPolicy::Fail;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+const DestinationEntry *DestinationListing::find(size_t file) {
+  // A directory's files can be split up by the files of its subdirectories,
+  // so its listing is kept until its last file rather than its first gap
+  if (directories.empty()) {
+    for (size_t i = 0; i < files.size(); i++) {
+      directories[parentPath(files[i].dest)].lastFile = i;
+    }
+  }
+
+  std::wstring dir = parentPath(files[file].dest);
+  std::wstring name = baseName(files[file].dest);
+  auto found = directories.find(dir);
+  Listing &listing = found->second;
+
+  if (!listing.listed) {
+    std::vector<WIN32_FIND_DATAW> entries;
+
+    // A directory that can't be listed is treated as empty, and copying into
+    // it reports the real error
+    if (listDirectory(dir, entries) == 0) {
+      sortByName(entries);
+    } else {
+      entries.clear();
+    }
+
+    listing.listed = true;
+    current.push_back(found);
+    listing.entries.reserve(entries.size());
+    for (const WIN32_FIND_DATAW &data : entries) {
+      DestinationEntry entry;
+      entry.name = data.cFileName;
+      entry.size = fileSizeOf(data);
+      entry.lastWriteTime = fileTimeToTicks(data.ftLastWriteTime);
+      listing.entries.push_back(std::move(entry));
+    }
+  }
+
+  // Listings of directories whose files are all done are dropped
+  for (size_t i = current.size(); i-- > 0;) {
+    Listing &done = current[i]->second;
+    if (done.lastFile < file) {
+      done.listed = false;
+      std::vector<DestinationEntry>().swap(done.entries);
+      current.erase(current.begin() + i);
+    }
+  }
+
+  auto entry = std::lower_bound(
+      listing.entries.begin(), listing.entries.end(), name,
+      [](const DestinationEntry &candidate, const std::wstring &name) {
+        return compareNames(candidate.name.c_str(), name.c_str()) < 0;
+      });
+
+  if (entry == listing.entries.end() ||
+      compareNames(entry->name.c_str(), name.c_str()) != 0) {
+    return NULL;
+  }
+
+  return &*entry;
+}
+
+ConflictAction resolveConflict(ConflictPolicy policy, const FileCopy &file,
+                               const DestinationEntry *existing,
+                               ConflictStats &stats) {
+  if (existing == NULL || policy == ConflictPolicy::Default) {
+    return ConflictAction::Copy;
+  }
+
+  bool replace = false;
+
+  switch (policy) {
+  case ConflictPolicy::Overwrite:
+    replace = true;
+    break;
+  case ConflictPolicy::Newer:
+    replace = file.lastWriteTime > existing->lastWriteTime;
+    break;
+  case ConflictPolicy::Larger:
+    replace = file.size > existing->size;
+    break;
+  case ConflictPolicy::Rename:
+    return ConflictAction::Rename;
+  case ConflictPolicy::Fail:
+    return ConflictAction::Fail;
+  default:
+    break;
+  }
+
+  if (replace) {
+    stats.overwritten++;
+    return ConflictAction::Copy;
+  }
+
+  stats.skipped++;
+  return ConflictAction::Skip;
+}
+
+DWORD claimFreeName(const std::wstring &path, std::wstring &claimed) {
+  std::wstring dir = parentPath(path);
+  std::wstring name = baseName(path);
+
+  // Numbers go before the extension, but a name like ".profile" is all stem
+  size_t dot = name.rfind(L'.');
+  if (dot == 0 || dot == std::wstring::npos) {
+    dot = name.length();
+  }
+  std::wstring stem = name.substr(0, dot);
+  std::wstring extension = name.substr(dot);
+
+  for (int i = 2; i < MAX_RENAME_ATTEMPTS; i++) {
+    std::wstring candidate = joinPath(
+        dir, stem + L" (" + std::to_wstring(i) + L")" + extension);
+
+    HANDLE file = CreateFileW(candidate.c_str(), GENERIC_WRITE, 0, NULL,
+                              CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      DWORD error = GetLastError();
+      if (error == ERROR_FILE_EXISTS || error == ERROR_ALREADY_EXISTS) {
+        continue;
+      }
+      return error;
+    }
+
+    CloseHandle(file);
+    claimed = candidate;
+    return 0;
+  }
+
+  return ERROR_FILE_EXISTS;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "paths.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * What the built-in copier does with a file whose destination already exists
+ */
+enum class ConflictPolicy {
+  // Not set, which replaces it without asking
+  Default,
+  Overwrite,
+  Skip,
+  // Copy to a free name next to it, like "name (2).ext"
+  Rename,
+  // Replace it if the source was modified more recently
+  Newer,
+  // Replace it if the source is larger
+  Larger,
+  // Stop the copy with ERROR_FILE_EXISTS
+  Fail,
+};
+
+/**
+ * Parse the value of the --on-conflict option
+ */
+bool parseConflictPolicy(const std::string &value, ConflictPolicy &policy);
+
+/**
+ * What was done with files whose destinations already existed
+ */
+struct ConflictStats {
+  ULONGLONG overwritten = 0;
+  ULONGLONG skipped = 0;
+  ULONGLONG renamed = 0;
+  // Each renamed file's source and the free name it was copied to
+  std::vector<Target> renamedFiles;
+};
+
+/**
+ * What to do with one file
+ */
+enum class ConflictAction {
+  // Nothing is in the way, or it should be replaced
+  Copy,
+  Skip,
+  Rename,
+  Fail,
+};
+
+/**
+ * What's already at a destination, kept from a directory listing
+ */
+struct DestinationEntry {
+  std::wstring name;
+  ULONGLONG size;
+  ULONGLONG lastWriteTime;
+};
+
+/**
+ * The entries of destination directories, each read with a single listing
+ * the first time a file is copied into it, so conflicts are found without
+ * looking up each destination on its own. A listing is dropped once the last
+ * file copied into its directory has been looked up, so only the directories
+ * on the way to the current one are held at a time.
+ */
+class DestinationListing {
+public:
+  explicit DestinationListing(const std::vector<FileCopy> &files)
+      : files(files) {}
+
+  /**
+   * Find what's at the destination of the file with the given index, or
+   * return NULL if it's free. Files have to be looked up in order.
+   */
+  const DestinationEntry *find(size_t file);
+
+private:
+  /**
+   * A directory's entries, sorted by name
+   */
+  struct Listing {
+    size_t lastFile;
+    bool listed = false;
+    std::vector<DestinationEntry> entries;
+  };
+
+  const std::vector<FileCopy> &files;
+  // Keyed by directory, with every directory files are copied into, but only
+  // the current ones listed
+  std::map<std::wstring, Listing> directories;
+  // The directories that are listed at the moment
+  std::vector<std::map<std::wstring, Listing>::iterator> current;
+};
+
+/**
+ * Decide what to do with a file, given what's at its destination (which may
+ * be NULL), and count the decision in `stats`. Renames are counted by the
+ * caller, once a free name has been claimed.
+ */
+ConflictAction resolveConflict(ConflictPolicy policy, const FileCopy &file,
+                               const DestinationEntry *existing,
+                               ConflictStats &stats);
+
+/**
+ * Claim the first free name like "name (2).ext" next to the given path, by
+ * creating it with CREATE_NEW, so another process can't take the same name
+ * between finding it and copying into it. Returns 0 or a Windows error code.
+ */
+DWORD claimFreeName(const std::wstring &path, std::wstring &claimed);
@@ -0,0 +1,102 @@
+#include "hash.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define CRC32C_USE_SSE42
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// The reflected Castagnoli polynomial
+static const UINT32 POLYNOMIAL = 0x82F63B78U;
+
+/**
+ * The table for the byte-at-a-time fallback
+ */
+struct CrcTable {
+  UINT32 values[256];
+
+  CrcTable() {
+    for (UINT32 i = 0; i < 256; i++) {
+      UINT32 crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? POLYNOMIAL : 0);
+      }
+      values[i] = crc;
+    }
+  }
+};
+
+#ifdef CRC32C_USE_SSE42
+static bool cpuHasSse42() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 20)) != 0;
+#endif
+}
+
+static UINT32 updateHardware(UINT32 crc, const BYTE *data, size_t length) {
+#if defined(_M_X64) || defined(__x86_64__)
+  ULONGLONG crc64 = crc;
+  for (; length >= 8; data += 8, length -= 8) {
+    ULONGLONG value;
+    memcpy(&value, data, sizeof(value));
+    crc64 = _mm_crc32_u64(crc64, value);
+  }
+  crc = (UINT32)crc64;
+#endif
+
+  for (; length >= 4; data += 4, length -= 4) {
+    UINT32 value;
+    memcpy(&value, data, sizeof(value));
+    crc = _mm_crc32_u32(crc, value);
+  }
+
+  for (; length > 0; data++, length--) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+
+  return crc;
+}
+#endif
+
+Crc32cHasher::Crc32cHasher() : crc(0xFFFFFFFFU) {}
+
+void Crc32cHasher::update(const void *data, size_t length) {
+  const BYTE *bytes = (const BYTE *)data;
+
+#ifdef CRC32C_USE_SSE42
+  static const bool hasSse42 = cpuHasSse42();
+  if (hasSse42) {
+    crc = updateHardware(crc, bytes, length);
+    return;
+  }
+#endif
+
+  static const CrcTable table;
+  for (size_t i = 0; i < length; i++) {
+    crc = (crc >> 8) ^ table.values[(crc ^ bytes[i]) & 0xFF];
+  }
+}
+
+std::string Crc32cHasher::digest() const {
+  static const char digits[] = "0123456789abcdef";
+
+  UINT32 value = ~crc;
+  std::string hex(8, '0');
+  for (int i = 7; i >= 0; i--) {
+    hex[i] = digits[value & 0xF];
+    value >>= 4;
+  }
+
+  return hex;
+}
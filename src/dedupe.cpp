@@ -0,0 +1,242 @@
+#include "dedupe.h"
+#include "diff.h"
+#include "engine.h"
+#include "hash.h"
+#include "parallel.h"
+
+// clang-format off
+#include <winioctl.h>
+// clang-format on
+
+#include <algorithm>
+#include <unordered_map>
+
+// Smaller files save too little to be worth reading twice
+static const ULONGLONG DEDUPE_MIN_SIZE = 4096;
+
+// The most a single clone request can cover. This needs to be a multiple of
+// the cluster size.
+static const ULONGLONG REFLINK_CHUNK_SIZE = 1024 * 1024 * 1024;
+
+// Block cloning was added in Windows 10 and Server 2016, after the version
+// this targets
+#ifndef FSCTL_DUPLICATE_EXTENTS_TO_FILE
+#define FSCTL_DUPLICATE_EXTENTS_TO_FILE                                        \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 209, METHOD_BUFFERED, FILE_WRITE_DATA)
+#endif
+
+struct DuplicateExtentsData {
+  HANDLE fileHandle;
+  LARGE_INTEGER sourceFileOffset;
+  LARGE_INTEGER targetFileOffset;
+  LARGE_INTEGER byteCount;
+};
+
+bool parseDedupe(const std::string &value, Dedupe &mode) {
+  if (value == "reflink") {
+    mode = Dedupe::Reflink;
+  } else if (value == "hardlink") {
+    mode = Dedupe::Hardlink;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+DWORD findDuplicates(const std::vector<FileCopy> &files,
+                     std::vector<size_t> &originals) {
+  originals.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    originals[i] = i;
+  }
+
+  // Only files that share their size with another can be repeats. The sort
+  // is stable, so each group keeps the copy order.
+  std::vector<size_t> bySize;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i].size >= DEDUPE_MIN_SIZE) {
+      bySize.push_back(i);
+    }
+  }
+
+  std::stable_sort(bySize.begin(), bySize.end(), [&](size_t a, size_t b) {
+    return files[a].size < files[b].size;
+  });
+
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i < bySize.size(); i++) {
+    ULONGLONG size = files[bySize[i]].size;
+    if ((i > 0 && files[bySize[i - 1]].size == size) ||
+        (i + 1 < bySize.size() && files[bySize[i + 1]].size == size)) {
+      candidates.push_back(bySize[i]);
+    }
+  }
+
+  std::vector<std::string> digests(files.size());
+  DWORD error = runParallel(candidates.size(), [&](size_t i) {
+    ULONGLONG read = 0;
+    return hashFile(files[candidates[i]].src, HashAlgorithm::Xxh3, false,
+                    digests[candidates[i]], read);
+  });
+  if (error != 0) {
+    return error;
+  }
+
+  // Match each candidate with the first earlier file of the same size and
+  // hash, then compare their bytes in case the hashes collided
+  std::vector<std::pair<size_t, size_t>> matches;
+  std::unordered_map<std::string, size_t> firsts;
+
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (i > 0 && files[candidates[i - 1]].size != files[candidates[i]].size) {
+      firsts.clear();
+    }
+
+    auto inserted = firsts.insert(
+        std::make_pair(digests[candidates[i]], candidates[i]));
+    if (!inserted.second) {
+      matches.push_back(std::make_pair(candidates[i], inserted.first->second));
+    }
+  }
+
+  return runParallel(matches.size(), [&](size_t i) {
+    std::vector<BYTE> buffer;
+    bool equal = false;
+
+    DWORD error = filesEqual(files[matches[i].first].src,
+                             files[matches[i].second].src, buffer, equal);
+    if (error == 0 && equal) {
+      originals[matches[i].first] = matches[i].second;
+    }
+
+    return error;
+  });
+}
+
+/**
+ * Check if an error means the destination can't clone or link files, rather
+ * than that something went wrong
+ */
+static bool isUnsupported(DWORD error) {
+  return error == ERROR_INVALID_FUNCTION || error == ERROR_NOT_SUPPORTED ||
+         error == ERROR_NOT_SAME_DEVICE || error == ERROR_TOO_MANY_LINKS;
+}
+
+/**
+ * Clone the data of `original` into the open, empty file `dest`, a cluster
+ * aligned range at a time
+ */
+static DWORD cloneExtents(HANDLE original, HANDLE dest, const FileCopy &file) {
+  DWORD sectorsPerCluster = 0;
+  DWORD bytesPerSector = 0;
+  DWORD freeClusters = 0;
+  DWORD totalClusters = 0;
+
+  if (!GetDiskFreeSpaceW(volumeRoot(file.dest).c_str(), &sectorsPerCluster,
+                         &bytesPerSector, &freeClusters, &totalClusters)) {
+    return GetLastError();
+  }
+
+  ULONGLONG clusterSize = (ULONGLONG)sectorsPerCluster * bytesPerSector;
+  DWORD returned = 0;
+
+  // Both files have to be sparse or not sparse alike
+  if ((file.attributes & FILE_ATTRIBUTE_SPARSE_FILE) &&
+      !DeviceIoControl(dest, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned,
+                       NULL)) {
+    return GetLastError();
+  }
+
+  // The destination has to be as long as the data cloned into it
+  LARGE_INTEGER size;
+  size.QuadPart = (LONGLONG)file.size;
+  if (!SetFilePointerEx(dest, size, NULL, FILE_BEGIN) || !SetEndOfFile(dest)) {
+    return GetLastError();
+  }
+
+  // The last range is rounded up to a whole cluster, which is allowed since
+  // it ends at the end of the file
+  for (ULONGLONG offset = 0; offset < file.size;
+       offset += REFLINK_CHUNK_SIZE) {
+    ULONGLONG length = std::min(REFLINK_CHUNK_SIZE, file.size - offset);
+
+    DuplicateExtentsData data;
+    data.fileHandle = original;
+    data.sourceFileOffset.QuadPart = (LONGLONG)offset;
+    data.targetFileOffset.QuadPart = (LONGLONG)offset;
+    data.byteCount.QuadPart =
+        (LONGLONG)((length + clusterSize - 1) / clusterSize * clusterSize);
+
+    if (!DeviceIoControl(dest, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &data,
+                         sizeof(data), NULL, 0, &returned, NULL)) {
+      return GetLastError();
+    }
+  }
+
+  FILETIME lastWriteTime;
+  lastWriteTime.dwLowDateTime = (DWORD)file.lastWriteTime;
+  lastWriteTime.dwHighDateTime = (DWORD)(file.lastWriteTime >> 32);
+  if (!SetFileTime(dest, NULL, NULL, &lastWriteTime)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+DWORD cloneFile(const FileCopy &file, const std::wstring &original,
+                Dedupe mode, bool &cloned) {
+  std::wstring partial = partialPathFor(file.dest);
+  DWORD error = 0;
+  cloned = false;
+
+  // Clone or link into a temporary name first, so an existing destination
+  // is only replaced once its new contents are in place
+  DeleteFileW(partial.c_str());
+
+  if (mode == Dedupe::Hardlink) {
+    if (!CreateHardLinkW(partial.c_str(), original.c_str(), NULL)) {
+      error = GetLastError();
+      return isUnsupported(error) ? 0 : error;
+    }
+  } else {
+    HANDLE src = CreateFileW(original.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                             NULL, OPEN_EXISTING, 0, NULL);
+    if (src == INVALID_HANDLE_VALUE) {
+      return GetLastError();
+    }
+
+    HANDLE dest =
+        CreateFileW(partial.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                    CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+    if (dest == INVALID_HANDLE_VALUE) {
+      error = GetLastError();
+      CloseHandle(src);
+      return error;
+    }
+
+    error = cloneExtents(src, dest, file);
+
+    CloseHandle(src);
+    CloseHandle(dest);
+
+    if (error != 0) {
+      DeleteFileW(partial.c_str());
+      return isUnsupported(error) ? 0 : error;
+    }
+  }
+
+  if (!MoveFileExW(partial.c_str(), file.dest.c_str(),
+                   MOVEFILE_REPLACE_EXISTING)) {
+    return GetLastError();
+  }
+
+  // A hard link shares its attributes with the file it links to
+  if (mode == Dedupe::Reflink &&
+      !SetFileAttributesW(file.dest.c_str(), file.attributes)) {
+    return GetLastError();
+  }
+
+  cloned = true;
+  return 0;
+}
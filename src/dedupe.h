@@ -0,0 +1,43 @@
+#pragma once
+
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * How to avoid writing files that are the same as one already copied
+ */
+enum class Dedupe {
+  // Copy every file
+  None,
+  // Clone the earlier copy's data, so the files share storage until one of
+  // them changes (needs ReFS)
+  Reflink,
+  // Hard link to the earlier copy, so both names are the same file
+  Hardlink,
+};
+
+/**
+ * Parse the value of the --dedupe option
+ */
+bool parseDedupe(const std::string &value, Dedupe &mode);
+
+/**
+ * Find the files with the same contents as an earlier file in the list.
+ * Files are grouped by size, then by a hash of their contents, and repeats
+ * are confirmed by comparing their bytes. `originals` is set to the index of
+ * each file's earlier copy, or to the file's own index when it has none.
+ * Returns 0 or a Windows error code.
+ */
+DWORD findDuplicates(const std::vector<FileCopy> &files,
+                     std::vector<size_t> &originals);
+
+/**
+ * Make the destination of `file` a clone of, or link to, the already copied
+ * file at `original`. `cloned` is false when the destination doesn't support
+ * it, and the file should be copied instead. Returns 0 or a Windows error
+ * code.
+ */
+DWORD cloneFile(const FileCopy &file, const std::wstring &original,
+                Dedupe mode, bool &cloned);
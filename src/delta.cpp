@@ -0,0 +1,492 @@
+#include "delta.h"
+#include "engine.h"
+#include "hash.h"
+#include "priority.h"
+#include "throttle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DELTA_USE_SSE2
+#endif
+
+// The size of the blocks the destination is split into. This needs to be a
+// multiple of 16 for the vectorised checksum.
+static const DWORD BLOCK_SIZE = 64 * 1024;
+
+// Smaller files are cheaper to copy whole than to compare
+static const ULONGLONG DELTA_MIN_SIZE = 16ULL * BLOCK_SIZE;
+
+// How much of the source is read at a time while scanning it
+static const size_t SCAN_BUFFER_SIZE = 8 * 1024 * 1024;
+
+// The number of bits in the filter of known checksums, checked before the
+// block table on every byte of the scan
+static const size_t FILTER_BITS = 1 << 20;
+
+/**
+ * The checksums of a single block of the destination
+ */
+struct BlockSignature {
+  DWORD weak;
+  ULONGLONG strong;
+};
+
+/**
+ * A range of the new file, either taken from the old file at `destOffset`
+ * or, when `isLiteral` is set, from the source
+ */
+struct DeltaRange {
+  ULONGLONG srcOffset;
+  ULONGLONG destOffset;
+  ULONGLONG length;
+  bool isLiteral;
+};
+
+/**
+ * Combine the two halves of the rolling checksum, as rsync does
+ */
+static inline DWORD weakChecksum(UINT32 a, UINT32 b) {
+  return (a & 0xFFFF) | (b << 16);
+}
+
+/**
+ * Compute the rolling checksum of a whole block. `a` is the sum of the bytes,
+ * and `b` is the sum of each byte weighted by its distance from the end of
+ * the block. Both wrap around, which the rolling update does too.
+ */
+static void blockChecksum(const BYTE *data, UINT32 &a, UINT32 &b) {
+#ifdef DELTA_USE_SSE2
+  // Each 16 bytes adds its sum to `a`, and `prefix` adds up `a` after each
+  // step, which gives every byte a weight of the number of steps left. The
+  // weights within each step are then taken off with a multiply-add.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lowWeights = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m128i highWeights = _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15);
+
+  __m128i sum = zero;
+  __m128i prefix = zero;
+  __m128i weighted = zero;
+
+  for (DWORD i = 0; i < BLOCK_SIZE; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+
+    sum = _mm_add_epi32(sum, _mm_sad_epu8(bytes, zero));
+    prefix = _mm_add_epi32(prefix, sum);
+
+    weighted = _mm_add_epi32(
+        weighted, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), lowWeights));
+    weighted = _mm_add_epi32(
+        weighted, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), highWeights));
+  }
+
+  UINT32 lanes[4];
+
+  _mm_storeu_si128((__m128i *)lanes, sum);
+  a = lanes[0] + lanes[2];
+
+  _mm_storeu_si128((__m128i *)lanes, prefix);
+  UINT32 prefixTotal = lanes[0] + lanes[2];
+
+  _mm_storeu_si128((__m128i *)lanes, weighted);
+  UINT32 weightedTotal = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+  b = 16 * prefixTotal - weightedTotal;
+#else
+  a = 0;
+  b = 0;
+  for (DWORD i = 0; i < BLOCK_SIZE; i++) {
+    a += data[i];
+    b += (BLOCK_SIZE - i) * data[i];
+  }
+#endif
+}
+
+static inline size_t filterIndex(DWORD weak) {
+  return (size_t)((weak * 0x9E3779B1U) >> 12) & (FILTER_BITS - 1);
+}
+
+bool canCopyDelta(const FileCopy &file) {
+  WIN32_FILE_ATTRIBUTE_DATA dest;
+
+  if (file.size < DELTA_MIN_SIZE ||
+      !GetFileAttributesExW(file.dest.c_str(), GetFileExInfoStandard, &dest)) {
+    return false;
+  }
+
+  ULONGLONG destSize = ((ULONGLONG)dest.nFileSizeHigh << 32) | dest.nFileSizeLow;
+
+  return !(dest.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+         destSize >= DELTA_MIN_SIZE;
+}
+
+/**
+ * Compute the signature of every whole block in the given file. Blocks are
+ * shared between several threads, each reading through its own handle.
+ */
+static DWORD computeSignatures(const std::wstring &path, ULONGLONG size,
+                               std::vector<BlockSignature> &signatures) {
+  signatures.resize((size_t)(size / BLOCK_SIZE));
+
+  // Each thread takes this many blocks at a time, so reads stay large
+  const size_t blocksPerTask = 16;
+
+  std::atomic<size_t> next(0);
+  std::atomic<DWORD> firstError(0);
+
+  auto worker = [&]() {
+    HANDLE file =
+        CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      DWORD none = 0;
+      firstError.compare_exchange_strong(none, GetLastError());
+      return;
+    }
+    setIoPriorityHint(file);
+
+    std::vector<BYTE> data(blocksPerTask * BLOCK_SIZE);
+
+    for (size_t first = next.fetch_add(blocksPerTask);
+         first < signatures.size() && firstError == 0;
+         first = next.fetch_add(blocksPerTask)) {
+      size_t count = std::min(blocksPerTask, signatures.size() - first);
+
+      LARGE_INTEGER position;
+      position.QuadPart = (LONGLONG)first * BLOCK_SIZE;
+      DWORD read = 0;
+
+      if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN) ||
+          !ReadFile(file, data.data(), (DWORD)(count * BLOCK_SIZE), &read,
+                    NULL) ||
+          read != count * BLOCK_SIZE) {
+        DWORD none = 0;
+        firstError.compare_exchange_strong(
+            none, read != count * BLOCK_SIZE ? ERROR_HANDLE_EOF : GetLastError());
+        break;
+      }
+      throttleIo(read);
+
+      for (size_t i = 0; i < count; i++) {
+        const BYTE *block = data.data() + i * BLOCK_SIZE;
+        UINT32 a;
+        UINT32 b;
+        blockChecksum(block, a, b);
+
+        signatures[first + i].weak = weakChecksum(a, b);
+        signatures[first + i].strong = xxh64(block, BLOCK_SIZE);
+      }
+    }
+
+    CloseHandle(file);
+  };
+
+  size_t threadCount =
+      std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()),
+                       signatures.size() / blocksPerTask + 1);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i++) {
+    threads.push_back(startWorker(worker));
+  }
+  worker();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  return firstError;
+}
+
+/**
+ * A window into the source that only moves forward, reading ahead in large
+ * pieces
+ */
+class ScanWindow {
+public:
+  ScanWindow(HANDLE file, ULONGLONG size)
+      : file(file), size(size), data(SCAN_BUFFER_SIZE), start(0), length(0) {}
+
+  /**
+   * Make sure the `count` bytes at `offset` are in the buffer. Earlier
+   * offsets can't be asked for again.
+   */
+  DWORD fill(ULONGLONG offset, size_t count) {
+    if (offset + count <= start + length) {
+      return 0;
+    }
+
+    size_t keep = (size_t)(start + length - offset);
+    memmove(data.data(), data.data() + (offset - start), keep);
+    start = offset;
+    length = keep;
+
+    while (length < data.size() && start + length < size) {
+      DWORD read = 0;
+      if (!ReadFile(file, data.data() + length, (DWORD)(data.size() - length),
+                    &read, NULL)) {
+        return GetLastError();
+      }
+      throttleIo(read);
+      if (read == 0) {
+        return ERROR_HANDLE_EOF;
+      }
+      length += read;
+    }
+
+    return offset + count <= start + length ? 0 : ERROR_HANDLE_EOF;
+  }
+
+  const BYTE *at(ULONGLONG offset) const {
+    return data.data() + (offset - start);
+  }
+
+private:
+  HANDLE file;
+  ULONGLONG size;
+  std::vector<BYTE> data;
+  ULONGLONG start;
+  size_t length;
+};
+
+/**
+ * Add a range to the list, joining it to the one before when they follow on
+ */
+static void addRange(std::vector<DeltaRange> &ranges, ULONGLONG srcOffset,
+                     ULONGLONG destOffset, ULONGLONG length, bool isLiteral) {
+  if (length == 0) {
+    return;
+  }
+
+  if (!ranges.empty()) {
+    DeltaRange &last = ranges.back();
+    if (last.isLiteral == isLiteral &&
+        last.srcOffset + last.length == srcOffset &&
+        (isLiteral || last.destOffset + last.length == destOffset)) {
+      last.length += length;
+      return;
+    }
+  }
+
+  DeltaRange range;
+  range.srcOffset = srcOffset;
+  range.destOffset = destOffset;
+  range.length = length;
+  range.isLiteral = isLiteral;
+  ranges.push_back(range);
+}
+
+/**
+ * Scan the source for blocks of the destination, rolling the checksum along
+ * one byte at a time between matches
+ */
+static DWORD findMatches(HANDLE src, ULONGLONG size,
+                         const std::vector<BlockSignature> &signatures,
+                         std::vector<DeltaRange> &ranges) {
+  std::vector<bool> filter(FILTER_BITS);
+  std::unordered_multimap<DWORD, size_t> blocks;
+  blocks.reserve(signatures.size());
+
+  for (size_t i = 0; i < signatures.size(); i++) {
+    filter[filterIndex(signatures[i].weak)] = true;
+    blocks.insert(std::make_pair(signatures[i].weak, i));
+  }
+
+  ScanWindow window(src, size);
+  ULONGLONG offset = 0;
+  ULONGLONG literalStart = 0;
+  bool haveChecksum = false;
+  UINT32 a = 0;
+  UINT32 b = 0;
+
+  while (offset + BLOCK_SIZE <= size) {
+    bool canRoll = offset + BLOCK_SIZE < size;
+    DWORD error = window.fill(offset, BLOCK_SIZE + (canRoll ? 1 : 0));
+    if (error != 0) {
+      return error;
+    }
+
+    if (!haveChecksum) {
+      blockChecksum(window.at(offset), a, b);
+      haveChecksum = true;
+    }
+
+    DWORD weak = weakChecksum(a, b);
+    size_t match = SIZE_MAX;
+
+    if (filter[filterIndex(weak)]) {
+      auto candidates = blocks.equal_range(weak);
+      if (candidates.first != candidates.second) {
+        ULONGLONG strong = xxh64(window.at(offset), BLOCK_SIZE);
+
+        // Prefer the block that's already at this offset, so unchanged
+        // parts of the file don't have to move
+        for (auto it = candidates.first; it != candidates.second; it++) {
+          if (signatures[it->second].strong == strong &&
+              (match == SIZE_MAX ||
+               (ULONGLONG)it->second * BLOCK_SIZE == offset)) {
+            match = it->second;
+          }
+        }
+      }
+    }
+
+    if (match != SIZE_MAX) {
+      addRange(ranges, literalStart, literalStart, offset - literalStart, true);
+      addRange(ranges, offset, (ULONGLONG)match * BLOCK_SIZE, BLOCK_SIZE,
+               false);
+
+      offset += BLOCK_SIZE;
+      literalStart = offset;
+      haveChecksum = false;
+      continue;
+    }
+
+    if (!canRoll) {
+      break;
+    }
+
+    BYTE out = *window.at(offset);
+    BYTE in = *window.at(offset + BLOCK_SIZE);
+    a += in - out;
+    b += a - BLOCK_SIZE * out;
+    offset++;
+  }
+
+  addRange(ranges, literalStart, literalStart, size - literalStart, true);
+
+  return 0;
+}
+
+/**
+ * Set the time and attributes of the finished file
+ */
+static DWORD finishFile(HANDLE handle, const FileCopy &file) {
+  FILETIME lastWriteTime;
+  lastWriteTime.dwLowDateTime = (DWORD)file.lastWriteTime;
+  lastWriteTime.dwHighDateTime = (DWORD)(file.lastWriteTime >> 32);
+
+  LARGE_INTEGER size;
+  size.QuadPart = (LONGLONG)file.size;
+
+  if (!SetFilePointerEx(handle, size, NULL, FILE_BEGIN) ||
+      !SetEndOfFile(handle) ||
+      !SetFileTime(handle, NULL, NULL, &lastWriteTime)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+DWORD copyDelta(const FileCopy &file, std::vector<BYTE> &buffer,
+                bool atomic) {
+  WIN32_FILE_ATTRIBUTE_DATA destData;
+  if (!GetFileAttributesExW(file.dest.c_str(), GetFileExInfoStandard,
+                            &destData)) {
+    return GetLastError();
+  }
+
+  ULONGLONG destSize =
+      ((ULONGLONG)destData.nFileSizeHigh << 32) | destData.nFileSizeLow;
+
+  std::vector<BlockSignature> signatures;
+  DWORD error = computeSignatures(file.dest, destSize, signatures);
+  if (error != 0) {
+    return error;
+  }
+
+  HANDLE src =
+      CreateFileW(file.src.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (src == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+  setIoPriorityHint(src);
+
+  std::vector<DeltaRange> ranges;
+  error = findMatches(src, file.size, signatures, ranges);
+
+  // Blocks that are all where they were leave only the changed ranges to
+  // write, which can be done in place. An atomic copy never shows a partly
+  // updated file, so it always rebuilds into a temporary one.
+  bool inPlace = !atomic;
+  for (const DeltaRange &range : ranges) {
+    if (!range.isLiteral && range.srcOffset != range.destOffset) {
+      inPlace = false;
+      break;
+    }
+  }
+
+  // The old file has to stay readable while its blocks are copied into the
+  // temporary one
+  std::wstring target = inPlace ? file.dest : partialPathFor(file.dest);
+  HANDLE dest = INVALID_HANDLE_VALUE;
+  HANDLE old = INVALID_HANDLE_VALUE;
+
+  if (error == 0) {
+    dest = CreateFileW(target.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                       inPlace ? OPEN_EXISTING : CREATE_ALWAYS,
+                       inPlace ? 0 : FILE_ATTRIBUTE_HIDDEN, NULL);
+    if (dest == INVALID_HANDLE_VALUE) {
+      error = GetLastError();
+    } else {
+      setIoPriorityHint(dest);
+    }
+  }
+
+  if (error == 0 && !inPlace) {
+    old = CreateFileW(file.dest.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                      OPEN_EXISTING, 0, NULL);
+    if (old == INVALID_HANDLE_VALUE) {
+      error = GetLastError();
+    } else {
+      setIoPriorityHint(old);
+    }
+  }
+
+  for (const DeltaRange &range : ranges) {
+    if (error != 0) {
+      break;
+    }
+
+    if (range.isLiteral) {
+      error = copyRange(src, range.srcOffset, dest, range.srcOffset,
+                        range.length, buffer);
+    } else if (!inPlace) {
+      error = copyRange(old, range.destOffset, dest, range.srcOffset,
+                        range.length, buffer);
+    }
+  }
+
+  if (error == 0) {
+    error = finishFile(dest, file);
+  }
+
+  CloseHandle(src);
+  if (dest != INVALID_HANDLE_VALUE) {
+    CloseHandle(dest);
+  }
+  if (old != INVALID_HANDLE_VALUE) {
+    CloseHandle(old);
+  }
+
+  if (error != 0) {
+    if (!inPlace) {
+      DeleteFileW(target.c_str());
+    }
+    return error;
+  }
+
+  if ((!inPlace && !MoveFileExW(target.c_str(), file.dest.c_str(),
+                                MOVEFILE_REPLACE_EXISTING)) ||
+      !SetFileAttributesW(file.dest.c_str(), file.attributes)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "paths.h"
+
+#include <vector>
+
+/**
+ * Check if the given file can be copied as a delta against what's already at
+ * its destination
+ */
+bool canCopyDelta(const FileCopy &file);
+
+/**
+ * Copy a file over an older version of itself, writing only what changed.
+ * The destination is split into blocks, each with a rolling checksum and a
+ * strong hash, and the source is scanned for those blocks at every offset.
+ * When every block is found where it already is, only the changed ranges are
+ * written in place, unless `atomic` is set. Otherwise the file is rebuilt into
+ * a temporary file from the blocks of the old one and the changed ranges of
+ * the new one, then renamed into place. Returns 0 or a Windows error code.
+ */
+DWORD copyDelta(const FileCopy &file, std::vector<BYTE> &buffer, bool atomic);
@@ -0,0 +1,410 @@
+#include "diff.h"
+#include "paths.h"
+#include "priority.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DIFF_USE_SSE2
+#endif
+
+// The size of each read when comparing contents
+static const DWORD COMPARE_READ_SIZE = 1024 * 1024;
+
+/**
+ * Check if two buffers hold the same bytes, 64 bytes at a time
+ */
+static bool bytesEqual(const BYTE *a, const BYTE *b, size_t length) {
+  size_t i = 0;
+
+#ifdef DIFF_USE_SSE2
+  for (; i + 64 <= length; i += 64) {
+    __m128i equal0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                    _mm_loadu_si128((const __m128i *)(b + i)));
+    __m128i equal1 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                       _mm_loadu_si128((const __m128i *)(b + i + 16)));
+    __m128i equal2 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+                       _mm_loadu_si128((const __m128i *)(b + i + 32)));
+    __m128i equal3 =
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+                       _mm_loadu_si128((const __m128i *)(b + i + 48)));
+
+    __m128i all = _mm_and_si128(_mm_and_si128(equal0, equal1),
+                                _mm_and_si128(equal2, equal3));
+    if (_mm_movemask_epi8(all) != 0xFFFF) {
+      return false;
+    }
+  }
+#endif
+
+  return memcmp(a + i, b + i, length - i) == 0;
+}
+
+/**
+ * Read up to `length` bytes, stopping early only at the end of the file
+ */
+static DWORD readFully(HANDLE file, BYTE *buffer, DWORD length, DWORD &read) {
+  read = 0;
+
+  while (read < length) {
+    DWORD got = 0;
+    if (!ReadFile(file, buffer + read, length - read, &got, NULL)) {
+      return GetLastError();
+    }
+    if (got == 0) {
+      break;
+    }
+    read += got;
+  }
+
+  return 0;
+}
+
+DWORD filesEqual(const std::wstring &left, const std::wstring &right,
+                 std::vector<BYTE> &buffer, bool &equal) {
+  buffer.resize(std::max<size_t>(buffer.size(), 2 * COMPARE_READ_SIZE));
+
+  HANDLE leftFile =
+      CreateFileW(left.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (leftFile == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  HANDLE rightFile =
+      CreateFileW(right.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (rightFile == INVALID_HANDLE_VALUE) {
+    DWORD error = GetLastError();
+    CloseHandle(leftFile);
+    return error;
+  }
+
+  setIoPriorityHint(leftFile);
+  setIoPriorityHint(rightFile);
+
+  BYTE *leftBuffer = buffer.data();
+  BYTE *rightBuffer = buffer.data() + COMPARE_READ_SIZE;
+  DWORD error = 0;
+  equal = true;
+
+  while (equal) {
+    DWORD leftRead = 0;
+    DWORD rightRead = 0;
+
+    error = readFully(leftFile, leftBuffer, COMPARE_READ_SIZE, leftRead);
+    if (error == 0) {
+      error = readFully(rightFile, rightBuffer, COMPARE_READ_SIZE, rightRead);
+    }
+    if (error != 0) {
+      break;
+    }
+
+    equal = leftRead == rightRead &&
+            bytesEqual(leftBuffer, rightBuffer, leftRead);
+
+    if (leftRead < COMPARE_READ_SIZE) {
+      break;
+    }
+  }
+
+  CloseHandle(leftFile);
+  CloseHandle(rightFile);
+
+  return error;
+}
+
+/**
+ * A change found in a directory, or a file whose contents still need to be
+ * compared to know if it's changed
+ */
+struct PendingChange {
+  DiffChange change;
+  std::wstring path;
+  bool isDirectory;
+  bool needsContents;
+};
+
+/**
+ * The threads that compare file contents, started once for the whole walk.
+ * The walk itself stays on one thread, and hands each directory's files to
+ * the pool as a batch that it helps with and waits for.
+ */
+class ComparePool {
+public:
+  ComparePool(const std::wstring &left, const std::wstring &right)
+      : left(left), right(right) {}
+
+  ~ComparePool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    ready.notify_all();
+
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  }
+
+  /**
+   * Compare the contents of the files that need it. Files that turn out to be
+   * the same are marked as not changed.
+   */
+  DWORD compare(const std::vector<PendingChange> &changes,
+                std::vector<char> &unchanged) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    candidates.clear();
+    for (size_t i = 0; i < changes.size(); i++) {
+      if (changes[i].needsContents) {
+        candidates.push_back(i);
+      }
+    }
+    if (candidates.empty()) {
+      return 0;
+    }
+
+    // Nothing is started for trees whose files never need their contents
+    // compared
+    if (threads.empty()) {
+      unsigned int count = std::max(1U, std::thread::hardware_concurrency());
+      for (unsigned int i = 1; i < count; i++) {
+        threads.push_back(startWorker([this]() { work(); }));
+      }
+    }
+
+    batch = &changes;
+    results = &unchanged;
+    next = 0;
+    firstError = 0;
+    ready.notify_all();
+
+    takeWork(ownBuffer, lock);
+    done.wait(lock, [this]() { return busy == 0; });
+
+    batch = NULL;
+    results = NULL;
+    return firstError;
+  }
+
+private:
+  bool hasWork() const {
+    return batch != NULL && next < candidates.size() && firstError == 0;
+  }
+
+  /**
+   * Compare files from the current batch until none are left. Called with the
+   * lock held, which is let go during each comparison.
+   */
+  void takeWork(std::vector<BYTE> &buffer,
+                std::unique_lock<std::mutex> &lock) {
+    while (hasWork()) {
+      size_t index = candidates[next++];
+      const PendingChange &change = (*batch)[index];
+      busy++;
+
+      lock.unlock();
+      bool equal = false;
+      DWORD error = filesEqual(joinPath(left, change.path),
+                               joinPath(right, change.path), buffer, equal);
+      lock.lock();
+
+      busy--;
+      if (error != 0 && firstError == 0) {
+        firstError = error;
+      }
+      (*results)[index] = equal;
+    }
+
+    if (busy == 0) {
+      done.notify_all();
+    }
+  }
+
+  void work() {
+    std::vector<BYTE> buffer;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+      ready.wait(lock, [this]() { return stopping || hasWork(); });
+      if (stopping) {
+        return;
+      }
+      takeWork(buffer, lock);
+    }
+  }
+
+  const std::wstring &left;
+  const std::wstring &right;
+  std::vector<std::thread> threads;
+  // The calling thread's buffer
+  std::vector<BYTE> ownBuffer;
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::condition_variable done;
+  bool stopping = false;
+
+  // The batch being compared, if any
+  const std::vector<PendingChange> *batch = NULL;
+  std::vector<char> *results = NULL;
+  std::vector<size_t> candidates;
+  size_t next = 0;
+  // Comparisons running outside the lock
+  size_t busy = 0;
+  DWORD firstError = 0;
+};
+
+/**
+ * Compare a single directory that's in both trees, and report its changes in
+ * name order. Directories in both are added to `subdirs` to be compared next.
+ */
+static DWORD diffDirectory(const std::wstring &left, const std::wstring &right,
+                           const std::wstring &relative, ComparePool &pool,
+                           const DiffCallback &callback,
+                           std::vector<std::wstring> &subdirs) {
+  std::wstring leftDir = relative.empty() ? left : joinPath(left, relative);
+  std::wstring rightDir = relative.empty() ? right : joinPath(right, relative);
+
+  std::vector<WIN32_FIND_DATAW> leftEntries;
+  std::vector<WIN32_FIND_DATAW> rightEntries;
+
+  DWORD error = listDirectory(leftDir, leftEntries);
+  if (error == 0) {
+    error = listDirectory(rightDir, rightEntries);
+  }
+  if (error != 0) {
+    return error;
+  }
+
+  sortByName(leftEntries);
+  sortByName(rightEntries);
+
+  std::vector<PendingChange> changes;
+  size_t i = 0;
+  size_t j = 0;
+
+  while (i < leftEntries.size() || j < rightEntries.size()) {
+    int order;
+    if (i == leftEntries.size()) {
+      order = 1;
+    } else if (j == rightEntries.size()) {
+      order = -1;
+    } else {
+      order = compareNames(leftEntries[i].cFileName, rightEntries[j].cFileName);
+    }
+
+    const WIN32_FIND_DATAW &entry =
+        order > 0 ? rightEntries[j] : leftEntries[i];
+
+    PendingChange change;
+    change.path = relative.empty() ? std::wstring(entry.cFileName)
+                                   : joinPath(relative, entry.cFileName);
+    change.isDirectory = isWalkableDirectory(entry);
+    change.needsContents = false;
+
+    if (order < 0) {
+      change.change = DiffChange::Removed;
+      changes.push_back(change);
+      i++;
+      continue;
+    }
+
+    if (order > 0) {
+      change.change = DiffChange::Added;
+      changes.push_back(change);
+      j++;
+      continue;
+    }
+
+    const WIN32_FIND_DATAW &leftEntry = leftEntries[i++];
+    const WIN32_FIND_DATAW &rightEntry = rightEntries[j++];
+    change.change = DiffChange::Modified;
+
+    if (isWalkableDirectory(leftEntry) != isWalkableDirectory(rightEntry)) {
+      changes.push_back(change);
+    } else if (change.isDirectory) {
+      subdirs.push_back(change.path);
+    } else if (fileSizeOf(leftEntry) != fileSizeOf(rightEntry)) {
+      changes.push_back(change);
+    } else if (fileTimeToTicks(leftEntry.ftLastWriteTime) !=
+               fileTimeToTicks(rightEntry.ftLastWriteTime)) {
+      change.needsContents = true;
+      changes.push_back(change);
+    }
+  }
+
+  std::vector<char> unchanged(changes.size(), 0);
+  error = pool.compare(changes, unchanged);
+  if (error != 0) {
+    return error;
+  }
+
+  for (size_t k = 0; k < changes.size(); k++) {
+    if (!unchanged[k]) {
+      callback(changes[k].change, changes[k].path, changes[k].isDirectory);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * A directory being compared, and the directories in it still to compare
+ */
+struct DiffFrame {
+  std::vector<std::wstring> subdirs;
+  size_t next;
+};
+
+DWORD diffTrees(const std::wstring &left, const std::wstring &right,
+                const DiffCallback &callback) {
+  WIN32_FIND_DATAW leftRoot;
+  WIN32_FIND_DATAW rightRoot;
+
+  if (!statPath(left, leftRoot) || !statPath(right, rightRoot)) {
+    return GetLastError();
+  }
+
+  if (!isWalkableDirectory(leftRoot) || !isWalkableDirectory(rightRoot)) {
+    return ERROR_DIRECTORY;
+  }
+
+  // Only the directories on the path to the current one are kept, each with
+  // the names of its subdirectories that are in both trees
+  std::vector<DiffFrame> stack(1);
+  stack.back().next = 0;
+
+  ComparePool pool(left, right);
+  DWORD error =
+      diffDirectory(left, right, L"", pool, callback, stack.back().subdirs);
+
+  while (error == 0 && !stack.empty()) {
+    DiffFrame &frame = stack.back();
+
+    if (frame.next == frame.subdirs.size()) {
+      stack.pop_back();
+      continue;
+    }
+
+    std::wstring relative = frame.subdirs[frame.next++];
+
+    DiffFrame child;
+    child.next = 0;
+    error =
+        diffDirectory(left, right, relative, pool, callback, child.subdirs);
+    stack.push_back(std::move(child));
+  }
+
+  return error;
+}
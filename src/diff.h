@@ -0,0 +1,46 @@
+#pragma once
+
+#include "platform.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * How an entry differs between two trees
+ */
+enum class DiffChange {
+  // Only in the right tree
+  Added,
+  // Only in the left tree
+  Removed,
+  // In both, but with different contents, or a file on one side and a
+  // directory on the other
+  Modified,
+};
+
+/**
+ * Called for each entry that differs, with its path relative to the roots.
+ * Entries only on one side are reported once, without their contents.
+ */
+typedef std::function<void(DiffChange change, const std::wstring &path,
+                           bool isDirectory)>
+    DiffCallback;
+
+/**
+ * Check if two files have the same contents, reading both in large chunks.
+ * The buffer is grown to fit the chunks. Returns 0 or a Windows error code.
+ */
+DWORD filesEqual(const std::wstring &left, const std::wstring &right,
+                 std::vector<BYTE> &buffer, bool &equal);
+
+/**
+ * Compare the directories at `left` and `right`. Both trees are walked
+ * together, depth first, so memory grows with the depth of the trees rather
+ * than the number of entries. Files with different sizes are modified, files
+ * with the same size and modification time are taken as unchanged, and the
+ * rest have their contents compared. Changes are reported in name order
+ * within each directory. Returns 0 or a Windows error code.
+ */
+DWORD diffTrees(const std::wstring &left, const std::wstring &right,
+                const DiffCallback &callback);
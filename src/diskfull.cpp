@@ -0,0 +1,168 @@
+#include "diskfull.h"
+#include "paths.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// How long to wait before the first check of a full volume, and at most
+// between checks after that
+static const DWORD FIRST_POLL_DELAY = 1000;
+static const DWORD MAX_POLL_DELAY = 60 * 1000;
+
+static std::atomic<bool> waitingEnabled(false);
+
+/**
+ * Writers waiting for space on one volume. Only one of them polls, and the
+ * rest wait for it to see space come back.
+ */
+struct VolumeGate {
+  std::mutex mutex;
+  std::condition_variable resumed;
+  bool polling = false;
+};
+
+static std::mutex gatesMutex;
+static std::map<std::wstring, std::shared_ptr<VolumeGate>> gates;
+
+bool isOutOfSpace(DWORD error) {
+  return error == ERROR_DISK_FULL || error == ERROR_HANDLE_DISK_FULL ||
+         error == ERROR_DISK_QUOTA_EXCEEDED;
+}
+
+void setWaitForSpace(bool enabled) { waitingEnabled = enabled; }
+
+static std::shared_ptr<VolumeGate> gateFor(const std::wstring &volume) {
+  std::lock_guard<std::mutex> lock(gatesMutex);
+
+  std::shared_ptr<VolumeGate> &gate = gates[volume];
+  if (gate == NULL) {
+    gate = std::make_shared<VolumeGate>();
+  }
+
+  return gate;
+}
+
+/**
+ * Poll the free space of a volume until there's enough, doubling the delay
+ * between checks each time
+ */
+static DWORD pollForSpace(const std::wstring &volume, ULONGLONG needed) {
+  std::cout << "paused " << needed << " " << toUtf8(volume) << std::endl;
+
+  ULONGLONG start = GetTickCount64();
+  DWORD delay = FIRST_POLL_DELAY;
+  DWORD error = 0;
+
+  while (true) {
+    Sleep(delay);
+    delay = std::min(delay * 2, MAX_POLL_DELAY);
+
+    ULARGE_INTEGER available;
+    if (!GetDiskFreeSpaceExW(volume.c_str(), &available, NULL, NULL)) {
+      error = GetLastError();
+      break;
+    }
+
+    if (available.QuadPart >= needed) {
+      break;
+    }
+  }
+
+  if (error == 0) {
+    std::cout << "resumed " << (GetTickCount64() - start) / 1000 << " "
+              << toUtf8(volume) << std::endl;
+  }
+
+  return error;
+}
+
+/**
+ * Wait for space on the volume with the given root
+ */
+static DWORD waitOnVolume(const std::wstring &volume, ULONGLONG needed) {
+  std::shared_ptr<VolumeGate> gate = gateFor(volume);
+  std::unique_lock<std::mutex> lock(gate->mutex);
+
+  // Someone else is already polling, so try again once they see space
+  if (gate->polling) {
+    gate->resumed.wait(lock, [&]() { return !gate->polling; });
+    return 0;
+  }
+
+  gate->polling = true;
+  lock.unlock();
+
+  DWORD error = pollForSpace(volume, needed);
+
+  lock.lock();
+  gate->polling = false;
+  gate->resumed.notify_all();
+
+  return error;
+}
+
+/**
+ * Get the root of the volume a path is on. Long paths are looked up in their
+ * \\?\ form, and drive and share roots are returned without it, so each
+ * volume has one gate.
+ */
+static std::wstring volumeOf(const std::wstring &path) {
+  std::wstring extended = path;
+  if (path.length() >= MAX_PATH && path.compare(0, 4, L"\\\\?\\") != 0) {
+    extended = path.compare(0, 2, L"\\\\") == 0
+                   ? L"\\\\?\\UNC" + path.substr(1)
+                   : L"\\\\?\\" + path;
+  }
+
+  std::wstring root = volumeRoot(extended);
+  if (root.compare(0, 8, L"\\\\?\\UNC\\") == 0) {
+    return L"\\" + root.substr(7);
+  } else if (root.compare(0, 4, L"\\\\?\\") == 0 && root.length() > 5 &&
+             root[5] == L':') {
+    return root.substr(4);
+  }
+
+  return root;
+}
+
+DWORD waitForSpace(const std::wstring &path, ULONGLONG needed, DWORD error) {
+  if (!waitingEnabled || !isOutOfSpace(error)) {
+    return error;
+  }
+
+  std::wstring volume = volumeOf(path);
+  if (volume.empty()) {
+    return error;
+  }
+
+  DWORD waitError = waitOnVolume(volume, needed);
+  return waitError != 0 ? error : 0;
+}
+
+DWORD waitForSpace(HANDLE file, ULONGLONG needed, DWORD error) {
+  if (!waitingEnabled || !isOutOfSpace(error)) {
+    return error;
+  }
+
+  // The path comes back in its \\?\ form, which can be any length, so the
+  // first call only asks how long it is
+  DWORD length = GetFinalPathNameByHandleW(file, NULL, 0, VOLUME_NAME_DOS);
+  if (length == 0) {
+    return error;
+  }
+
+  std::vector<wchar_t> path(length);
+  length = GetFinalPathNameByHandleW(file, path.data(), length,
+                                     VOLUME_NAME_DOS);
+  if (length == 0 || length >= path.size()) {
+    return error;
+  }
+
+  return waitForSpace(std::wstring(path.data(), length), needed, error);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+
+/**
+ * Check if an error means a volume, or the user's quota on it, is full
+ */
+bool isOutOfSpace(DWORD error);
+
+/**
+ * Turn waiting for space on or off. While it's off, waitForSpace() just
+ * returns the error it's given.
+ */
+void setWaitForSpace(bool enabled);
+
+/**
+ * If `error` means the volume holding the open file is full and waiting is
+ * on, wait until `needed` bytes are free and return 0 so the write can be
+ * tried again from the same place. Otherwise return `error`.
+ *
+ * The volume's free space is polled with a growing delay, and a `paused` and
+ * a `resumed` line are printed. Writers that run out of space on the same
+ * volume while it's being polled wait for the same poll. Files are copied
+ * one at a time, so the whole operation pauses, including files bound for
+ * other volumes.
+ */
+DWORD waitForSpace(HANDLE file, ULONGLONG needed, DWORD error);
+
+/**
+ * The same as the other waitForSpace(), for a file that isn't open
+ */
+DWORD waitForSpace(const std::wstring &path, ULONGLONG needed, DWORD error);
@@ -0,0 +1,265 @@
+#include "durability.h"
+#include "priority.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+#include <thread>
+
+// A batch is flushed once it has this many files or bytes, whichever is first
+static const size_t BATCH_MAX_FILES = 512;
+static const ULONGLONG BATCH_MAX_BYTES = 256ULL * 1024 * 1024;
+
+/**
+ * The files and directories on a single volume that need flushing
+ */
+struct FlushSet {
+  std::vector<std::wstring> files;
+  std::vector<ULONGLONG> sizes;
+  std::set<std::wstring> dirs;
+};
+
+bool parseDurability(const std::string &value, Durability &mode) {
+  if (value == "none") {
+    mode = Durability::None;
+  } else if (value == "file") {
+    mode = Durability::File;
+  } else if (value == "batch") {
+    mode = Durability::Batch;
+  } else if (value == "end") {
+    mode = Durability::End;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Flush a single file or directory. Directories on file systems that can't
+ * flush them are skipped, since there's nothing more we can do there.
+ */
+static DWORD flushPath(const std::wstring &path, bool isDirectory) {
+  HANDLE handle = CreateFileW(
+      path.c_str(), GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+      OPEN_EXISTING,
+      isDirectory ? FILE_FLAG_BACKUP_SEMANTICS : FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    DWORD error = GetLastError();
+
+    // Read-only files can't be opened for writing, so clear the attribute
+    // for as long as it takes to flush
+    DWORD attributes = GetFileAttributesW(path.c_str());
+    if (!isDirectory && error == ERROR_ACCESS_DENIED &&
+        attributes != INVALID_FILE_ATTRIBUTES &&
+        (attributes & FILE_ATTRIBUTE_READONLY)) {
+      SetFileAttributesW(path.c_str(), attributes & ~FILE_ATTRIBUTE_READONLY);
+      error = flushPath(path, false);
+      SetFileAttributesW(path.c_str(), attributes);
+    }
+
+    return error;
+  }
+
+  DWORD error = 0;
+  if (!FlushFileBuffers(handle)) {
+    error = GetLastError();
+    if (isDirectory &&
+        (error == ERROR_INVALID_FUNCTION || error == ERROR_NOT_SUPPORTED)) {
+      error = 0;
+    }
+  }
+
+  CloseHandle(handle);
+
+  return error;
+}
+
+/**
+ * Flush the given paths from several threads at once, so the device can
+ * service the flushes together instead of one after the other
+ */
+static DWORD flushAll(const std::vector<std::wstring> &paths,
+                      bool isDirectory) {
+  std::atomic<size_t> next(0);
+  std::atomic<DWORD> firstError(0);
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < paths.size() && firstError == 0; i = next++) {
+      DWORD error = flushPath(paths[i], isDirectory);
+      if (error != 0) {
+        DWORD none = 0;
+        firstError.compare_exchange_strong(none, error);
+      }
+    }
+  };
+
+  size_t threadCount =
+      std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()),
+                       paths.size());
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i++) {
+    threads.push_back(startWorker(worker));
+  }
+  worker();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  return firstError;
+}
+
+/**
+ * Flush a whole volume, which writes back everything cached for it in one go
+ */
+static DWORD flushVolume(const std::wstring &root) {
+  wchar_t volumeName[MAX_PATH];
+  if (!GetVolumeNameForVolumeMountPointW(root.c_str(), volumeName, MAX_PATH)) {
+    return GetLastError();
+  }
+
+  // The volume name ends with a backslash, which would open the root
+  // directory instead of the volume itself
+  std::wstring device = volumeName;
+  device.pop_back();
+
+  HANDLE handle = CreateFileW(device.c_str(), GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, 0, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  DWORD error = FlushFileBuffers(handle) ? 0 : GetLastError();
+  CloseHandle(handle);
+
+  return error;
+}
+
+/**
+ * Add every file and directory in the tree at the given root to the set
+ */
+static DWORD collect(const std::wstring &root, bool directoriesOnly,
+                     FlushSet &set) {
+  return walkTree(root, [&](const std::wstring &path,
+                            const WIN32_FIND_DATAW &data) {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      set.dirs.insert(path);
+    } else if (!directoriesOnly) {
+      set.files.push_back(path);
+      set.sizes.push_back(fileSizeOf(data));
+    }
+    return true;
+  });
+}
+
+/**
+ * Flush each file followed by its parent directory
+ */
+static DWORD flushEachFile(const FlushSet &set) {
+  for (const std::wstring &file : set.files) {
+    DWORD error = flushPath(file, false);
+    if (error == 0) {
+      error = flushPath(parentPath(file), true);
+    }
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  // Catch the directories that have no files, and the parents of the roots
+  for (const std::wstring &dir : set.dirs) {
+    DWORD error = flushPath(dir, true);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Flush files in parallel batches, then flush every directory once
+ */
+static DWORD flushInBatches(const FlushSet &set) {
+  std::vector<std::wstring> batch;
+  ULONGLONG batchBytes = 0;
+
+  for (size_t i = 0; i < set.files.size(); i++) {
+    batch.push_back(set.files[i]);
+    batchBytes += set.sizes[i];
+
+    if (batch.size() >= BATCH_MAX_FILES || batchBytes >= BATCH_MAX_BYTES ||
+        i == set.files.size() - 1) {
+      DWORD error = flushAll(batch, false);
+      if (error != 0) {
+        return error;
+      }
+
+      batch.clear();
+      batchBytes = 0;
+    }
+  }
+
+  // Every entry exists by now, so one flush per directory covers them all
+  std::vector<std::wstring> dirs(set.dirs.begin(), set.dirs.end());
+  return flushAll(dirs, true);
+}
+
+DWORD makeDurable(const std::string &action, const std::vector<Target> &targets,
+                  Durability mode, bool directoriesOnly) {
+  if (mode == Durability::None) {
+    return 0;
+  }
+
+  // Group everything by volume, so `end` can flush each volume just once
+  std::map<std::wstring, FlushSet> volumes;
+
+  for (const Target &target : targets) {
+    if (action != "delete") {
+      FlushSet &set = volumes[volumeRoot(target.dest)];
+      set.dirs.insert(parentPath(target.dest));
+
+      DWORD error = collect(target.dest, directoriesOnly, set);
+      if (error != 0) {
+        return error;
+      }
+    }
+
+    // Moves and deletes also change the source's parent directory
+    if (action != "copy") {
+      volumes[volumeRoot(target.src)].dirs.insert(parentPath(target.src));
+    }
+  }
+
+  for (auto &volume : volumes) {
+    Durability volumeMode = mode;
+
+    if (volumeMode == Durability::End) {
+      DWORD error = flushVolume(volume.first);
+      if (error == 0) {
+        continue;
+      } else if (error != ERROR_ACCESS_DENIED) {
+        return error;
+      }
+
+      // Flushing a volume needs admin rights, so make do with batches
+      volumeMode = Durability::Batch;
+    }
+
+    DWORD error = volumeMode == Durability::File
+                      ? flushEachFile(volume.second)
+                      : flushInBatches(volume.second);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * How hard to try to get the results of an operation onto stable storage
+ * before reporting success
+ */
+enum class Durability {
+  // Leave it to the OS to write back cached data whenever it likes
+  None,
+  // Flush each file and then its parent directory, one at a time
+  File,
+  // Flush files in parallel groups, flushing each directory only once
+  Batch,
+  // Flush each destination volume once at the end (needs admin rights,
+  // falls back to Batch otherwise)
+  End,
+};
+
+/**
+ * Parse the value of the --durability option
+ */
+bool parseDurability(const std::string &value, Durability &mode);
+
+/**
+ * Flush the results of a finished operation to stable storage using the given
+ * mode. When `directoriesOnly` is set, file data is assumed to be flushed
+ * already and only directory entries are flushed.
+ * Returns 0 or a Windows error code.
+ */
+DWORD makeDurable(const std::string &action, const std::vector<Target> &targets,
+                  Durability mode, bool directoriesOnly = false);
@@ -0,0 +1,754 @@
+#include "engine.h"
+#include "dedupe.h"
+#include "delta.h"
+#include "diskfull.h"
+#include "hardlinks.h"
+#include "ignore.h"
+#include "journal.h"
+#include "links.h"
+#include "manifest.h"
+#include "preserve.h"
+#include "priority.h"
+#include "throttle.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+
+// Large files are copied in chunks of this size, and the journal records
+// progress at chunk boundaries
+static const DWORD CHUNK_SIZE = 64 * 1024 * 1024;
+static const ULONGLONG LARGE_FILE_SIZE = 2ULL * CHUNK_SIZE;
+
+// The size of each read and write within a chunk
+static const DWORD IO_SIZE = 1024 * 1024;
+
+// How many finished small files to record between journal flushes
+static const size_t JOURNAL_FLUSH_FILES = 256;
+
+std::wstring partialPathFor(const std::wstring &dest) {
+  return joinPath(parentPath(dest), L"." + baseName(dest) + L".fileops-part");
+}
+
+/**
+ * An entry found while expanding targets, waiting to be looked at
+ */
+struct PendingEntry {
+  std::wstring src;
+  std::wstring dest;
+  WIN32_FIND_DATAW data;
+  // Where the filter and ignore files are for this entry's contents, if it's
+  // a directory
+  FilterState filter;
+  IgnoreState ignore;
+};
+
+static FileCopy fileCopyOf(const PendingEntry &entry) {
+  FileCopy file;
+  file.src = entry.src;
+  file.dest = entry.dest;
+  file.size = fileSizeOf(entry.data);
+  file.lastWriteTime = fileTimeToTicks(entry.data.ftLastWriteTime);
+  file.attributes = entry.data.dwFileAttributes;
+  return file;
+}
+
+DWORD expandTargets(const std::vector<Target> &targets,
+                    const FileOpOptions &options, CopyList &list) {
+  SymlinkPolicy symlinks = options.symlinks;
+  const PathFilter &filter = options.filter;
+  bool follow = symlinks == SymlinkPolicy::Follow;
+
+  // The directories expanded so far, by volume and file id. When following
+  // links, a directory reached again is skipped, which stops link loops.
+  std::set<std::pair<ULONGLONG, ULONGLONG>> visited;
+
+  std::vector<PendingEntry> pending;
+  std::vector<WIN32_FIND_DATAW> entries;
+
+  for (const Target &target : targets) {
+    PendingEntry root;
+    root.src = target.src;
+    root.dest = target.dest;
+    root.filter = filter.root();
+    if (!statPath(target.src, root.data)) {
+      return GetLastError();
+    }
+    pending.push_back(root);
+
+    while (!pending.empty()) {
+      PendingEntry entry = std::move(pending.back());
+      pending.pop_back();
+
+      EntryKind kind = entryKindOf(entry.data);
+
+      // Sockets, FIFOs, and devices are never opened, since reading them can
+      // block forever
+      if (kind == EntryKind::Special) {
+        list.skipped++;
+        continue;
+      }
+
+      if (kind == EntryKind::Link) {
+        if (symlinks == SymlinkPolicy::Skip) {
+          list.skipped++;
+          continue;
+        }
+
+        if (!follow || !canFollowLink(entry.data)) {
+          if (options.selection.selects(entry.data, true)) {
+            list.links.push_back(fileCopyOf(entry));
+          } else {
+            list.excluded++;
+          }
+          continue;
+        }
+
+        // A link that points nowhere has nothing to copy
+        ULONGLONG volume = 0;
+        ULONGLONG fileId = 0;
+        if (followLink(entry.src, entry.data, volume, fileId) != 0) {
+          list.skipped++;
+          continue;
+        }
+      }
+
+      if (!(entry.data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        if (options.selection.selects(entry.data, false)) {
+          list.files.push_back(fileCopyOf(entry));
+        } else {
+          list.excluded++;
+        }
+        continue;
+      }
+
+      if (follow) {
+        ULONGLONG volume = 0;
+        ULONGLONG fileId = 0;
+        DWORD error = directoryIdentity(entry.src, volume, fileId);
+        if (error != 0) {
+          return error;
+        }
+
+        if (!visited.insert(std::make_pair(volume, fileId)).second) {
+          list.skipped++;
+          continue;
+        }
+      }
+
+      Target dir;
+      dir.src = entry.src;
+      dir.dest = entry.dest;
+      list.dirs.push_back(dir);
+
+      entries.clear();
+      DWORD error = listDirectory(entry.src, entries);
+      if (error == ERROR_FILE_NOT_FOUND) {
+        continue;
+      } else if (error != 0) {
+        return error;
+      }
+
+      // An ignore file applies to the directory it's in and everything
+      // beneath, so it's read before any of the entries are looked at
+      if (!options.ignoreFile.empty()) {
+        for (const WIN32_FIND_DATAW &data : entries) {
+          if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+              compareNames(data.cFileName, options.ignoreFile.c_str()) == 0) {
+            error = readIgnoreFile(joinPath(entry.src, data.cFileName),
+                                   entry.ignore);
+            if (error != 0) {
+              return error;
+            }
+            break;
+          }
+        }
+      }
+
+      // Entries are taken from the back, so add them in reverse to expand
+      // them in listing order. Excluded directories are left out here, so
+      // they're never listed.
+      for (size_t i = entries.size(); i-- > 0;) {
+        PendingEntry child;
+        bool isDirectory =
+            (entries[i].dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        if (!filter.empty() && filter.excludes(entry.filter,
+                                               entries[i].cFileName,
+                                               isDirectory, child.filter)) {
+          list.excluded++;
+          continue;
+        }
+
+        if (entry.ignore.rules != NULL &&
+            isIgnored(entry.ignore, entries[i].cFileName, isDirectory,
+                      child.ignore)) {
+          list.excluded++;
+          continue;
+        }
+
+        child.src = joinPath(entry.src, entries[i].cFileName);
+        child.dest = joinPath(entry.dest, entries[i].cFileName);
+        child.data = entries[i];
+        pending.push_back(std::move(child));
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Check if the destination of the given file already matches its source
+ */
+static bool destinationMatches(const FileCopy &file) {
+  WIN32_FIND_DATAW data;
+  return statPath(file.dest, data) && fileSizeOf(data) == file.size &&
+         fileTimeToTicks(data.ftLastWriteTime) == file.lastWriteTime;
+}
+
+DWORD copyRange(HANDLE src, ULONGLONG srcOffset, HANDLE dest,
+                ULONGLONG destOffset, ULONGLONG length,
+                std::vector<BYTE> &buffer, Hasher *hasher) {
+  LARGE_INTEGER srcPosition;
+  srcPosition.QuadPart = (LONGLONG)srcOffset;
+  LARGE_INTEGER destPosition;
+  destPosition.QuadPart = (LONGLONG)destOffset;
+
+  if (!SetFilePointerEx(src, srcPosition, NULL, FILE_BEGIN) ||
+      !SetFilePointerEx(dest, destPosition, NULL, FILE_BEGIN)) {
+    return GetLastError();
+  }
+
+  while (length > 0) {
+    DWORD toRead = (DWORD)std::min<ULONGLONG>(length, buffer.size());
+    DWORD read = 0;
+
+    // One read and one write
+    throttleIo(toRead, 2);
+
+    if (!ReadFile(src, buffer.data(), toRead, &read, NULL)) {
+      return GetLastError();
+    }
+
+    // The source got shorter since it was listed
+    if (read == 0) {
+      return ERROR_HANDLE_EOF;
+    }
+
+    // When the volume fills up, wait for space and carry on from the first
+    // byte that wasn't written
+    for (DWORD done = 0; done < read;) {
+      DWORD written = 0;
+      if (WriteFile(dest, buffer.data() + done, read - done, &written, NULL)) {
+        done += written;
+        continue;
+      }
+
+      done += written;
+      DWORD error = waitForSpace(dest, length - done, GetLastError());
+      if (error != 0) {
+        return error;
+      }
+
+      destPosition.QuadPart = (LONGLONG)(destOffset + done);
+      if (!SetFilePointerEx(dest, destPosition, NULL, FILE_BEGIN)) {
+        return GetLastError();
+      }
+    }
+
+    if (hasher != NULL) {
+      hasher->update(buffer.data(), read);
+    }
+
+    length -= read;
+    destOffset += read;
+  }
+
+  return 0;
+}
+
+CopyMethod copyMethodFor(const FileCopy &file, const FileOpOptions &options) {
+  bool hashing =
+      options.verify != HashAlgorithm::None || !options.manifest.empty();
+
+  if (options.delta && canCopyDelta(file)) {
+    return CopyMethod::Delta;
+  } else if (file.size >= LARGE_FILE_SIZE || hashing) {
+    return CopyMethod::Chunked;
+  }
+  return CopyMethod::CopyFile;
+}
+
+/**
+ * Charge what CopyFileEx copied since it last reported progress to the limits
+ */
+static DWORD CALLBACK throttleCopy(LARGE_INTEGER totalSize,
+                                   LARGE_INTEGER totalCopied,
+                                   LARGE_INTEGER streamSize,
+                                   LARGE_INTEGER streamCopied, DWORD stream,
+                                   DWORD reason, HANDLE src, HANDLE dest,
+                                   LPVOID data) {
+  ULONGLONG &charged = *(ULONGLONG *)data;
+  ULONGLONG copied = (ULONGLONG)totalCopied.QuadPart;
+
+  if (copied > charged) {
+    throttleIo(copied - charged, 2);
+    charged = copied;
+  }
+
+  return PROGRESS_CONTINUE;
+}
+
+/**
+ * Copy a small file in one go, through a temporary name when `atomic` is set
+ */
+static DWORD copySmallFile(const FileCopy &file, bool atomic) {
+  std::wstring dest = atomic ? partialPathFor(file.dest) : file.dest;
+
+  // CopyFileEx keeps the attributes and modification time, and can offload
+  // the copy to the storage when it supports that
+  // CopyFileEx removes what it wrote when it fails, so a copy that ran out
+  // of space starts over once there's room for the whole file
+  ULONGLONG charged = 0;
+  while (!CopyFileExW(file.src.c_str(), dest.c_str(), throttleCopy, &charged,
+                      NULL, 0)) {
+    DWORD error = waitForSpace(dest, file.size, GetLastError());
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  if (atomic && !MoveFileExW(dest.c_str(), file.dest.c_str(),
+                             MOVEFILE_REPLACE_EXISTING)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+/**
+ * Copy a large file chunk by chunk into a hidden partial file, then rename it
+ * into place. With a journal, each finished chunk is recorded once its data is
+ * on disk, and chunks recorded by an earlier run are skipped. With a hasher,
+ * the source is hashed as it's read, and `hashed` is set if every chunk was.
+ */
+static DWORD copyLargeFile(const FileCopy &file, Journal *journal,
+                           std::vector<BYTE> &buffer, Hasher *hasher,
+                           bool &hashed) {
+  std::wstring partial = partialPathFor(file.dest);
+
+  HANDLE src =
+      CreateFileW(file.src.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (src == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  HANDLE dest = CreateFileW(partial.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                            NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+  if (dest == INVALID_HANDLE_VALUE) {
+    DWORD error = GetLastError();
+    CloseHandle(src);
+    return error;
+  }
+
+  setIoPriorityHint(src);
+  setIoPriorityHint(dest);
+
+  // Only trust the journal's chunks if the partial file from that run is
+  // still there in full
+  LARGE_INTEGER partialSize;
+  bool canResume = GetFileSizeEx(dest, &partialSize) &&
+                   (ULONGLONG)partialSize.QuadPart == file.size;
+
+  ULONGLONG record = 0;
+  DWORD error = 0;
+
+  if (journal != NULL) {
+    error = journal->chunksFor(file, CHUNK_SIZE, canResume, record);
+  }
+
+  // Size the file up front, so chunks can be written in any order
+  LARGE_INTEGER size;
+  size.QuadPart = (LONGLONG)file.size;
+  while (error == 0 && (!SetFilePointerEx(dest, size, NULL, FILE_BEGIN) ||
+                        !SetEndOfFile(dest))) {
+    error = waitForSpace(dest, file.size, GetLastError());
+  }
+
+  ULONGLONG chunkCount = (file.size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  hashed = hasher != NULL;
+
+  for (ULONGLONG i = 0; error == 0 && i < chunkCount; i++) {
+    if (journal != NULL && journal->isChunkDone(record, i)) {
+      hashed = false;
+      continue;
+    }
+
+    ULONGLONG offset = i * CHUNK_SIZE;
+    error = copyRange(src, offset, dest, offset,
+                      std::min<ULONGLONG>(CHUNK_SIZE, file.size - offset),
+                      buffer, hashed ? hasher : NULL);
+
+    // The chunk's data has to be on disk before the journal says it's done
+    if (error == 0 && journal != NULL) {
+      error = FlushFileBuffers(dest) ? journal->markChunkDone(record, i)
+                                     : GetLastError();
+    }
+  }
+
+  FILETIME lastWriteTime;
+  lastWriteTime.dwLowDateTime = (DWORD)file.lastWriteTime;
+  lastWriteTime.dwHighDateTime = (DWORD)(file.lastWriteTime >> 32);
+  if (error == 0 && !SetFileTime(dest, NULL, NULL, &lastWriteTime)) {
+    error = GetLastError();
+  }
+
+  CloseHandle(src);
+  CloseHandle(dest);
+
+  if (error != 0) {
+    return error;
+  }
+
+  if (!MoveFileExW(partial.c_str(), file.dest.c_str(),
+                   MOVEFILE_REPLACE_EXISTING) ||
+      !SetFileAttributesW(file.dest.c_str(), file.attributes)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+/**
+ * A copied file and the hash of its source
+ */
+struct CopiedFile {
+  size_t file;
+  std::string digest;
+};
+
+/**
+ * Read back each copied file past the system cache and check it hashes the
+ * same as its source. Files are checked on several threads at once.
+ */
+static DWORD verifyCopies(const std::vector<FileCopy> &files,
+                          const std::vector<CopiedFile> &copied,
+                          HashAlgorithm algorithm, CopyStats &stats) {
+  ULONGLONG start = GetTickCount64();
+  std::atomic<size_t> next(0);
+  std::atomic<ULONGLONG> bytes(0);
+  std::atomic<DWORD> firstError(0);
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < copied.size() && firstError == 0; i = next++) {
+      std::string digest;
+      ULONGLONG read = 0;
+      DWORD error = hashFile(files[copied[i].file].dest, algorithm, true,
+                             digest, read);
+
+      if (error == 0 && digest != copied[i].digest) {
+        error = ERROR_CRC;
+      }
+
+      bytes += read;
+
+      if (error != 0) {
+        DWORD none = 0;
+        firstError.compare_exchange_strong(none, error);
+      }
+    }
+  };
+
+  size_t threadCount = std::min<size_t>(
+      std::max(1U, std::thread::hardware_concurrency()), copied.size());
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i++) {
+    threads.push_back(startWorker(worker));
+  }
+  worker();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  stats.verifiedFiles = copied.size();
+  stats.verifiedBytes = bytes;
+  stats.verifyMilliseconds = GetTickCount64() - start;
+
+  return firstError;
+}
+
+DWORD copyTargets(const std::vector<Target> &targets,
+                  const FileOpOptions &options, CopyStats &stats) {
+  Journal journal;
+  bool useJournal = !options.journal.empty();
+
+  setWaitForSpace(options.waitForSpace);
+  setBandwidthLimit(options.bwlimit);
+  setIopsLimit(options.iopsLimit);
+
+  if (!options.control.empty()) {
+    DWORD error = startControlChannel(options.control);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  if (useJournal) {
+    DWORD error = journal.open(options.journal);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  CopyList list;
+  std::vector<FileCopy> &files = list.files;
+  // Where the path of each file starts, relative to the directory its target
+  // is copied into, for the manifest
+  std::vector<size_t> relativeStarts;
+  DWORD error = 0;
+
+  for (const Target &target : targets) {
+    error = expandTargets(std::vector<Target>(1, target), options, list);
+    if (error != 0) {
+      return error;
+    }
+
+    std::wstring base = parentPath(target.dest);
+    relativeStarts.resize(files.size(),
+                          base.length() + (base.back() == L'\\' ? 0 : 1));
+  }
+
+  for (const Target &dir : list.dirs) {
+    error = createDirectories(dir.dest);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  for (const FileCopy &link : list.links) {
+    error = copyLink(link.src, link.dest,
+                     (link.attributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  stats.skippedEntries = list.skipped;
+  stats.excludedEntries = list.excluded;
+
+  std::vector<BYTE> buffer(IO_SIZE);
+  size_t unflushed = 0;
+  bool verify = options.verify != HashAlgorithm::None;
+  bool useManifest = !options.manifest.empty();
+  std::vector<CopiedFile> copied;
+  std::vector<ManifestEntry> manifest;
+  DestinationListing destinations(files);
+
+  // The manifest uses the same hash as verifying when both are asked for
+  HashAlgorithm algorithm = verify        ? options.verify
+                            : useManifest ? HashAlgorithm::Xxh3
+                                          : HashAlgorithm::None;
+  bool hashing = algorithm != HashAlgorithm::None;
+
+  // Names of a file that has already been copied are linked to its copy
+  std::vector<size_t> links;
+  if (options.hardlinks) {
+    error = findHardLinks(files, links);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  // Repeats of an earlier file are cloned from its copy instead of written
+  std::vector<size_t> originals;
+  bool useDedupe = options.dedupe != Dedupe::None;
+  if (useDedupe) {
+    error = findDuplicates(files, originals);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  // Which files hold their source's contents at their destination, so only
+  // those are linked or cloned from. A skipped file's destination is
+  // something else.
+  std::vector<bool> written(files.size(), false);
+
+  for (size_t i = 0; i < files.size(); i++) {
+    const FileCopy &file = files[i];
+
+    ManifestEntry entry;
+    entry.path = file.dest.substr(relativeStarts[i]);
+    entry.size = file.size;
+    entry.lastWriteTime = file.lastWriteTime;
+
+    // Files finished by an earlier run still belong in the manifest
+    if (useJournal && journal.isFileDone(file) && destinationMatches(file)) {
+      if (useManifest) {
+        ULONGLONG read = 0;
+        error = hashFile(file.src, algorithm, false, entry.digest, read);
+        if (error != 0) {
+          break;
+        }
+        manifest.push_back(entry);
+      }
+      written[i] = true;
+      continue;
+    }
+
+    if (options.onConflict != ConflictPolicy::Default) {
+      ConflictAction action =
+          resolveConflict(options.onConflict, file, destinations.find(i),
+                          stats.conflicts);
+
+      if (action == ConflictAction::Skip) {
+        continue;
+      } else if (action == ConflictAction::Fail) {
+        error = ERROR_FILE_EXISTS;
+        break;
+      } else if (action == ConflictAction::Rename) {
+        // Later names of the same file are linked to the renamed copy
+        error = claimFreeName(file.dest, files[i].dest);
+        if (error != 0) {
+          break;
+        }
+        entry.path = file.dest.substr(relativeStarts[i]);
+
+        Target renamed;
+        renamed.src = file.src;
+        renamed.dest = file.dest;
+        stats.conflicts.renamedFiles.push_back(renamed);
+        stats.conflicts.renamed++;
+      }
+    }
+
+    // Files that are hashed are copied through the buffer, so the source can
+    // be hashed as it's read
+    std::unique_ptr<Hasher> hasher = createHasher(algorithm);
+    bool hashed = false;
+    bool cloned = false;
+    bool linked = false;
+    // CopyFileEx copies streams itself, and small files that are only
+    // chunked to be hashed get theirs copied as CopyFileEx would have
+    bool hasStreams = false;
+    bool needsStreams = false;
+
+    if (options.hardlinks && links[i] != i && written[links[i]]) {
+      error = cloneFile(file, files[links[i]].dest, Dedupe::Hardlink, cloned);
+      if (cloned) {
+        stats.linkedFiles++;
+        linked = true;
+      }
+    }
+
+    if (error == 0 && !cloned && useDedupe && originals[i] != i &&
+        written[originals[i]]) {
+      error = cloneFile(file, files[originals[i]].dest, options.dedupe, cloned);
+      if (cloned) {
+        stats.dedupedFiles++;
+        stats.bytesSaved += file.size;
+        linked = options.dedupe == Dedupe::Hardlink;
+      }
+    }
+
+    CopyMethod method = error != 0 || cloned ? CopyMethod::CopyFile
+                                             : copyMethodFor(file, options);
+
+    if (error != 0 || cloned) {
+      // Cloned from an earlier copy, or failed trying
+    } else if (method == CopyMethod::Delta) {
+      error = copyDelta(file, buffer, options.atomic);
+    } else if (method == CopyMethod::Chunked) {
+      Journal *chunkJournal =
+          useJournal && file.size >= LARGE_FILE_SIZE ? &journal : NULL;
+      error = copyLargeFile(file, chunkJournal, buffer, hasher.get(), hashed);
+      needsStreams = file.size < LARGE_FILE_SIZE;
+    } else {
+      error = copySmallFile(file, options.atomic);
+      hasStreams = true;
+    }
+
+    DWORD flags = options.preserve;
+    if (needsStreams) {
+      flags |= PRESERVE_XATTR;
+    }
+    if (hasStreams) {
+      flags &= ~PRESERVE_XATTR;
+    }
+
+    // A hard link already has the metadata of the file it links to
+    if (error == 0 && flags != 0 && !linked) {
+      error = preserveMetadata(file.src, file.dest, flags, buffer,
+                               stats.preserve);
+    }
+
+    // Clones, deltas, and resumed files don't read the whole source, so it's
+    // hashed on its own
+    if (error == 0 && hashing) {
+      if (hashed) {
+        entry.digest = hasher->digest();
+      } else {
+        ULONGLONG read = 0;
+        error = hashFile(file.src, algorithm, false, entry.digest, read);
+      }
+
+      if (verify) {
+        CopiedFile copy;
+        copy.file = i;
+        copy.digest = entry.digest;
+        copied.push_back(copy);
+      }
+
+      if (useManifest) {
+        manifest.push_back(entry);
+      }
+    }
+
+    if (error == 0 && useJournal) {
+      error = journal.markFileDone(file);
+
+      if (error == 0 && ++unflushed >= JOURNAL_FLUSH_FILES) {
+        error = journal.flush();
+        unflushed = 0;
+      }
+    }
+
+    if (error != 0) {
+      break;
+    }
+
+    written[i] = true;
+  }
+
+  // Keep whatever was finished, even if the copy failed part way
+  if (useJournal) {
+    DWORD flushError = journal.flush();
+    if (error == 0) {
+      error = flushError;
+    }
+  }
+
+  // Writing into a directory changes its times, so directories are done
+  // once everything is in them, children before parents
+  if (options.preserve != 0) {
+    for (size_t i = list.dirs.size(); error == 0 && i-- > 0;) {
+      error = preserveMetadata(list.dirs[i].src, list.dirs[i].dest,
+                               options.preserve, buffer, stats.preserve);
+    }
+  }
+
+  if (error == 0 && verify) {
+    error = verifyCopies(files, copied, options.verify, stats);
+  }
+
+  if (error == 0 && useManifest) {
+    error = writeManifest(options.manifest, algorithm, manifest);
+  }
+
+  return error;
+}
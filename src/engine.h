@@ -0,0 +1,90 @@
+#pragma once
+
+#include "hash.h"
+#include "links.h"
+#include "preserve.h"
+#include "options.h"
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Get the hidden name a file is written to before it's renamed into place
+ */
+std::wstring partialPathFor(const std::wstring &dest);
+
+/**
+ * Copy `length` bytes from one open file to another, at the given offset in
+ * each. Returns 0 or a Windows error code.
+ */
+DWORD copyRange(HANDLE src, ULONGLONG srcOffset, HANDLE dest,
+                ULONGLONG destOffset, ULONGLONG length,
+                std::vector<BYTE> &buffer, Hasher *hasher = NULL);
+
+/**
+ * Everything beneath a set of targets, sorted by how it's copied
+ */
+struct CopyList {
+  std::vector<FileCopy> files;
+  // Listed before their contents
+  std::vector<Target> dirs;
+  // Symbolic links and junctions to recreate as links
+  std::vector<FileCopy> links;
+  // Special files, and links that were skipped or point nowhere
+  size_t skipped = 0;
+  // Entries left out by the filter, ignore files, or selection
+  size_t excluded = 0;
+};
+
+/**
+ * Expand the given targets into every file, directory, and link beneath
+ * them, handling links as the options say and leaving out what the filter,
+ * ignore files, and selection exclude. Returns 0 or a Windows error code.
+ */
+DWORD expandTargets(const std::vector<Target> &targets,
+                    const FileOpOptions &options, CopyList &list);
+
+/**
+ * How the built-in copier writes a file's contents, when it isn't linked or
+ * cloned from another copy
+ */
+enum class CopyMethod {
+  // Only the blocks that changed, over an older copy
+  Delta,
+  // Chunk by chunk through a buffer, so it can be resumed or hashed
+  Chunked,
+  // In one go with CopyFileEx, which can offload the copy to the storage
+  CopyFile,
+};
+
+/**
+ * Choose how the built-in copier writes the given file
+ */
+CopyMethod copyMethodFor(const FileCopy &file, const FileOpOptions &options);
+
+/**
+ * Figures from a copy by the built-in copier
+ */
+struct CopyStats {
+  ULONGLONG verifiedFiles = 0;
+  ULONGLONG verifiedBytes = 0;
+  ULONGLONG verifyMilliseconds = 0;
+  ULONGLONG dedupedFiles = 0;
+  ULONGLONG bytesSaved = 0;
+  ULONGLONG linkedFiles = 0;
+  ULONGLONG skippedEntries = 0;
+  ULONGLONG excludedEntries = 0;
+  PreserveStats preserve;
+  ConflictStats conflicts;
+};
+
+/**
+ * Copy the given targets with the built-in copier instead of Explorer. This is
+ * used for options that need to see each file or chunk as it's copied, such
+ * as --journal, --delta, --verify, --manifest, --dedupe, --hardlinks,
+ * --symlinks, --preserve, --on-conflict, --wait-for-space, and the filters.
+ * Returns 0 or a Windows error code.
+ */
+DWORD copyTargets(const std::vector<Target> &targets,
+                  const FileOpOptions &options, CopyStats &stats);
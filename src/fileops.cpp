@@ -1,12 +1,21 @@
-#define WIN32_LEAN_AND_MEAN // Disables inclusion of many large headers
-#define _WIN32_WINNT 0x0601 // Defines the version of Windows for <windows.h>
-#define UNICODE
+#include "platform.h"
+#include "diff.h"
+#include "engine.h"
+#include "manifest.h"
+#include "options.h"
+#include "plan.h"
+#include "preflight.h"
+#include "shellop.h"
+#include "staging.h"
+#include "sync.h"
+#include "throttle.h"
+#include "undo.h"
 
 // clang-format off
-#include <windows.h>
 #include <shellapi.h>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <map>
 #include <iostream>
 #include <sstream>
@@ -20,13 +29,128 @@
  */
 void printUsage() {
   std::cout << "\n"
-            << "usage: (action is one of: copy, move, delete)" << std::endl;
+            << "usage: (action is one of: copy, move, delete, undo, "
+               "verify-manifest, diff)"
+            << std::endl;
   std::cout << "  FileOps.exe <action> --from <sourcePath> [sourcePath]* --to "
                "<directoryPath>"
             << std::endl;
   std::cout << "  FileOps.exe <action> --from <sourcePath> [sourcePath]* --to "
                "<destPath> [destPath]*"
             << std::endl;
+  std::cout << "  FileOps.exe undo <jobId>" << std::endl;
+  std::cout << "  FileOps.exe verify-manifest <manifestPath> <directoryPath>"
+            << std::endl;
+  std::cout << "  FileOps.exe diff <leftPath> <rightPath>" << std::endl;
+  std::cout << "\n"
+            << "options:" << std::endl;
+  std::cout << "  --show-errors                      show a dialog on error"
+            << std::endl;
+  std::cout << "  --durability=none|file|batch|end   flush results to disk "
+               "before reporting ok"
+            << std::endl;
+  std::cout << "  --atomic                           only show files at the "
+               "destination once complete"
+            << std::endl;
+  std::cout << "  --dry-run                          print what would be done "
+               "and how long it would take"
+            << std::endl;
+  std::cout << "  --preflight                        check there's enough free "
+               "space before starting"
+            << std::endl;
+  std::cout << "  --wait-for-space                   pause when a destination "
+               "is full until space frees up"
+            << std::endl;
+  std::cout << "  --journal <path>                   record progress to resume "
+               "an interrupted copy"
+            << std::endl;
+  std::cout << "  --wal <path>                       log moves so an "
+               "interrupted move can be recovered"
+            << std::endl;
+  std::cout << "  --wal-recover=replay|rollback      finish or undo an "
+               "interrupted move"
+            << std::endl;
+  std::cout << "  --sync                             only copy items that "
+               "are missing or changed"
+            << std::endl;
+  std::cout << "  --mirror                           sync, and remove items "
+               "that aren't in the source"
+            << std::endl;
+  std::cout << "  --index <path>                     keep an index of the "
+               "destination to sync against"
+            << std::endl;
+  std::cout << "  --mtime-tolerance=<ms>             treat modification times "
+               "this close as equal"
+            << std::endl;
+  std::cout << "  --delta                            only write the changed "
+               "parts of existing files"
+            << std::endl;
+  std::cout << "  --verify=xxh3|crc32c|blake3        check each copy against "
+               "a hash of its source"
+            << std::endl;
+  std::cout << "  --manifest <path>                  write the hash of each "
+               "copied file to a manifest"
+            << std::endl;
+  std::cout << "  --dedupe=reflink|hardlink          clone or link repeated "
+               "files instead of copying them"
+            << std::endl;
+  std::cout << "  --hardlinks                        keep files that are "
+               "hard links to each other linked"
+            << std::endl;
+  std::cout << "  --symlinks=copy-link|follow|skip   how to copy symbolic "
+               "links and junctions"
+            << std::endl;
+  std::cout << "  --on-conflict=overwrite|skip|...   existing files: "
+               "overwrite, skip, rename, newer, larger, fail"
+            << std::endl;
+  std::cout << "  --preserve=mode,owner,times,...    metadata to copy: mode, "
+               "owner, times, xattr, acl"
+            << std::endl;
+  std::cout << "  --include <pattern>                only copy what matches a "
+               "glob, or re:<regex>"
+            << std::endl;
+  std::cout << "  --exclude <pattern>                leave out what matches a "
+               "glob, or re:<regex>"
+            << std::endl;
+  std::cout << "  --ignore-file <name>               leave out what ignore "
+               "files with this name list"
+            << std::endl;
+  std::cout << "  --bwlimit=<size>                   most bytes to read or "
+               "write per second"
+            << std::endl;
+  std::cout << "  --iops-limit=<count>               most reads and writes "
+               "per second"
+            << std::endl;
+  std::cout << "  --control <name>                   change the limits while "
+               "running through a named pipe"
+            << std::endl;
+  std::cout << "  --io-priority=idle|best-effort:N   I/O class of the "
+               "operation's threads, or realtime:N"
+            << std::endl;
+  std::cout << "  --nice=<value>                     process priority, from "
+               "-20 (highest) to 19 (lowest)"
+            << std::endl;
+  std::cout << "  --affinity=<cpus>                  processors workers run "
+               "on, like 0-3,6 or 0x4f"
+            << std::endl;
+  std::cout << "  --min-size=<size>                  only files of at least "
+               "this size, like 10K or 5M"
+            << std::endl;
+  std::cout << "  --max-size=<size>                  only files of at most "
+               "this size"
+            << std::endl;
+  std::cout << "  --newer-than=<age>                 only files changed within "
+               "this age, like 12h or 30d"
+            << std::endl;
+  std::cout << "  --older-than=<age>                 only files last changed "
+               "longer ago than this age"
+            << std::endl;
+  std::cout << "  --type=f|l                         only files (f) or links "
+               "(l), or both as f,l"
+            << std::endl;
+  std::cout << "  --job-id <id>                      the id to save the undo "
+               "log under"
+            << std::endl;
 }
 
 /**
@@ -92,24 +216,6 @@ bool inputIsValid(const std::string &action,
   return true;
 }
 
-/**
- * Convert an std::string to LPCWSTR
- * See https://stackoverflow.com/a/27296
- */
-LPWSTR stringToLpwstr(const std::string &str) {
-  int stringLength = (int)str.length() + 1;
-
-  // The first call with a 0 target string returns the buffer length needed
-  int bufferLength = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, 0, 0);
-
-  wchar_t *buffer = new wchar_t[bufferLength];
-
-  // The second call actually does the conversion
-  MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, buffer, bufferLength);
-
-  return buffer;
-}
-
 /**
  * Get the error string for the given Windows error code
  */
@@ -215,6 +321,12 @@ void handleStatus(int opReturnCode, bool wasAborted, std::string action,
       MessageBox(0, lpText, lpCaption, MB_ICONWARNING);
     } else if (action == "delete") {
       MessageBox(0, lpText, lpCaption, MB_ICONWARNING);
+    } else if (action == "undo") {
+      MessageBox(0, lpText, lpCaption, MB_ICONWARNING);
+    } else if (action == "verify-manifest") {
+      MessageBox(0, lpText, lpCaption, MB_ICONWARNING);
+    } else if (action == "diff") {
+      MessageBox(0, lpText, lpCaption, MB_ICONWARNING);
     }
 
     delete[] lpCaption;
@@ -226,72 +338,510 @@ void handleStatus(int opReturnCode, bool wasAborted, std::string action,
 }
 
 /**
- * Combine the given file names into a single LPWSTR string, with a null
- * terminator character used as separator, with double null terminators at the
- * end of the string.
- * All this to create a string for pFrom and pTo in the SHFILEOPSTRUCT:
- *   https://docs.microsoft.com/en-us/windows/win32/api/shellapi/ns-shellapi-shfileopstructw#members
+ * Finish or undo the moves in the write-ahead log that an earlier run didn't
+ * finish, then clear the log
+ */
+int recoverMoves(WriteAheadLog &wal, Recovery mode, BOOL &wasAborted) {
+  std::vector<Target> moves;
+  std::vector<std::wstring> leftovers;
+
+  DWORD error = wal.pendingMoves(mode, moves, leftovers);
+  if (error != 0) {
+    return error;
+  }
+
+  if (!moves.empty()) {
+    std::vector<std::string> srcPaths;
+    std::vector<std::string> destPaths;
+    for (const Target &move : moves) {
+      srcPaths.push_back(toUtf8(move.src));
+      destPaths.push_back(toUtf8(move.dest));
+    }
+
+    // Some of each move may have happened already, so whatever is in the
+    // way is replaced without asking. When undoing, only items that are
+    // gone from their source are moved back, so no source is replaced.
+    int status = runShellOperation("move", srcPaths, destPaths, true,
+                                   wasAborted, FOF_NOCONFIRMATION);
+    if (status != 0 || wasAborted) {
+      return status;
+    }
+  }
+
+  // Copies of items that never left their source, and the directories that
+  // held them
+  for (const std::wstring &path : leftovers) {
+    DWORD attributes = GetFileAttributesW(path.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+      continue;
+    }
+
+    // A directory that still has something in it is kept
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
+      RemoveDirectoryW(path.c_str());
+      continue;
+    }
+
+    SetFileAttributesW(path.c_str(), FILE_ATTRIBUTE_NORMAL);
+    if (!DeleteFileW(path.c_str())) {
+      return GetLastError();
+    }
+  }
+
+  return wal.clear();
+}
+
+/**
+ * Reverse the job with the given id
+ */
+int performUndo(const std::string &jobId, bool showErrorDialog) {
+  BOOL wasAborted = FALSE;
+  int status = undoJob(toWide(jobId), wasAborted);
+
+  handleStatus(status, wasAborted, "undo", showErrorDialog);
+
+  return status;
+}
+
+/**
+ * Check the files in the given directory against a manifest, and list the
+ * ones that don't match
+ */
+int performVerifyManifest(const std::string &manifestPath,
+                          const std::string &directory, bool showErrorDialog) {
+  ManifestReport report;
+  int status = verifyManifest(toWide(manifestPath), toWide(directory), report);
+
+  for (const std::wstring &path : report.missing) {
+    std::cout << "missing " << toUtf8(path) << std::endl;
+  }
+
+  for (const std::wstring &path : report.changed) {
+    std::cout << "changed " << toUtf8(path) << std::endl;
+  }
+
+  if (status == 0 && (!report.missing.empty() || !report.changed.empty())) {
+    status = ERROR_CRC;
+  }
+
+  handleStatus(status, false, "verify-manifest", showErrorDialog);
+
+  return status;
+}
+
+/**
+ * List how the tree at `right` differs from the tree at `left`, one entry per
+ * line, with directories ending in a backslash
+ */
+int performDiff(const std::string &left, const std::string &right,
+                bool showErrorDialog) {
+  int status = diffTrees(
+      toWide(left), toWide(right),
+      [](DiffChange change, const std::wstring &path, bool isDirectory) {
+        const char *name = change == DiffChange::Added     ? "added"
+                           : change == DiffChange::Removed ? "removed"
+                                                           : "modified";
+
+        // Lines aren't flushed one by one, since there can be millions
+        std::cout << name << " " << toUtf8(path) << (isDirectory ? "\\" : "")
+                  << "\n";
+      });
+
+  handleStatus(status, false, "diff", showErrorDialog);
+
+  return status;
+}
+
+/**
+ * Print how much was read back to verify the copies, and how fast
+ */
+void printVerifyStats(const CopyStats &stats) {
+  double megabytes = stats.verifiedBytes / (1024.0 * 1024.0);
+  double seconds = std::max<ULONGLONG>(stats.verifyMilliseconds, 1) / 1000.0;
+
+  std::cout << "verified " << stats.verifiedFiles << " files ("
+            << (ULONGLONG)megabytes << " MB) at "
+            << (ULONGLONG)(megabytes / seconds) << " MB/s" << std::endl;
+}
+
+/**
+ * Print how many system calls were made to copy each kind of metadata
+ */
+void printPreserveStats(const PreserveStats &stats) {
+  std::cout << "preserve calls: mode " << stats.mode << ", owner "
+            << stats.owner << ", times " << stats.times << ", xattr "
+            << stats.xattr << ", acl " << stats.acl << std::endl;
+}
+
+/**
+ * Print what each destination volume needs and has, and check if everything
+ * fits
  */
-LPWSTR combileFileNames(const std::vector<std::string> &files) {
-  // Combine the file names into an std::string with '\t' as separator
-  std::string combinedStr = "";
-  for (std::string file : files) {
-    combinedStr += file + "\t";
+bool printSpace(const std::vector<VolumeSpace> &volumes) {
+  bool fits = true;
+
+  for (const VolumeSpace &space : volumes) {
+    std::cout << "volume " << toUtf8(space.volume) << " ("
+              << toUtf8(space.fileSystem) << ", " << space.clusterSize
+              << " byte clusters) needs " << space.required << " bytes for "
+              << space.files << " files and " << space.directories
+              << " directories, and has " << space.available;
+
+    if (space.required > space.available) {
+      std::cout << ", short by " << space.required - space.available;
+      fits = false;
+    }
+
+    std::cout << std::endl;
   }
 
-  // Convert the combined string to LPWSTR
-  LPWSTR combined = stringToLpwstr(combinedStr);
+  return fits;
+}
+
+/**
+ * Check that the results of the operation fit on each destination volume
+ * before starting it, so it doesn't fail part way through
+ */
+int performPreflight(const std::string &action,
+                     const std::vector<Target> &targets,
+                     const FileOpOptions &options, bool useEngine) {
+  OperationPlan plan;
+  DWORD error = planOperation(action, targets, options, useEngine, plan);
 
-  // Replace each '\t' separator with a null terminator '\0'
-  int length = wcslen(combined);
-  for (int i = 0; i < length; i++) {
-    if (combined[i] == L'\t') {
-      combined[i] = L'\0';
+  std::vector<VolumeSpace> volumes;
+  if (error == 0) {
+    error = measureSpace(targets, plan, volumes);
+  }
+
+  if (error == 0 && !printSpace(volumes)) {
+    error = ERROR_DISK_FULL;
+  }
+
+  return error;
+}
+
+/**
+ * Print each step a run would take, including the destination items a mirror
+ * would remove, then the totals and how long it's estimated to take
+ */
+int performDryRun(const std::string &action,
+                  const std::vector<Target> &targets,
+                  const std::vector<std::wstring> &removals,
+                  const FileOpOptions &options, bool useEngine) {
+  OperationPlan plan;
+  DWORD error = planOperation(action, targets, options, useEngine, plan);
+
+  std::vector<VolumeSpace> volumes;
+  if (error == 0) {
+    error = measureSpace(targets, plan, volumes);
+  }
+
+  if (error == 0) {
+    error = estimateDuration(plan);
+  }
+
+  if (error != 0) {
+    return error;
+  }
+
+  for (const PlanItem &item : plan.items) {
+    std::cout << planMethodName(item.method) << " " << toUtf8(item.src);
+    if (!item.dest.empty()) {
+      std::cout << " -> " << toUtf8(item.dest);
     }
+    std::cout << " " << item.size << "\n";
+  }
+
+  for (const std::wstring &path : removals) {
+    std::cout << "remove " << toUtf8(path) << "\n";
+  }
+
+  if (plan.excluded > 0) {
+    std::cout << "excluded " << plan.excluded << " entries\n";
   }
 
-  return combined;
+  if (plan.overwrites > 0) {
+    std::cout << "overwrites " << plan.overwrites << " existing files\n";
+  }
+
+  std::cout << plan.files << " files, " << plan.directories
+            << " directories, " << plan.bytes << " bytes, "
+            << plan.bytesWritten << " to write" << std::endl;
+
+  std::cout << "estimated " << (ULONGLONG)(plan.seconds + 0.5) << " s at "
+            << (ULONGLONG)(plan.model.bytesPerSecond / (1024 * 1024))
+            << " MB/s and " << (ULONGLONG)(plan.model.secondsPerFile * 1e6)
+            << " us per file" << std::endl;
+
+  // Not fitting is reported without failing, since nothing was tried
+  printSpace(volumes);
+
+  return 0;
 }
 
 /**
  * Perform the file operation with the given input
  */
 int performFileOperation(const std::string &action,
-                         const std::vector<std::string> &srcPaths,
-                         const std::vector<std::string> &destPaths,
-                         bool showErrorDialog) {
-  SHFILEOPSTRUCTW op;
+                         std::vector<std::string> srcPaths,
+                         std::vector<std::string> destPaths,
+                         const FileOpOptions &options) {
+  std::vector<Target> targets = resolveTargets(srcPaths, destPaths);
+  bool multipleDestinations = destPaths.size() > 1;
+  bool useFilters = !options.filter.empty() || !options.ignoreFile.empty() ||
+                    !options.selection.empty();
+  bool useEngine = !options.journal.empty() || options.delta ||
+                   options.verify != HashAlgorithm::None ||
+                   !options.manifest.empty() ||
+                   options.dedupe != Dedupe::None || options.hardlinks ||
+                   options.symlinks != SymlinkPolicy::Default ||
+                   options.preserve != 0 || options.waitForSpace ||
+                   options.onConflict != ConflictPolicy::Default ||
+                   options.bwlimit != 0 || options.iopsLimit != 0 ||
+                   !options.control.empty() ||
+                   (useFilters && action == "copy");
+  bool isStaged = options.atomic && action != "delete" && !useEngine;
+  bool useWal = !options.wal.empty();
+  // A dry run doesn't fill in or change the index
+  bool useIndex = !options.index.empty() && !options.dryRun;
+  WriteAheadLog wal;
+  FileIndex index;
+  UndoLog undo;
+  BOOL wasAborted = FALSE;
+  CopyStats stats;
+  SyncPlan syncPlan;
+  ULONGLONG removedItems = 0;
+  int status = 0;
 
-  // Set the file flags
-  op.fFlags = FOF_ALLOWUNDO | FOF_NOCONFIRMMKDIR | FOF_WANTNUKEWARNING;
-  if (destPaths.size() > 1) {
-    op.fFlags = op.fFlags | FOF_MULTIDESTFILES;
+  // A sync only copies what's missing or changed, each item to its exact
+  // destination path
+  if (options.sync) {
+    if (useIndex) {
+      status = index.open(options.index);
+    }
+
+    if (status == 0) {
+      status = planSync(targets, options.mtimeTolerance, options.mirror,
+                        useIndex ? &index : NULL, syncPlan);
+    }
+
+    targets = syncPlan.copies;
+    multipleDestinations = true;
+    srcPaths.clear();
+    destPaths.clear();
+    for (const Target &target : targets) {
+      srcPaths.push_back(toUtf8(target.src));
+      destPaths.push_back(toUtf8(target.dest));
+    }
   }
 
-  // Set the source
-  LPWSTR pFrom = combileFileNames(srcPaths);
-  op.pFrom = pFrom;
+  // Deleting with filters deletes the files and links they select, one by
+  // one, and leaves the directories they're in
+  if (status == 0 && useFilters && action == "delete") {
+    CopyList list;
+    status = expandTargets(targets, options, list);
+    stats.excludedEntries = list.excluded;
+
+    list.files.insert(list.files.end(), list.links.begin(), list.links.end());
+    targets.clear();
+    srcPaths.clear();
+    for (const FileCopy &file : list.files) {
+      Target target;
+      target.src = file.src;
+      targets.push_back(target);
+      srcPaths.push_back(toUtf8(file.src));
+    }
+  }
 
-  // Set the destination
-  LPWSTR pTo = combileFileNames(destPaths);
-  op.pTo = pTo;
+  // A dry run shows what would happen and stops there
+  if (options.dryRun) {
+    if (status == 0) {
+      std::vector<std::wstring> removals = syncPlan.replaced;
+      removals.insert(removals.end(), syncPlan.extras.begin(),
+                      syncPlan.extras.end());
+      status = performDryRun(action, targets, removals, options, useEngine);
+    }
+    handleStatus(status, FALSE, action, options.showErrorDialog);
+    return status;
+  }
 
-  // Set the action
-  if (action == "copy") {
-    op.wFunc = FO_COPY;
-  } else if (action == "move") {
-    op.wFunc = FO_MOVE;
-  } else if (action == "delete") {
-    op.wFunc = FO_DELETE;
+  // Stop before anything changes if the results won't fit
+  if (status == 0 && options.preflight && !targets.empty()) {
+    status = performPreflight(action, targets, options, useEngine);
+    if (status != 0) {
+      handleStatus(status, FALSE, action, options.showErrorDialog);
+      return status;
+    }
   }
 
-  int status = SHFileOperationW(&op);
+  std::vector<Target> staged = targets;
 
-  // Handle any possible errors
-  handleStatus(status, op.fAnyOperationsAborted, action, showErrorDialog);
+  // When mirroring, items in the way of a copy have to go before it. They're
+  // recorded before the copies, so the undo log sees their destinations free.
+  if (status == 0 && !syncPlan.replaced.empty()) {
+    status = removeFromDestination(syncPlan.replaced, useIndex ? &index : NULL,
+                                   removedItems, wasAborted);
+    undo.addRemoved(syncPlan.replaced);
+  }
+
+  // Look at the destinations before anything changes, so undoing only
+  // touches what this job adds
+  if (status == 0 && !wasAborted) {
+    status = undo.prepare(action, targets);
+  }
+
+  // Deal with anything an earlier run left unfinished before logging the
+  // moves about to be made
+  if (status == 0 && useWal) {
+    status = wal.open(options.wal);
+    if (status == 0) {
+      status = recoverMoves(wal, options.walRecovery, wasAborted);
+    }
+    if (status == 0 && !wasAborted) {
+      status = wal.begin(targets);
+    }
+  }
+
+  // The built-in copier writes each file under a temporary name itself, and
+  // Explorer writes into hidden staging directories first, so nothing
+  // appears at the destination until it's complete
+  if (status != 0 || wasAborted) {
+    // Recovering an earlier run failed, so don't start a new one
+  } else if (targets.empty()) {
+    // Everything is already up to date
+  } else if (useEngine) {
+    status = copyTargets(targets, options, stats);
+
+    // Copies renamed to avoid a conflict get names the undo log couldn't
+    // know about beforehand
+    undo.add(stats.conflicts.renamedFiles);
+  } else if (isStaged) {
+    status = stageTargets(action, targets, staged);
+
+    std::vector<std::string> stagedPaths;
+    for (const Target &target : staged) {
+      stagedPaths.push_back(toUtf8(target.dest));
+    }
+
+    if (status == 0) {
+      status =
+          runShellOperation(action, srcPaths, stagedPaths, true, wasAborted);
+    }
+  } else {
+    // A sync replaces the files that changed without asking
+    status = runShellOperation(action, srcPaths, destPaths,
+                               multipleDestinations, wasAborted,
+                               options.sync ? FOF_NOCONFIRMATION : 0);
+  }
+
+  // Staged data is flushed before it's published, so a crash can't leave a
+  // published file with missing data
+  if (isStaged && status == 0 && !wasAborted) {
+    status = makeDurable(action, staged, options.durability);
+    if (status == 0) {
+      status = publishTargets(targets, staged);
+    }
+  }
+
+  if (isStaged) {
+    std::vector<std::wstring> kept;
+    DWORD error = discardStaging(action, targets, staged, kept);
+
+    for (const std::wstring &path : kept) {
+      std::cout << "error: moved items that couldn't be published are in "
+                << toUtf8(path) << std::endl;
+    }
+
+    if (status == 0) {
+      status = error;
+    }
+  }
+
+  // Make sure the results are on disk before reporting success
+  if (status == 0 && !wasAborted) {
+    status = makeDurable(action, targets, options.durability, isStaged);
+  }
+
+  // A mirror only removes extra items once everything else is in place, so
+  // a sync that fails part way doesn't leave the destination with less
+  if (status == 0 && !wasAborted && !syncPlan.extras.empty()) {
+    ULONGLONG removed = 0;
+    status = removeFromDestination(syncPlan.extras, useIndex ? &index : NULL,
+                                   removed, wasAborted);
+    removedItems += removed;
+    undo.addRemoved(syncPlan.extras);
+  }
+
+  // Record what's now at the destination, so the next sync doesn't have to
+  // list it
+  if (useIndex && status == 0 && !wasAborted) {
+    status = updateIndex(index, targets);
+  }
+
+  if (useIndex) {
+    DWORD error = index.flush();
+    if (status == 0) {
+      status = error;
+    }
+  }
+
+  // A move that failed is left in the log to be recovered next time, while
+  // one the user cancelled is left as it is
+  if (useWal && (status == 0 || wasAborted)) {
+    DWORD error = wal.end();
+    if (status == 0) {
+      status = error;
+    }
+  }
+
+  // Save the undo log for anything that happened, even if the user cancelled
+  // part way. The job id is printed so the caller can undo it later.
+  if (status == 0 || wasAborted) {
+    std::wstring jobId = options.jobId.empty() ? newJobId() : options.jobId;
+    if (undo.save(jobId) == 0) {
+      std::cout << "job " << toUtf8(jobId) << std::endl;
+    }
+  }
+
+  if (stats.excludedEntries > 0) {
+    std::cout << "excluded " << stats.excludedEntries << " entries"
+              << std::endl;
+  }
+
+  if (removedItems > 0) {
+    std::cout << "removed " << removedItems << " items" << std::endl;
+  }
+
+  if (stats.skippedEntries > 0) {
+    std::cout << "skipped " << stats.skippedEntries
+              << " links, loops, or special files" << std::endl;
+  }
 
-  delete[] pFrom;
-  delete[] pTo;
+  if (stats.linkedFiles > 0) {
+    std::cout << "linked " << stats.linkedFiles << " files" << std::endl;
+  }
+
+  if (stats.dedupedFiles > 0) {
+    std::cout << "deduplicated " << stats.dedupedFiles << " files, saving "
+              << stats.bytesSaved << " bytes" << std::endl;
+  }
+
+  if (stats.verifiedFiles > 0) {
+    printVerifyStats(stats);
+  }
+
+  if (options.preserve != 0) {
+    printPreserveStats(stats.preserve);
+  }
+
+  if (options.onConflict != ConflictPolicy::Default) {
+    std::cout << "conflicts: overwritten " << stats.conflicts.overwritten
+              << ", skipped " << stats.conflicts.skipped << ", renamed "
+              << stats.conflicts.renamed << std::endl;
+  }
+
+  // Handle any possible errors
+  handleStatus(status, wasAborted, action, options.showErrorDialog);
 
   return status;
 }
@@ -300,11 +850,13 @@ int performFileOperation(const std::string &action,
  * The CLI entry point
  */
 int main(int argc, char *argv[]) {
-  bool showErrorDialog = false;
+  FileOpOptions options;
   std::string action = "";
   std::vector<std::string> srcPaths;
   std::vector<std::string> destPaths;
 
+  std::vector<std::string> actionArgs;
+
   std::string currentlyProcessing = "action";
 
   for (int i = 1; i < argc; i++) {
@@ -317,7 +869,261 @@ int main(int argc, char *argv[]) {
       currentlyProcessing = "to";
       continue;
     } else if (arg == "--show-errors") {
-      showErrorDialog = true;
+      options.showErrorDialog = true;
+      continue;
+    } else if (arg == "--dry-run") {
+      options.dryRun = true;
+      continue;
+    } else if (arg == "--preflight") {
+      options.preflight = true;
+      continue;
+    } else if (arg == "--wait-for-space") {
+      options.waitForSpace = true;
+      continue;
+    } else if (arg == "--atomic") {
+      options.atomic = true;
+      continue;
+    } else if (arg == "--journal") {
+      if (i + 1 >= argc) {
+        std::cout << "error: --journal requires a path" << std::endl;
+        printUsage();
+        return 1;
+      }
+      options.journal = toWide(argv[++i]);
+      continue;
+    } else if (arg == "--wal") {
+      if (i + 1 >= argc) {
+        std::cout << "error: --wal requires a path" << std::endl;
+        printUsage();
+        return 1;
+      }
+      options.wal = toWide(argv[++i]);
+      continue;
+    } else if (arg == "--manifest") {
+      if (i + 1 >= argc) {
+        std::cout << "error: --manifest requires a path" << std::endl;
+        printUsage();
+        return 1;
+      }
+      options.manifest = toWide(argv[++i]);
+      continue;
+    } else if (arg == "--include" || arg == "--exclude") {
+      if (i + 1 >= argc) {
+        std::cout << "error: " << arg << " requires a pattern" << std::endl;
+        printUsage();
+        return 1;
+      }
+      std::string pattern = argv[++i];
+      std::string error;
+      if (!options.filter.add(toWide(pattern), arg == "--exclude", error)) {
+        std::cout << "error: invalid pattern " << pattern << ": " << error
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg == "--ignore-file") {
+      if (i + 1 >= argc) {
+        std::cout << "error: --ignore-file requires a name" << std::endl;
+        printUsage();
+        return 1;
+      }
+      options.ignoreFile = toWide(argv[++i]);
+      continue;
+    } else if (arg == "--index") {
+      if (i + 1 >= argc) {
+        std::cout << "error: --index requires a path" << std::endl;
+        printUsage();
+        return 1;
+      }
+      options.index = toWide(argv[++i]);
+      continue;
+    } else if (arg == "--job-id") {
+      if (i + 1 >= argc) {
+        std::cout << "error: --job-id requires an id" << std::endl;
+        printUsage();
+        return 1;
+      }
+      options.jobId = toWide(argv[++i]);
+      if (!isValidJobId(options.jobId)) {
+        std::cout << "error: --job-id can only contain letters, digits, - "
+                     "and _"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg == "--sync") {
+      options.sync = true;
+      continue;
+    } else if (arg == "--hardlinks") {
+      options.hardlinks = true;
+      continue;
+    } else if (arg == "--delta") {
+      options.delta = true;
+      continue;
+    } else if (arg == "--mirror") {
+      options.sync = true;
+      options.mirror = true;
+      continue;
+    } else if (arg.rfind("--mtime-tolerance=", 0) == 0) {
+      if (!parseTolerance(arg.substr(18), options.mtimeTolerance)) {
+        std::cout << "error: mtime-tolerance must be a number of milliseconds"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--wal-recover=", 0) == 0) {
+      if (!parseRecovery(arg.substr(14), options.walRecovery)) {
+        std::cout << "error: wal-recover must be one of: replay, rollback"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--verify=", 0) == 0) {
+      if (!parseHashAlgorithm(arg.substr(9), options.verify)) {
+        std::cout << "error: verify must be one of: xxh3, crc32c, blake3"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--dedupe=", 0) == 0) {
+      if (!parseDedupe(arg.substr(9), options.dedupe)) {
+        std::cout << "error: dedupe must be one of: reflink, hardlink"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--on-conflict=", 0) == 0) {
+      if (!parseConflictPolicy(arg.substr(14), options.onConflict)) {
+        std::cout << "error: on-conflict must be one of: overwrite, skip, "
+                     "rename, newer, larger, fail"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--symlinks=", 0) == 0) {
+      if (!parseSymlinkPolicy(arg.substr(11), options.symlinks)) {
+        std::cout << "error: symlinks must be one of: copy-link, follow, skip"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--preserve=", 0) == 0) {
+      if (!parsePreserve(arg.substr(11), options.preserve)) {
+        std::cout << "error: preserve must be a list of: mode, owner, times, "
+                     "xattr, acl"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--bwlimit=", 0) == 0) {
+      if (!parseSize(arg.substr(10), options.bwlimit)) {
+        std::cout << "error: bwlimit must be a number of bytes, with an "
+                     "optional K, M, G, or T suffix"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--iops-limit=", 0) == 0) {
+      if (!parseCount(arg.substr(13), options.iopsLimit)) {
+        std::cout << "error: iops-limit must be a number" << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg == "--control") {
+      if (i + 1 >= argc) {
+        std::cout << "error: --control requires a name" << std::endl;
+        printUsage();
+        return 1;
+      }
+      options.control = toWide(argv[++i]);
+      continue;
+    } else if (arg.rfind("--io-priority=", 0) == 0) {
+      if (!parseIoPriority(arg.substr(14), options.scheduling)) {
+        std::cout << "error: io-priority must be one of: idle, best-effort:N, "
+                     "realtime:N, with N from 0 to 7"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--nice=", 0) == 0) {
+      if (!parseNice(arg.substr(7), options.scheduling.nice)) {
+        std::cout << "error: nice must be a number from -20 to 19"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--affinity=", 0) == 0) {
+      if (!parseAffinity(arg.substr(11), options.scheduling.affinity)) {
+        std::cout << "error: affinity must be a list of processors like 0-3,6 "
+                     "or a mask like 0x4f"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--min-size=", 0) == 0) {
+      if (!parseSize(arg.substr(11), options.selection.minSize)) {
+        std::cout << "error: sizes must be a number of bytes, with an "
+                     "optional K, M, G, or T suffix"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--max-size=", 0) == 0) {
+      if (!parseSize(arg.substr(11), options.selection.maxSize)) {
+        std::cout << "error: sizes must be a number of bytes, with an "
+                     "optional K, M, G, or T suffix"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--newer-than=", 0) == 0) {
+      if (!parseAge(arg.substr(13), options.selection.newerThan)) {
+        std::cout << "error: ages must be a number with an optional s, m, h, "
+                     "d, or w suffix"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--older-than=", 0) == 0) {
+      if (!parseAge(arg.substr(13), options.selection.olderThan)) {
+        std::cout << "error: ages must be a number with an optional s, m, h, "
+                     "d, or w suffix"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--type=", 0) == 0) {
+      if (!parseEntryTypes(arg.substr(7), options.selection.types)) {
+        std::cout << "error: type must be a list of: f, l" << std::endl;
+        printUsage();
+        return 1;
+      }
+      continue;
+    } else if (arg.rfind("--durability=", 0) == 0) {
+      if (!parseDurability(arg.substr(13), options.durability)) {
+        std::cout << "error: durability must be one of: none, file, batch, end"
+                  << std::endl;
+        printUsage();
+        return 1;
+      }
       continue;
     } else if (arg.rfind("--", 0) == 0) {
       // An unknown arg starting with --, ignore
@@ -325,7 +1131,13 @@ int main(int argc, char *argv[]) {
     }
 
     if (currentlyProcessing == "action") {
-      action = arg;
+      // The undo, verify-manifest, and diff actions are followed by their
+      // arguments
+      if (action == "undo" || action == "verify-manifest" || action == "diff") {
+        actionArgs.push_back(arg);
+      } else {
+        action = arg;
+      }
     } else if (currentlyProcessing == "from") {
       srcPaths.push_back(std::string(argv[i]));
       continue;
@@ -335,9 +1147,225 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // Checked before undo, verify-manifest, and diff run, since they would
+  // ignore it and make their changes
+  if (options.dryRun && action != "copy" && action != "move" &&
+      action != "delete") {
+    std::cout << "error: --dry-run can only be used when action is copy, "
+                 "move, or delete"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  // Threads started from here on run with the scheduling options
+  DWORD schedulingError = setSchedulingPolicy(options.scheduling);
+  if (schedulingError != 0) {
+    handleStatus(schedulingError, FALSE, action, options.showErrorDialog);
+    return schedulingError;
+  }
+
+  if (action == "undo") {
+    if (actionArgs.size() != 1) {
+      std::cout << "error: a job id is required when action is undo"
+                << std::endl;
+      printUsage();
+      return 1;
+    }
+
+    if (!isValidJobId(toWide(actionArgs[0]))) {
+      std::cout << "error: a job id can only contain letters, digits, - and _"
+                << std::endl;
+      printUsage();
+      return 1;
+    }
+
+    return performUndo(actionArgs[0], options.showErrorDialog);
+  }
+
+  if (action == "verify-manifest") {
+    if (actionArgs.size() != 2) {
+      std::cout << "error: a manifest path and a directory path are required "
+                   "when action is verify-manifest"
+                << std::endl;
+      printUsage();
+      return 1;
+    }
+
+    return performVerifyManifest(actionArgs[0], actionArgs[1],
+                                 options.showErrorDialog);
+  }
+
+  if (action == "diff") {
+    if (actionArgs.size() != 2) {
+      std::cout << "error: two directory paths are required when action is "
+                   "diff"
+                << std::endl;
+      printUsage();
+      return 1;
+    }
+
+    return performDiff(actionArgs[0], actionArgs[1], options.showErrorDialog);
+  }
+
   if (!inputIsValid(action, srcPaths, destPaths)) {
     return 1;
   }
 
-  return performFileOperation(action, srcPaths, destPaths, showErrorDialog);
+  if (!options.journal.empty() && action != "copy") {
+    std::cout << "error: --journal can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.delta && action != "copy") {
+    std::cout << "error: --delta can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.verify != HashAlgorithm::None && action != "copy") {
+    std::cout << "error: --verify can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (!options.manifest.empty() && action != "copy") {
+    std::cout << "error: --manifest can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.dedupe != Dedupe::None && action != "copy") {
+    std::cout << "error: --dedupe can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.hardlinks && action != "copy") {
+    std::cout << "error: --hardlinks can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.symlinks != SymlinkPolicy::Default && action != "copy") {
+    std::cout << "error: --symlinks can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.onConflict != ConflictPolicy::Default && action != "copy") {
+    std::cout << "error: --on-conflict can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if ((options.bwlimit != 0 || options.iopsLimit != 0 ||
+       !options.control.empty()) &&
+      action != "copy") {
+    std::cout << "error: --bwlimit, --iops-limit, and --control can only be "
+                 "used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.preserve != 0 && action != "copy") {
+    std::cout << "error: --preserve can only be used when action is copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (!options.filter.empty() && action != "copy" && action != "delete") {
+    std::cout << "error: --include and --exclude can only be used when action "
+                 "is copy or delete"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (!options.ignoreFile.empty() && action != "copy" &&
+      action != "delete") {
+    std::cout << "error: --ignore-file can only be used when action is copy "
+                 "or delete"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (!options.selection.empty() && action != "copy" && action != "delete") {
+    std::cout << "error: --min-size, --max-size, --newer-than, --older-than, "
+                 "and --type can only be used when action is copy or delete"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.sync && action != "copy") {
+    std::cout << "error: --sync and --mirror can only be used when action is "
+                 "copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  // A sync copies the items it found changed, deep inside the sources, so
+  // patterns would be matched from the wrong place
+  if (options.sync &&
+      (!options.filter.empty() || !options.ignoreFile.empty())) {
+    std::cout << "error: --include, --exclude, and --ignore-file can't be "
+                 "used with --sync or --mirror"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.preflight && action != "copy" && action != "move") {
+    std::cout << "error: --preflight can only be used when action is copy or "
+                 "move"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (options.waitForSpace && action != "copy") {
+    std::cout << "error: --wait-for-space can only be used when action is "
+                 "copy"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (!options.index.empty() && !options.sync) {
+    std::cout << "error: --index can only be used with --sync or --mirror"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  if (!options.wal.empty() && action != "move") {
+    std::cout << "error: --wal can only be used when action is move"
+              << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  // The log records each move's final destination, so it can't find items
+  // left in the staging directory of a run that crashed
+  if (!options.wal.empty() && options.atomic) {
+    std::cout << "error: --wal can't be used with --atomic" << std::endl;
+    printUsage();
+    return 1;
+  }
+
+  return performFileOperation(action, srcPaths, destPaths, options);
 }
@@ -0,0 +1,679 @@
+#include "filter.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <map>
+#include <unordered_map>
+
+/**
+ * A state of the nondeterministic automaton the patterns are compiled to
+ */
+struct NfaNode {
+  enum Kind { Char, Split, Match } kind;
+  // For Char, the characters matched, as inclusive ranges
+  std::vector<std::pair<wchar_t, wchar_t>> ranges;
+  bool negated = false;
+  // The states that follow, or -1. Split states have two.
+  int out = -1;
+  int out1 = -1;
+  // For Match, the index of the pattern that matched
+  int pattern = -1;
+};
+
+struct PatternInfo {
+  bool exclude;
+  bool directoryOnly;
+};
+
+/**
+ * A state of the deterministic automaton, which stands for a set of states of
+ * the nondeterministic one
+ */
+struct DfaState {
+  std::vector<int> nodes;
+  // The patterns that match the path so far
+  std::vector<int> matches;
+  // Whether an include pattern could still match further down the path
+  bool canInclude = false;
+  // Transitions found so far, by case folded character
+  int ascii[128];
+  std::unordered_map<wchar_t, int> other;
+};
+
+struct FilterAutomaton {
+  std::vector<NfaNode> nodes;
+  std::vector<int> starts;
+  std::vector<PatternInfo> patterns;
+  bool hasIncludes = false;
+
+  // Built lazily. State 0 is the empty set, which nothing gets out of.
+  std::vector<char> reachesInclude;
+  std::vector<DfaState> states;
+  std::map<std::vector<int>, int> stateIds;
+  int start = 0;
+
+  void build();
+  int intern(std::vector<int> &nodes);
+  void addClosure(int node, std::vector<char> &seen,
+                  std::vector<int> &set) const;
+  int step(int state, wchar_t c);
+};
+
+static wchar_t fold(wchar_t c) {
+  if (c < 128) {
+    return c >= L'A' && c <= L'Z' ? (wchar_t)(c + 32) : c;
+  }
+  return (wchar_t)towlower(c);
+}
+
+static bool nodeMatches(const NfaNode &node, wchar_t c) {
+  bool inRange = false;
+  for (const std::pair<wchar_t, wchar_t> &range : node.ranges) {
+    if (c >= range.first && c <= range.second) {
+      inRange = true;
+      break;
+    }
+  }
+  return inRange != node.negated;
+}
+
+/**
+ * A piece of automaton with one way in, and the outs that are still to be
+ * connected to whatever comes next, each as a node index times two plus
+ * which of its outs it is
+ */
+struct Fragment {
+  int start;
+  std::vector<int> outs;
+};
+
+/**
+ * Builds fragments for globs and regular expressions into the given nodes
+ */
+class PatternCompiler {
+public:
+  PatternCompiler(std::vector<NfaNode> &nodes, const std::wstring &pattern)
+      : nodes(nodes), pattern(pattern), pos(0) {}
+
+  bool compileGlob(Fragment &fragment, bool &directoryOnly,
+                   std::string &error);
+  bool compileRegex(Fragment &fragment, std::string &error);
+
+private:
+  int addNode(NfaNode::Kind kind) {
+    NfaNode node;
+    node.kind = kind;
+    nodes.push_back(node);
+    return (int)nodes.size() - 1;
+  }
+
+  void patch(const std::vector<int> &outs, int target) {
+    for (int out : outs) {
+      if (out % 2 == 0) {
+        nodes[out / 2].out = target;
+      } else {
+        nodes[out / 2].out1 = target;
+      }
+    }
+  }
+
+  Fragment chars(const std::vector<std::pair<wchar_t, wchar_t>> &ranges,
+                 bool negated) {
+    int node = addNode(NfaNode::Char);
+    nodes[node].ranges = ranges;
+    nodes[node].negated = negated;
+    return Fragment{node, {node * 2}};
+  }
+
+  Fragment literal(wchar_t c) {
+    c = fold(c);
+    return chars({{c, c}}, false);
+  }
+
+  Fragment anyOf(bool crossSeparators) {
+    if (crossSeparators) {
+      return chars({}, true);
+    }
+    return chars({{L'/', L'/'}}, true);
+  }
+
+  /**
+   * Any number of directories, including none, like `**` and a slash in a
+   * glob
+   */
+  Fragment anyDirectories() {
+    return optional(concat(star(anyOf(true)), literal(L'/')));
+  }
+
+  Fragment empty() {
+    int node = addNode(NfaNode::Split);
+    return Fragment{node, {node * 2}};
+  }
+
+  Fragment concat(Fragment a, const Fragment &b) {
+    patch(a.outs, b.start);
+    a.outs = b.outs;
+    return a;
+  }
+
+  Fragment alternate(const Fragment &a, const Fragment &b) {
+    int node = addNode(NfaNode::Split);
+    nodes[node].out = a.start;
+    nodes[node].out1 = b.start;
+    Fragment result{node, a.outs};
+    result.outs.insert(result.outs.end(), b.outs.begin(), b.outs.end());
+    return result;
+  }
+
+  Fragment star(const Fragment &a) {
+    int node = addNode(NfaNode::Split);
+    nodes[node].out = a.start;
+    patch(a.outs, node);
+    return Fragment{node, {node * 2 + 1}};
+  }
+
+  Fragment plus(const Fragment &a) {
+    int node = addNode(NfaNode::Split);
+    nodes[node].out = a.start;
+    patch(a.outs, node);
+    return Fragment{a.start, {node * 2 + 1}};
+  }
+
+  Fragment optional(const Fragment &a) {
+    int node = addNode(NfaNode::Split);
+    nodes[node].out = a.start;
+    Fragment result{node, a.outs};
+    result.outs.push_back(node * 2 + 1);
+    return result;
+  }
+
+  bool parseClass(bool glob, Fragment &fragment, std::string &error);
+  bool parseAlternation(Fragment &fragment, std::string &error);
+  bool parseSequence(Fragment &fragment, std::string &error);
+  bool parseAtom(Fragment &fragment, std::string &error);
+
+  std::vector<NfaNode> &nodes;
+  std::wstring pattern;
+  size_t pos;
+};
+
+/**
+ * Parse a character set like `[a-z]`, starting just after the `[`
+ */
+bool PatternCompiler::parseClass(bool glob, Fragment &fragment,
+                                 std::string &error) {
+  std::vector<std::pair<wchar_t, wchar_t>> ranges;
+  bool negated = false;
+
+  if (pos < pattern.size() &&
+      (pattern[pos] == L'^' || (glob && pattern[pos] == L'!'))) {
+    negated = true;
+    pos++;
+  }
+
+  bool first = true;
+  while (pos < pattern.size() && (first || pattern[pos] != L']')) {
+    wchar_t low = pattern[pos++];
+    if (!glob && low == L'\\' && pos < pattern.size()) {
+      low = pattern[pos++];
+    }
+
+    wchar_t high = low;
+    if (pos + 1 < pattern.size() && pattern[pos] == L'-' &&
+        pattern[pos + 1] != L']') {
+      high = pattern[pos + 1];
+      pos += 2;
+    }
+
+    if (high < low) {
+      error = "character range is out of order";
+      return false;
+    }
+
+    // Keep both cases of letters, since paths are folded to lower case
+    ranges.push_back(std::make_pair(low, high));
+    if (fold(low) != low || fold(high) != high) {
+      ranges.push_back(std::make_pair(fold(low), fold(high)));
+    }
+    first = false;
+  }
+
+  if (pos == pattern.size()) {
+    error = "character set is missing its ]";
+    return false;
+  }
+  pos++;
+
+  // A path's names never contain a separator
+  if (glob && negated) {
+    ranges.push_back(std::make_pair(L'/', L'/'));
+  }
+
+  fragment = chars(ranges, negated);
+  return true;
+}
+
+bool PatternCompiler::compileGlob(Fragment &fragment, bool &directoryOnly,
+                                  std::string &error) {
+  std::replace(pattern.begin(), pattern.end(), L'\\', L'/');
+
+  directoryOnly = !pattern.empty() && pattern.back() == L'/';
+  while (!pattern.empty() && pattern.back() == L'/') {
+    pattern.pop_back();
+  }
+
+  // A slash anywhere but the end anchors the glob to the target
+  bool anchored = pattern.find(L'/') != std::wstring::npos;
+  if (!pattern.empty() && pattern[0] == L'/') {
+    pattern.erase(0, 1);
+  }
+
+  if (pattern.empty()) {
+    error = "pattern is empty";
+    return false;
+  }
+
+  // Otherwise it can match after any number of directories
+  fragment = anchored ? empty() : anyDirectories();
+
+  while (pos < pattern.size()) {
+    wchar_t c = pattern[pos++];
+
+    if (c == L'*' && pos < pattern.size() && pattern[pos] == L'*') {
+      while (pos < pattern.size() && pattern[pos] == L'*') {
+        pos++;
+      }
+
+      if (pos < pattern.size() && pattern[pos] == L'/') {
+        pos++;
+        fragment = concat(fragment, anyDirectories());
+      } else {
+        fragment = concat(fragment, star(anyOf(true)));
+      }
+    } else if (c == L'*') {
+      fragment = concat(fragment, star(anyOf(false)));
+    } else if (c == L'?') {
+      fragment = concat(fragment, anyOf(false));
+    } else if (c == L'[' && pattern.find(L']', pos) != std::wstring::npos) {
+      Fragment set;
+      if (!parseClass(true, set, error)) {
+        return false;
+      }
+      fragment = concat(fragment, set);
+    } else {
+      fragment = concat(fragment, literal(c));
+    }
+  }
+
+  return true;
+}
+
+bool PatternCompiler::compileRegex(Fragment &fragment, std::string &error) {
+  // Regular expressions always match the whole path
+  if (pos < pattern.size() && pattern[pos] == L'^') {
+    pos++;
+  }
+
+  if (!parseAlternation(fragment, error)) {
+    return false;
+  }
+
+  if (pos < pattern.size()) {
+    error = "unmatched )";
+    return false;
+  }
+
+  return true;
+}
+
+bool PatternCompiler::parseAlternation(Fragment &fragment,
+                                       std::string &error) {
+  if (!parseSequence(fragment, error)) {
+    return false;
+  }
+
+  while (pos < pattern.size() && pattern[pos] == L'|') {
+    pos++;
+    Fragment next;
+    if (!parseSequence(next, error)) {
+      return false;
+    }
+    fragment = alternate(fragment, next);
+  }
+
+  return true;
+}
+
+bool PatternCompiler::parseSequence(Fragment &fragment, std::string &error) {
+  fragment = empty();
+
+  while (pos < pattern.size() && pattern[pos] != L'|' &&
+         pattern[pos] != L')') {
+    // A trailing $ is allowed, since matches are anchored anyway
+    if (pattern[pos] == L'$' && pos + 1 == pattern.size()) {
+      pos++;
+      break;
+    }
+
+    Fragment atom;
+    if (!parseAtom(atom, error)) {
+      return false;
+    }
+
+    while (pos < pattern.size()) {
+      if (pattern[pos] == L'*') {
+        atom = star(atom);
+      } else if (pattern[pos] == L'+') {
+        atom = plus(atom);
+      } else if (pattern[pos] == L'?') {
+        atom = optional(atom);
+      } else {
+        break;
+      }
+      pos++;
+    }
+
+    fragment = concat(fragment, atom);
+  }
+
+  return true;
+}
+
+bool PatternCompiler::parseAtom(Fragment &fragment, std::string &error) {
+  wchar_t c = pattern[pos++];
+
+  switch (c) {
+  case L'(':
+    if (!parseAlternation(fragment, error)) {
+      return false;
+    }
+    if (pos == pattern.size() || pattern[pos] != L')') {
+      error = "unmatched (";
+      return false;
+    }
+    pos++;
+    return true;
+  case L'.':
+    fragment = anyOf(true);
+    return true;
+  case L'[':
+    return parseClass(false, fragment, error);
+  case L'*':
+  case L'+':
+  case L'?':
+    error = "nothing to repeat";
+    return false;
+  case L'\\':
+    if (pos == pattern.size()) {
+      error = "pattern ends with \\";
+      return false;
+    }
+    c = pattern[pos++];
+    if (c == L'd') {
+      fragment = chars({{L'0', L'9'}}, false);
+    } else if (c == L'w') {
+      fragment = chars({{L'a', L'z'}, {L'0', L'9'}, {L'_', L'_'}}, false);
+    } else if (c == L's') {
+      fragment = chars({{L' ', L' '}, {L'\t', L'\t'}}, false);
+    } else {
+      fragment = literal(c);
+    }
+    return true;
+  default:
+    fragment = literal(c);
+    return true;
+  }
+}
+
+void FilterAutomaton::addClosure(int node, std::vector<char> &seen,
+                                 std::vector<int> &set) const {
+  std::vector<int> pending(1, node);
+
+  while (!pending.empty()) {
+    int current = pending.back();
+    pending.pop_back();
+
+    if (current < 0 || seen[current]) {
+      continue;
+    }
+    seen[current] = 1;
+
+    if (nodes[current].kind == NfaNode::Split) {
+      pending.push_back(nodes[current].out1);
+      pending.push_back(nodes[current].out);
+    } else {
+      set.push_back(current);
+    }
+  }
+}
+
+int FilterAutomaton::intern(std::vector<int> &set) {
+  std::sort(set.begin(), set.end());
+
+  std::map<std::vector<int>, int>::iterator found = stateIds.find(set);
+  if (found != stateIds.end()) {
+    return found->second;
+  }
+
+  DfaState state;
+  state.nodes = set;
+  std::fill(state.ascii, state.ascii + 128, -1);
+
+  for (int node : set) {
+    if (nodes[node].kind == NfaNode::Match) {
+      state.matches.push_back(nodes[node].pattern);
+    }
+    if (reachesInclude[node]) {
+      state.canInclude = true;
+    }
+  }
+
+  int id = (int)states.size();
+  states.push_back(std::move(state));
+  stateIds[set] = id;
+
+  return id;
+}
+
+void FilterAutomaton::build() {
+  // Work back from the include patterns' matches to find every state that
+  // can lead to one
+  std::vector<std::vector<int>> incoming(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].out >= 0) {
+      incoming[nodes[i].out].push_back((int)i);
+    }
+    if (nodes[i].out1 >= 0) {
+      incoming[nodes[i].out1].push_back((int)i);
+    }
+  }
+
+  reachesInclude.assign(nodes.size(), 0);
+  std::vector<int> pending;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].kind == NfaNode::Match &&
+        !patterns[nodes[i].pattern].exclude) {
+      reachesInclude[i] = 1;
+      pending.push_back((int)i);
+    }
+  }
+
+  while (!pending.empty()) {
+    int node = pending.back();
+    pending.pop_back();
+    for (int previous : incoming[node]) {
+      if (!reachesInclude[previous]) {
+        reachesInclude[previous] = 1;
+        pending.push_back(previous);
+      }
+    }
+  }
+
+  std::vector<int> set;
+  intern(set);
+
+  std::vector<char> seen(nodes.size(), 0);
+  for (int node : starts) {
+    addClosure(node, seen, set);
+  }
+  start = intern(set);
+}
+
+int FilterAutomaton::step(int state, wchar_t c) {
+  if (state == 0) {
+    return 0;
+  }
+
+  c = fold(c);
+
+  if (c < 128 && states[state].ascii[c] >= 0) {
+    return states[state].ascii[c];
+  }
+  if (c >= 128) {
+    std::unordered_map<wchar_t, int>::const_iterator found =
+        states[state].other.find(c);
+    if (found != states[state].other.end()) {
+      return found->second;
+    }
+  }
+
+  std::vector<char> seen(nodes.size(), 0);
+  std::vector<int> set;
+  for (int node : states[state].nodes) {
+    if (nodes[node].kind == NfaNode::Char && nodeMatches(nodes[node], c)) {
+      addClosure(nodes[node].out, seen, set);
+    }
+  }
+
+  // Interning can add a state, so look this one up again afterwards
+  int next = intern(set);
+  if (c < 128) {
+    states[state].ascii[c] = next;
+  } else {
+    states[state].other[c] = next;
+  }
+
+  return next;
+}
+
+PathFilter::PathFilter() : automaton(std::make_shared<FilterAutomaton>()) {}
+
+bool PathFilter::add(const std::wstring &pattern, bool exclude,
+                     std::string &error, bool allowRegex) {
+  FilterAutomaton &a = *automaton;
+  PatternInfo info;
+  info.exclude = exclude;
+  info.directoryOnly = false;
+
+  Fragment fragment;
+  bool valid;
+  if (allowRegex && pattern.compare(0, 3, L"re:") == 0) {
+    PatternCompiler compiler(a.nodes, pattern.substr(3));
+    valid = compiler.compileRegex(fragment, error);
+  } else {
+    PatternCompiler compiler(a.nodes, pattern);
+    valid = compiler.compileGlob(fragment, info.directoryOnly, error);
+  }
+
+  if (!valid) {
+    return false;
+  }
+
+  NfaNode match;
+  match.kind = NfaNode::Match;
+  match.pattern = (int)a.patterns.size();
+  a.nodes.push_back(match);
+
+  for (int out : fragment.outs) {
+    if (out % 2 == 0) {
+      a.nodes[out / 2].out = (int)a.nodes.size() - 1;
+    } else {
+      a.nodes[out / 2].out1 = (int)a.nodes.size() - 1;
+    }
+  }
+
+  a.starts.push_back(fragment.start);
+  a.patterns.push_back(info);
+  a.hasIncludes = a.hasIncludes || !exclude;
+
+  // Start again with the new pattern
+  a.states.clear();
+  a.stateIds.clear();
+
+  return true;
+}
+
+bool PathFilter::empty() const { return automaton->patterns.empty(); }
+
+FilterState PathFilter::root() const {
+  if (automaton->states.empty()) {
+    automaton->build();
+  }
+
+  FilterState state;
+  state.state = automaton->start;
+  state.included = !automaton->hasIncludes;
+  return state;
+}
+
+/**
+ * Step through a name from the given state
+ */
+static int stepName(FilterAutomaton &a, int state, const wchar_t *name) {
+  for (const wchar_t *c = name; *c != 0 && state != 0; c++) {
+    state = a.step(state, *c);
+  }
+  return state;
+}
+
+bool PathFilter::excludes(const FilterState &parent, const wchar_t *name,
+                          bool isDirectory, FilterState &child) const {
+  FilterAutomaton &a = *automaton;
+  int state = stepName(a, parent.state, name);
+
+  bool included = parent.included;
+  for (int pattern : a.states[state].matches) {
+    const PatternInfo &info = a.patterns[pattern];
+    if (info.directoryOnly && !isDirectory) {
+      continue;
+    }
+    if (info.exclude) {
+      return true;
+    }
+    included = true;
+  }
+
+  if (!isDirectory) {
+    return !included;
+  }
+
+  child.state = a.step(state, L'/');
+  child.included = included;
+
+  // Skip directories that nothing beneath can be included from
+  return !included && !a.states[child.state].canInclude;
+}
+
+int PathFilter::lastMatch(const FilterState &parent, const wchar_t *name,
+                          bool isDirectory, FilterState &child) const {
+  FilterAutomaton &a = *automaton;
+  int state = stepName(a, parent.state, name);
+
+  int last = -1;
+  for (int pattern : a.states[state].matches) {
+    if (!a.patterns[pattern].directoryOnly || isDirectory) {
+      last = std::max(last, pattern);
+    }
+  }
+
+  if (isDirectory) {
+    child.state = a.step(state, L'/');
+    child.included = parent.included;
+  }
+
+  return last;
+}
+
+bool PathFilter::isExclude(int pattern) const {
+  return automaton->patterns[pattern].exclude;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "platform.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Where a walk is in a filter's automaton, for the entries of one directory
+ */
+struct FilterState {
+  int state = 0;
+  // Whether a directory above matched an include pattern, which includes
+  // everything beneath it
+  bool included = false;
+};
+
+struct FilterAutomaton;
+
+/**
+ * Include and exclude patterns, compiled together into a single automaton
+ * that's matched against paths relative to each target, one name at a time as
+ * the walk goes down. The automaton is built lazily: its states are worked out
+ * the first time a walk reaches them, then reused.
+ *
+ * Patterns are globs, where `*` and `?` match within a name, `**` matches
+ * across names, and `[a-z]` matches a set of characters. A glob without a
+ * slash matches names at any depth, one with a slash matches from the target
+ * down, and one that ends in a slash only matches directories. Patterns that
+ * start with `re:` are regular expressions matched against the whole relative
+ * path, with `/` between names. Matching ignores case.
+ *
+ * Excludes win over includes. When there are includes, files have to match
+ * one, or be in a directory that does, and directories no include can match
+ * beneath are skipped without being listed.
+ */
+class PathFilter {
+public:
+  PathFilter();
+
+  /**
+   * Add a pattern, or set `error` and return false if it isn't valid. Without
+   * `allowRegex`, patterns starting with `re:` are taken as globs.
+   */
+  bool add(const std::wstring &pattern, bool exclude, std::string &error,
+           bool allowRegex = true);
+
+  /**
+   * Check if the filter has no patterns, so nothing is excluded
+   */
+  bool empty() const;
+
+  /**
+   * Get the state for the entries of a target's root directory
+   */
+  FilterState root() const;
+
+  /**
+   * Check if the entry with the given name, in a directory with the given
+   * state, is excluded. If it's a directory that isn't, `child` is set to
+   * the state for its own entries.
+   */
+  bool excludes(const FilterState &parent, const wchar_t *name,
+                bool isDirectory, FilterState &child) const;
+
+  /**
+   * Find the last pattern added that matches the entry with the given name,
+   * in a directory with the given state, and return its index, or -1 if none
+   * do. If it's a directory, `child` is set to the state for its own entries.
+   */
+  int lastMatch(const FilterState &parent, const wchar_t *name,
+                bool isDirectory, FilterState &child) const;
+
+  /**
+   * Check if the pattern at the given index was added as an exclude
+   */
+  bool isExclude(int pattern) const;
+
+private:
+  // Shared so that copies of the options share one automaton, and mutable
+  // through const methods since states are added as they're reached
+  std::shared_ptr<FilterAutomaton> automaton;
+};
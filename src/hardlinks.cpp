@@ -0,0 +1,83 @@
+#include "hardlinks.h"
+#include "parallel.h"
+
+#include <unordered_map>
+
+/**
+ * Where a file's data lives: its volume and its id on that volume
+ */
+struct FileIdentity {
+  DWORD volume;
+  ULONGLONG fileId;
+  // Only files with other links need to be matched
+  bool isLinked;
+
+  bool operator==(const FileIdentity &other) const {
+    return volume == other.volume && fileId == other.fileId;
+  }
+};
+
+struct FileIdentityHash {
+  size_t operator()(const FileIdentity &identity) const {
+    return std::hash<ULONGLONG>()(identity.fileId ^
+                                  ((ULONGLONG)identity.volume << 32));
+  }
+};
+
+/**
+ * Read the identity of the file at the given path
+ */
+static DWORD identityOf(const std::wstring &path, FileIdentity &identity) {
+  HANDLE handle = CreateFileW(
+      path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  BY_HANDLE_FILE_INFORMATION info;
+  DWORD error = 0;
+
+  if (GetFileInformationByHandle(handle, &info)) {
+    identity.volume = info.dwVolumeSerialNumber;
+    identity.fileId =
+        ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    identity.isLinked = info.nNumberOfLinks > 1;
+  } else {
+    error = GetLastError();
+  }
+
+  CloseHandle(handle);
+
+  return error;
+}
+
+DWORD findHardLinks(const std::vector<FileCopy> &files,
+                    std::vector<size_t> &originals) {
+  originals.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    originals[i] = i;
+  }
+
+  // Listings don't include link counts, so each file is opened to get them.
+  // That's most of the cost, so it's done on several threads, each filling in
+  // its own entries.
+  std::vector<FileIdentity> identities(files.size());
+  DWORD error = runParallel(files.size(), [&](size_t i) {
+    return identityOf(files[i].src, identities[i]);
+  });
+  if (error != 0) {
+    return error;
+  }
+
+  std::unordered_map<FileIdentity, size_t, FileIdentityHash> firsts;
+
+  for (size_t i = 0; i < files.size(); i++) {
+    if (identities[i].isLinked) {
+      originals[i] = firsts.insert(std::make_pair(identities[i], i))
+                         .first->second;
+    }
+  }
+
+  return 0;
+}
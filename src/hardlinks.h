@@ -0,0 +1,15 @@
+#pragma once
+
+#include "paths.h"
+
+#include <vector>
+
+/**
+ * Find the files that are hard links to the same file as an earlier one in
+ * the list, by the volume and file id of files with more than one link.
+ * `originals` is set to the index of the first name each file was found
+ * under, or to the file's own index when it's the first.
+ * Returns 0 or a Windows error code.
+ */
+DWORD findHardLinks(const std::vector<FileCopy> &files,
+                    std::vector<size_t> &originals);
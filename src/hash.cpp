@@ -0,0 +1,201 @@
+#include "hash.h"
+#include "priority.h"
+#include "throttle.h"
+
+#include <string.h>
+
+// The size of each read when hashing a file. Unbuffered reads need this to be
+// a multiple of the sector size.
+static const DWORD HASH_READ_SIZE = 1024 * 1024;
+
+static const ULONGLONG PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const ULONGLONG PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const ULONGLONG PRIME64_3 = 0x165667B19E3779F9ULL;
+static const ULONGLONG PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const ULONGLONG PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+bool parseHashAlgorithm(const std::string &value, HashAlgorithm &algorithm) {
+  if (value == "xxh3") {
+    algorithm = HashAlgorithm::Xxh3;
+  } else if (value == "crc32c") {
+    algorithm = HashAlgorithm::Crc32c;
+  } else if (value == "blake3") {
+    algorithm = HashAlgorithm::Blake3;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+std::string hashAlgorithmName(HashAlgorithm algorithm) {
+  switch (algorithm) {
+  case HashAlgorithm::Xxh3:
+    return "xxh3";
+  case HashAlgorithm::Crc32c:
+    return "crc32c";
+  case HashAlgorithm::Blake3:
+    return "blake3";
+  default:
+    return "none";
+  }
+}
+
+std::string toHex64(ULONGLONG value) {
+  static const char digits[] = "0123456789abcdef";
+
+  std::string hex(16, '0');
+  for (int i = 15; i >= 0; i--) {
+    hex[i] = digits[value & 0xF];
+    value >>= 4;
+  }
+
+  return hex;
+}
+
+static inline ULONGLONG rotateLeft(ULONGLONG value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline ULONGLONG read64(const BYTE *data) {
+  ULONGLONG value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline UINT32 read32(const BYTE *data) {
+  UINT32 value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline ULONGLONG xxh64Round(ULONGLONG acc, ULONGLONG input) {
+  acc += input * PRIME64_2;
+  acc = rotateLeft(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline ULONGLONG xxh64Merge(ULONGLONG acc, ULONGLONG value) {
+  acc ^= xxh64Round(0, value);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+ULONGLONG xxh64(const void *data, size_t length, ULONGLONG seed) {
+  const BYTE *p = (const BYTE *)data;
+  const BYTE *end = p + length;
+  ULONGLONG hash;
+
+  if (length >= 32) {
+    ULONGLONG v1 = seed + PRIME64_1 + PRIME64_2;
+    ULONGLONG v2 = seed + PRIME64_2;
+    ULONGLONG v3 = seed;
+    ULONGLONG v4 = seed - PRIME64_1;
+
+    do {
+      v1 = xxh64Round(v1, read64(p));
+      v2 = xxh64Round(v2, read64(p + 8));
+      v3 = xxh64Round(v3, read64(p + 16));
+      v4 = xxh64Round(v4, read64(p + 24));
+      p += 32;
+    } while (p + 32 <= end);
+
+    hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) +
+           rotateLeft(v4, 18);
+    hash = xxh64Merge(hash, v1);
+    hash = xxh64Merge(hash, v2);
+    hash = xxh64Merge(hash, v3);
+    hash = xxh64Merge(hash, v4);
+  } else {
+    hash = seed + PRIME64_5;
+  }
+
+  hash += length;
+
+  for (; p + 8 <= end; p += 8) {
+    hash ^= xxh64Round(0, read64(p));
+    hash = rotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+  }
+
+  if (p + 4 <= end) {
+    hash ^= (ULONGLONG)read32(p) * PRIME64_1;
+    hash = rotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  for (; p < end; p++) {
+    hash ^= *p * PRIME64_5;
+    hash = rotateLeft(hash, 11) * PRIME64_1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= PRIME64_3;
+  hash ^= hash >> 32;
+
+  return hash;
+}
+
+std::unique_ptr<Hasher> createHasher(HashAlgorithm algorithm) {
+  switch (algorithm) {
+  case HashAlgorithm::Xxh3:
+    return std::unique_ptr<Hasher>(new Xxh3Hasher());
+  case HashAlgorithm::Crc32c:
+    return std::unique_ptr<Hasher>(new Crc32cHasher());
+  case HashAlgorithm::Blake3:
+    return std::unique_ptr<Hasher>(new Blake3Hasher());
+  default:
+    return std::unique_ptr<Hasher>();
+  }
+}
+
+DWORD hashFile(const std::wstring &path, HashAlgorithm algorithm,
+               bool unbuffered, std::string &digest, ULONGLONG &bytes) {
+  HANDLE file = CreateFileW(
+      path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      unbuffered ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+  setIoPriorityHint(file);
+
+  // Unbuffered reads have to go into sector-aligned memory, and VirtualAlloc
+  // always gives page-aligned memory
+  BYTE *buffer = (BYTE *)VirtualAlloc(NULL, HASH_READ_SIZE,
+                                      MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (buffer == NULL) {
+    DWORD error = GetLastError();
+    CloseHandle(file);
+    return error;
+  }
+
+  std::unique_ptr<Hasher> hasher = createHasher(algorithm);
+  DWORD error = 0;
+  bytes = 0;
+
+  while (true) {
+    DWORD read = 0;
+    if (!ReadFile(file, buffer, HASH_READ_SIZE, &read, NULL)) {
+      error = GetLastError();
+      break;
+    }
+    // Charged once the size is known, so the short last read and the empty
+    // one at the end aren't counted as whole buffers
+    throttleIo(read);
+    if (read == 0) {
+      break;
+    }
+
+    hasher->update(buffer, read);
+    bytes += read;
+  }
+
+  VirtualFree(buffer, 0, MEM_RELEASE);
+  CloseHandle(file);
+
+  if (error == 0) {
+    digest = hasher->digest();
+  }
+
+  return error;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "platform.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * The content hashes that copies can be verified with
+ */
+enum class HashAlgorithm {
+  None,
+  Xxh3,
+  Crc32c,
+  Blake3,
+};
+
+/**
+ * Parse the value of the --verify option
+ */
+bool parseHashAlgorithm(const std::string &value, HashAlgorithm &algorithm);
+
+/**
+ * Get the name of the given algorithm, as accepted by parseHashAlgorithm
+ */
+std::string hashAlgorithmName(HashAlgorithm algorithm);
+
+/**
+ * Hash the given bytes with XXH64
+ */
+ULONGLONG xxh64(const void *data, size_t length, ULONGLONG seed = 0);
+
+/**
+ * Format a 64-bit hash as hex, most significant byte first
+ */
+std::string toHex64(ULONGLONG value);
+
+/**
+ * A hash that's fed its input a piece at a time
+ */
+class Hasher {
+public:
+  virtual ~Hasher() {}
+
+  virtual void update(const void *data, size_t length) = 0;
+
+  /**
+   * Get the hash of everything so far, as hex
+   */
+  virtual std::string digest() const = 0;
+};
+
+/**
+ * XXH3, 64-bit, with the default secret and no seed
+ */
+class Xxh3Hasher : public Hasher {
+public:
+  Xxh3Hasher();
+
+  void update(const void *data, size_t length) override;
+  std::string digest() const override;
+  ULONGLONG digest64() const;
+
+private:
+  void consumeStripe(const BYTE *stripe);
+
+  alignas(16) ULONGLONG acc[8];
+  size_t stripesInBlock;
+  ULONGLONG total;
+  BYTE buffer[256];
+  size_t buffered;
+  BYTE lastStripe[64];
+};
+
+/**
+ * CRC-32C (Castagnoli), using the SSE 4.2 CRC instruction when the CPU has it
+ */
+class Crc32cHasher : public Hasher {
+public:
+  Crc32cHasher();
+
+  void update(const void *data, size_t length) override;
+  std::string digest() const override;
+
+private:
+  UINT32 crc;
+};
+
+/**
+ * BLAKE3 with a 256-bit output. Large inputs have their 1 KiB chunks hashed
+ * on several threads at once, which BLAKE3's tree structure allows.
+ */
+class Blake3Hasher : public Hasher {
+public:
+  Blake3Hasher();
+
+  void update(const void *data, size_t length) override;
+  std::string digest() const override;
+
+private:
+  void addChunkValue(const UINT32 *value);
+  void finishChunk();
+
+  // Chaining values of finished subtrees, 8 words each
+  std::vector<UINT32> stack;
+  // The chunk being hashed
+  UINT32 chunkValue[8];
+  ULONGLONG chunkCounter;
+  BYTE block[64];
+  size_t blockLength;
+  size_t blocksDone;
+};
+
+/**
+ * Create a hasher for the given algorithm
+ */
+std::unique_ptr<Hasher> createHasher(HashAlgorithm algorithm);
+
+/**
+ * Hash the file at the given path. With `unbuffered`, the file is read past
+ * the system cache, so what's hashed is what's on the disk. `bytes` is set to
+ * the number of bytes read. Returns 0 or a Windows error code.
+ */
+DWORD hashFile(const std::wstring &path, HashAlgorithm algorithm,
+               bool unbuffered, std::string &digest, ULONGLONG &bytes);
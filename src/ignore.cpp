@@ -0,0 +1,121 @@
+#include "ignore.h"
+#include "paths.h"
+
+void parseIgnoreFile(const std::string &contents, PathFilter &patterns) {
+  size_t start = 0;
+
+  // Skip a UTF-8 byte order mark
+  if (contents.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+    start = 3;
+  }
+
+  while (start < contents.size()) {
+    size_t end = contents.find('\n', start);
+    if (end == std::string::npos) {
+      end = contents.size();
+    }
+
+    std::string line = contents.substr(start, end - start);
+    start = end + 1;
+
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    // Trailing spaces don't count, unless the last is escaped
+    while (!line.empty() && line.back() == ' ') {
+      if (line.size() >= 2 && line[line.size() - 2] == '\\') {
+        line.erase(line.size() - 2, 1);
+        break;
+      }
+      line.pop_back();
+    }
+
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    bool exclude = true;
+    if (line[0] == '!') {
+      exclude = false;
+      line.erase(0, 1);
+    } else if (line[0] == '\\' && line.size() > 1 &&
+               (line[1] == '#' || line[1] == '!')) {
+      line.erase(0, 1);
+    }
+
+    std::string error;
+    patterns.add(toWide(line), exclude, error, false);
+  }
+}
+
+DWORD readIgnoreFile(const std::wstring &path, IgnoreState &state) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  LARGE_INTEGER size;
+  DWORD read = 0;
+  std::string data;
+
+  DWORD error = 0;
+  if (!GetFileSizeEx(file, &size)) {
+    error = GetLastError();
+  } else {
+    data.resize((size_t)size.QuadPart);
+    if (!data.empty() &&
+        !ReadFile(file, &data[0], (DWORD)data.length(), &read, NULL)) {
+      error = GetLastError();
+    }
+  }
+  CloseHandle(file);
+
+  if (error != 0) {
+    return error;
+  }
+
+  data.resize(read);
+
+  std::shared_ptr<IgnoreRules> rules = std::make_shared<IgnoreRules>();
+  parseIgnoreFile(data, rules->patterns);
+
+  if (!rules->patterns.empty()) {
+    rules->parent = state.rules;
+    state.states.push_back(rules->patterns.root());
+    state.rules = rules;
+  }
+
+  return 0;
+}
+
+bool isIgnored(const IgnoreState &state, const wchar_t *name,
+               bool isDirectory, IgnoreState &child) {
+  // 1 when ignored, -1 when kept by a `!` pattern, or 0 when undecided
+  int decision = 0;
+
+  if (isDirectory) {
+    child.rules = state.rules;
+    child.states.resize(state.states.size());
+  }
+
+  FilterState unused;
+  size_t i = state.states.size();
+
+  // Files are done once a file decides, but directories need a state in
+  // every file for their own entries
+  for (const IgnoreRules *rules = state.rules.get();
+       rules != NULL && (isDirectory || decision == 0);
+       rules = rules->parent.get()) {
+    i--;
+    int pattern =
+        rules->patterns.lastMatch(state.states[i], name, isDirectory,
+                                  isDirectory ? child.states[i] : unused);
+    if (decision == 0 && pattern >= 0) {
+      decision = rules->patterns.isExclude(pattern) ? 1 : -1;
+    }
+  }
+
+  return decision == 1;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "filter.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * The patterns of one ignore file, linked to those of the ignore files in
+ * the directories above it. Each file is read and compiled once, and shared by
+ * everything beneath its directory.
+ */
+struct IgnoreRules {
+  std::shared_ptr<const IgnoreRules> parent;
+  PathFilter patterns;
+};
+
+/**
+ * Where a walk is in every ignore file that applies to a directory's entries
+ */
+struct IgnoreState {
+  // The nearest ignore file, or null when there are none
+  std::shared_ptr<const IgnoreRules> rules;
+  // The state in each ignore file's patterns, the nearest file's last
+  std::vector<FilterState> states;
+};
+
+/**
+ * Add the patterns of an ignore file, written like a .gitignore, to the given
+ * filter. Patterns are excludes, or includes when they start with `!`, and
+ * the last one that matches wins. Invalid patterns are left out, like git
+ * does.
+ */
+void parseIgnoreFile(const std::string &contents, PathFilter &patterns);
+
+/**
+ * Read the ignore file at the given path, and make its patterns apply to the
+ * entries of the directory it's in, on top of those already in `state`.
+ * Returns 0 or a Windows error code.
+ */
+DWORD readIgnoreFile(const std::wstring &path, IgnoreState &state);
+
+/**
+ * Check if the entry with the given name, in a directory with the given
+ * state, is ignored. The nearest ignore file with a matching pattern decides.
+ * If it's a directory that isn't ignored, `child` is set to the state for its
+ * own entries.
+ */
+bool isIgnored(const IgnoreState &state, const wchar_t *name,
+               bool isDirectory, IgnoreState &child);
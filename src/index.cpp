@@ -0,0 +1,293 @@
+#include "index.h"
+#include "walker.h"
+
+#include <vector>
+
+static const char INDEX_MAGIC[8] = {'F', 'O', 'P', 'S', 'I', 'N', 'D', 'X'};
+static const DWORD INDEX_VERSION = 1;
+
+// The table starts with this many slots, and doubles once more than 3/4 of
+// them are used. The slot count is always a power of two.
+static const ULONGLONG INDEX_INITIAL_SLOTS = 1 << 16;
+
+struct IndexHeader {
+  char magic[8];
+  DWORD version;
+  DWORD reserved;
+  ULONGLONG slotCount;
+  ULONGLONG used;
+};
+
+// A slot with a path hash of 0 is empty
+struct IndexSlot {
+  ULONGLONG pathHash;
+  ULONGLONG size;
+  ULONGLONG lastWriteTime;
+  DWORD attributes;
+  DWORD reserved;
+};
+
+/**
+ * Hash a path for the table, keeping 0 free to mark empty slots
+ */
+static ULONGLONG slotHash(const std::wstring &path) {
+  ULONGLONG hash = hashPath(path);
+  return hash == 0 ? 1 : hash;
+}
+
+static IndexHeader *headerOf(BYTE *view) { return (IndexHeader *)view; }
+
+static IndexSlot *slotsOf(BYTE *view) {
+  return (IndexSlot *)(view + sizeof(IndexHeader));
+}
+
+/**
+ * Find the slot for the given hash, or the empty slot where it would go
+ */
+static IndexSlot *probe(BYTE *view, ULONGLONG hash) {
+  ULONGLONG mask = headerOf(view)->slotCount - 1;
+  IndexSlot *slots = slotsOf(view);
+
+  for (ULONGLONG i = hash & mask;; i = (i + 1) & mask) {
+    if (slots[i].pathHash == hash || slots[i].pathHash == 0) {
+      return &slots[i];
+    }
+  }
+}
+
+FileIndex::FileIndex()
+    : file(INVALID_HANDLE_VALUE), mapping(NULL), view(NULL) {}
+
+FileIndex::~FileIndex() {
+  unmap();
+
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+}
+
+DWORD FileIndex::map(ULONGLONG slotCount) {
+  ULONGLONG size = sizeof(IndexHeader) + slotCount * sizeof(IndexSlot);
+
+  // Mapping more than the file's size grows the file to match
+  mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, (DWORD)(size >> 32),
+                               (DWORD)size, NULL);
+  if (mapping == NULL) {
+    return GetLastError();
+  }
+
+  view = (BYTE *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+  if (view == NULL) {
+    DWORD error = GetLastError();
+    CloseHandle(mapping);
+    mapping = NULL;
+    return error;
+  }
+
+  return 0;
+}
+
+void FileIndex::unmap() {
+  if (view != NULL) {
+    UnmapViewOfFile(view);
+    view = NULL;
+  }
+
+  if (mapping != NULL) {
+    CloseHandle(mapping);
+    mapping = NULL;
+  }
+}
+
+DWORD FileIndex::open(const std::wstring &path) {
+  file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                     FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                     NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize)) {
+    return GetLastError();
+  }
+
+  if (fileSize.QuadPart == 0) {
+    DWORD error = map(INDEX_INITIAL_SLOTS);
+    if (error != 0) {
+      return error;
+    }
+
+    IndexHeader *header = headerOf(view);
+    memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header->version = INDEX_VERSION;
+    header->reserved = 0;
+    header->slotCount = INDEX_INITIAL_SLOTS;
+    header->used = 0;
+    return 0;
+  }
+
+  // Don't write over a file that isn't an index. Mapping a file smaller than
+  // the header would grow it.
+  if ((ULONGLONG)fileSize.QuadPart < sizeof(IndexHeader)) {
+    return ERROR_BAD_FORMAT;
+  }
+
+  // Map just the header first to find out how big the table is
+  DWORD error = map(0);
+  if (error != 0) {
+    return error;
+  }
+
+  IndexHeader *header = headerOf(view);
+  ULONGLONG slotCount = header->slotCount;
+
+  if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      header->version != INDEX_VERSION || slotCount == 0 ||
+      (slotCount & (slotCount - 1)) != 0 ||
+      (ULONGLONG)fileSize.QuadPart <
+          sizeof(IndexHeader) + slotCount * sizeof(IndexSlot)) {
+    return ERROR_BAD_FORMAT;
+  }
+
+  unmap();
+  return map(slotCount);
+}
+
+bool FileIndex::empty() const { return headerOf(view)->used == 0; }
+
+bool FileIndex::find(const std::wstring &path, IndexEntry &entry) const {
+  const IndexSlot *slot = probe(view, slotHash(path));
+  if (slot->pathHash == 0) {
+    return false;
+  }
+
+  entry.size = slot->size;
+  entry.lastWriteTime = slot->lastWriteTime;
+  entry.attributes = slot->attributes;
+  return true;
+}
+
+DWORD FileIndex::grow() {
+  IndexHeader *header = headerOf(view);
+  ULONGLONG slotCount = header->slotCount;
+
+  // Take the used slots out, then put them back into a table twice the size
+  std::vector<IndexSlot> used;
+  used.reserve((size_t)header->used);
+  for (ULONGLONG i = 0; i < slotCount; i++) {
+    if (slotsOf(view)[i].pathHash != 0) {
+      used.push_back(slotsOf(view)[i]);
+    }
+  }
+
+  unmap();
+  DWORD error = map(slotCount * 2);
+  if (error != 0) {
+    return error;
+  }
+
+  header = headerOf(view);
+  header->slotCount = slotCount * 2;
+  memset(slotsOf(view), 0, (size_t)(header->slotCount * sizeof(IndexSlot)));
+
+  for (const IndexSlot &slot : used) {
+    *probe(view, slot.pathHash) = slot;
+  }
+
+  return 0;
+}
+
+DWORD FileIndex::put(const std::wstring &path, const IndexEntry &entry) {
+  IndexHeader *header = headerOf(view);
+
+  if ((header->used + 1) * 4 > header->slotCount * 3) {
+    DWORD error = grow();
+    if (error != 0) {
+      return error;
+    }
+    header = headerOf(view);
+  }
+
+  ULONGLONG hash = slotHash(path);
+  IndexSlot *slot = probe(view, hash);
+
+  if (slot->pathHash == 0) {
+    header->used++;
+  }
+
+  slot->pathHash = hash;
+  slot->size = entry.size;
+  slot->lastWriteTime = entry.lastWriteTime;
+  slot->attributes = entry.attributes;
+  slot->reserved = 0;
+
+  return 0;
+}
+
+void FileIndex::erase(const std::wstring &path) {
+  IndexHeader *header = headerOf(view);
+  IndexSlot *slots = slotsOf(view);
+  ULONGLONG mask = header->slotCount - 1;
+
+  IndexSlot *slot = probe(view, slotHash(path));
+  if (slot->pathHash == 0) {
+    return;
+  }
+
+  // Shift later entries of the same run back into the gap, so lookups never
+  // stop early at an empty slot and no tombstones are needed
+  ULONGLONG hole = (ULONGLONG)(slot - slots);
+  for (ULONGLONG i = (hole + 1) & mask; slots[i].pathHash != 0;
+       i = (i + 1) & mask) {
+    ULONGLONG home = slots[i].pathHash & mask;
+    bool canMove = hole <= i ? (home <= hole || home > i)
+                             : (home <= hole && home > i);
+    if (canMove) {
+      slots[hole] = slots[i];
+      hole = i;
+    }
+  }
+
+  slots[hole].pathHash = 0;
+  header->used--;
+}
+
+DWORD FileIndex::flush() {
+  if (view == NULL) {
+    return 0;
+  }
+
+  if (!FlushViewOfFile(view, 0) || !FlushFileBuffers(file)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+DWORD updateIndex(FileIndex &index, const std::vector<Target> &targets) {
+  for (const Target &target : targets) {
+    DWORD putError = 0;
+    DWORD error = walkTree(target.dest, [&](const std::wstring &path,
+                                            const WIN32_FIND_DATAW &data) {
+      IndexEntry entry;
+      entry.size = fileSizeOf(data);
+      entry.lastWriteTime = fileTimeToTicks(data.ftLastWriteTime);
+      entry.attributes = data.dwFileAttributes;
+
+      if (putError == 0) {
+        putError = index.put(path, entry);
+      }
+      return putError == 0;
+    });
+
+    if (error != 0 && error != ERROR_FILE_NOT_FOUND) {
+      return error;
+    }
+    if (putError != 0) {
+      return putError;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * What the index knows about a single destination path
+ */
+struct IndexEntry {
+  ULONGLONG size;
+  ULONGLONG lastWriteTime;
+  DWORD attributes;
+};
+
+/**
+ * A persistent index of what's at a sync's destination, so later syncs can
+ * compare the source against it instead of listing the destination again.
+ * Entries are kept in a memory-mapped open-addressing hash table, keyed by a
+ * hash of their path, and the table doubles in size when it gets too full.
+ *
+ * The index assumes the destination only changes through syncs that use it.
+ */
+class FileIndex {
+public:
+  FileIndex();
+  ~FileIndex();
+
+  /**
+   * Open the index at the given path, creating it if it doesn't exist.
+   * Returns 0 or a Windows error code.
+   */
+  DWORD open(const std::wstring &path);
+
+  /**
+   * Check if the index has no entries yet
+   */
+  bool empty() const;
+
+  /**
+   * Look up the entry for the given path
+   */
+  bool find(const std::wstring &path, IndexEntry &entry) const;
+
+  /**
+   * Add or replace the entry for the given path. Returns 0 or a Windows error
+   * code.
+   */
+  DWORD put(const std::wstring &path, const IndexEntry &entry);
+
+  /**
+   * Remove the entry for the given path, if there is one
+   */
+  void erase(const std::wstring &path);
+
+  /**
+   * Write the index to disk, if it was opened. Returns 0 or a Windows error
+   * code.
+   */
+  DWORD flush();
+
+private:
+  DWORD map(ULONGLONG slotCount);
+  void unmap();
+  DWORD grow();
+
+  HANDLE file;
+  HANDLE mapping;
+  BYTE *view;
+};
+
+/**
+ * Record the current state of everything at or below each target's
+ * destination. Returns 0 or a Windows error code.
+ */
+DWORD updateIndex(FileIndex &index, const std::vector<Target> &targets);
@@ -0,0 +1,265 @@
+#include "journal.h"
+
+#include <algorithm>
+
+static const char JOURNAL_MAGIC[8] = {'F', 'O', 'P', 'S', 'J', 'R', 'N', 'L'};
+static const DWORD JOURNAL_VERSION = 1;
+static const ULONGLONG JOURNAL_INITIAL_CAPACITY = 1024 * 1024;
+
+enum RecordType : DWORD {
+  RECORD_FILE_DONE = 1,
+  RECORD_CHUNKS = 2,
+};
+
+struct JournalHeader {
+  char magic[8];
+  DWORD version;
+  DWORD reserved;
+};
+
+struct RecordHeader {
+  DWORD type;
+  DWORD length;
+  ULONGLONG pathHash;
+  ULONGLONG size;
+  ULONGLONG lastWriteTime;
+  // A hash of the fields above, to spot records torn by a crash
+  ULONGLONG check;
+};
+
+// Chunk records are followed by a bitmap with one bit per chunk
+struct ChunkHeader {
+  DWORD chunkSize;
+  DWORD reserved;
+  ULONGLONG chunkCount;
+};
+
+static ULONGLONG mix(ULONGLONG hash, ULONGLONG value) {
+  hash ^= value + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+  return hash * 0xBF58476D1CE4E5B9ULL;
+}
+
+static ULONGLONG checkOf(const RecordHeader &record) {
+  ULONGLONG hash = mix(record.type, record.length);
+  hash = mix(hash, record.pathHash);
+  hash = mix(hash, record.size);
+  return mix(hash, record.lastWriteTime);
+}
+
+static RecordHeader recordFor(const FileCopy &file, DWORD type, DWORD length) {
+  RecordHeader record;
+  record.type = type;
+  record.length = length;
+  record.pathHash = hashPath(file.dest);
+  record.size = file.size;
+  record.lastWriteTime = file.lastWriteTime;
+  record.check = checkOf(record);
+  return record;
+}
+
+Journal::Journal()
+    : file(INVALID_HANDLE_VALUE), mapping(NULL), view(NULL), capacity(0),
+      used(0) {}
+
+Journal::~Journal() {
+  unmap();
+
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+}
+
+DWORD Journal::map(ULONGLONG newCapacity) {
+  // Mapping more than the file's size grows the file to match
+  mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE,
+                               (DWORD)(newCapacity >> 32), (DWORD)newCapacity,
+                               NULL);
+  if (mapping == NULL) {
+    return GetLastError();
+  }
+
+  view = (BYTE *)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+  if (view == NULL) {
+    DWORD error = GetLastError();
+    CloseHandle(mapping);
+    mapping = NULL;
+    return error;
+  }
+
+  capacity = newCapacity;
+
+  return 0;
+}
+
+void Journal::unmap() {
+  if (view != NULL) {
+    UnmapViewOfFile(view);
+    view = NULL;
+  }
+
+  if (mapping != NULL) {
+    CloseHandle(mapping);
+    mapping = NULL;
+  }
+}
+
+DWORD Journal::open(const std::wstring &path) {
+  file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                     FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                     NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize)) {
+    return GetLastError();
+  }
+
+  bool isNew = fileSize.QuadPart == 0;
+
+  DWORD error =
+      map(std::max((ULONGLONG)fileSize.QuadPart, JOURNAL_INITIAL_CAPACITY));
+  if (error != 0) {
+    return error;
+  }
+
+  JournalHeader *header = (JournalHeader *)view;
+
+  if (isNew) {
+    memcpy(header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    header->version = JOURNAL_VERSION;
+    header->reserved = 0;
+    used = sizeof(JournalHeader);
+    return flush();
+  }
+
+  // Don't write over a file that isn't a journal
+  if (memcmp(header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 ||
+      header->version != JOURNAL_VERSION) {
+    return ERROR_BAD_FORMAT;
+  }
+
+  // Read records up to the first one that's empty or torn. Anything after
+  // that is lost, which only means that work gets done again.
+  used = sizeof(JournalHeader);
+  while (used + sizeof(RecordHeader) <= capacity) {
+    const RecordHeader *record = (const RecordHeader *)(view + used);
+
+    if (record->type == 0 || record->length < sizeof(RecordHeader) ||
+        used + record->length > capacity || record->check != checkOf(*record)) {
+      break;
+    }
+
+    latest[record->pathHash] = used;
+    used += record->length;
+  }
+
+  return 0;
+}
+
+DWORD Journal::append(const BYTE *data, ULONGLONG length, ULONGLONG &offset) {
+  if (used + length > capacity) {
+    ULONGLONG newCapacity = capacity * 2;
+    while (used + length > newCapacity) {
+      newCapacity *= 2;
+    }
+
+    unmap();
+    DWORD error = map(newCapacity);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  offset = used;
+  memcpy(view + offset, data, (size_t)length);
+  used += length;
+
+  latest[((const RecordHeader *)data)->pathHash] = offset;
+
+  return 0;
+}
+
+bool Journal::isFileDone(const FileCopy &file) const {
+  auto found = latest.find(hashPath(file.dest));
+  if (found == latest.end()) {
+    return false;
+  }
+
+  const RecordHeader *record = (const RecordHeader *)(view + found->second);
+  return record->type == RECORD_FILE_DONE && record->size == file.size &&
+         record->lastWriteTime == file.lastWriteTime;
+}
+
+DWORD Journal::markFileDone(const FileCopy &file) {
+  RecordHeader record =
+      recordFor(file, RECORD_FILE_DONE, sizeof(RecordHeader));
+
+  ULONGLONG offset;
+  return append((const BYTE *)&record, sizeof(record), offset);
+}
+
+DWORD Journal::chunksFor(const FileCopy &file, DWORD chunkSize, bool resume,
+                         ULONGLONG &record) {
+  ULONGLONG chunkCount = (file.size + chunkSize - 1) / chunkSize;
+
+  if (resume) {
+    auto found = latest.find(hashPath(file.dest));
+    if (found != latest.end()) {
+      const RecordHeader *existing =
+          (const RecordHeader *)(view + found->second);
+      const ChunkHeader *chunks = (const ChunkHeader *)(existing + 1);
+
+      if (existing->type == RECORD_CHUNKS && existing->size == file.size &&
+          existing->lastWriteTime == file.lastWriteTime &&
+          chunks->chunkSize == chunkSize && chunks->chunkCount == chunkCount) {
+        record = found->second;
+        return 0;
+      }
+    }
+  }
+
+  // Bitmaps are padded so the next record stays 8-byte aligned
+  ULONGLONG bitmapBytes = ((chunkCount + 63) / 64) * 8;
+  ULONGLONG length = sizeof(RecordHeader) + sizeof(ChunkHeader) + bitmapBytes;
+
+  std::string data((size_t)length, '\0');
+  RecordHeader header = recordFor(file, RECORD_CHUNKS, (DWORD)length);
+  ChunkHeader chunks = {chunkSize, 0, chunkCount};
+  memcpy(&data[0], &header, sizeof(header));
+  memcpy(&data[sizeof(header)], &chunks, sizeof(chunks));
+
+  DWORD error = append((const BYTE *)data.data(), length, record);
+  if (error != 0) {
+    return error;
+  }
+
+  return flush();
+}
+
+bool Journal::isChunkDone(ULONGLONG record, ULONGLONG index) const {
+  const BYTE *bitmap =
+      view + record + sizeof(RecordHeader) + sizeof(ChunkHeader);
+  return (bitmap[index / 8] & (1 << (index % 8))) != 0;
+}
+
+DWORD Journal::markChunkDone(ULONGLONG record, ULONGLONG index) {
+  BYTE *bit = view + record + sizeof(RecordHeader) + sizeof(ChunkHeader) +
+              index / 8;
+  *bit |= (BYTE)(1 << (index % 8));
+
+  if (!FlushViewOfFile(bit, 1) || !FlushFileBuffers(file)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+DWORD Journal::flush() {
+  if (!FlushViewOfFile(view, (SIZE_T)used) || !FlushFileBuffers(file)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
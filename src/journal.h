@@ -0,0 +1,74 @@
+#pragma once
+
+#include "paths.h"
+
+#include <string>
+#include <unordered_map>
+
+/**
+ * An append-only record of the work a copy has finished, so a copy that's run
+ * again can skip what's already done. Finished files get a small record, and
+ * large files get a bitmap of finished chunks, whose bits are only ever set.
+ * The journal is memory-mapped and records are looked up by a hash of their
+ * destination path, along with the source size and modification time so
+ * changed sources are copied again.
+ */
+class Journal {
+public:
+  Journal();
+  ~Journal();
+
+  /**
+   * Open the journal at the given path, creating it if it doesn't exist.
+   * Returns 0 or a Windows error code.
+   */
+  DWORD open(const std::wstring &path);
+
+  /**
+   * Check if the given file was recorded as finished
+   */
+  bool isFileDone(const FileCopy &file) const;
+
+  /**
+   * Record the given file as finished. The record is only durable after the
+   * next flush.
+   */
+  DWORD markFileDone(const FileCopy &file);
+
+  /**
+   * Get the chunk bitmap of the given file, adding an empty one if there's no
+   * bitmap for it yet or `resume` is false. `record` is set to an offset to
+   * use with the other chunk functions. Returns 0 or a Windows error code.
+   */
+  DWORD chunksFor(const FileCopy &file, DWORD chunkSize, bool resume,
+                  ULONGLONG &record);
+
+  /**
+   * Check if the given chunk was recorded as finished
+   */
+  bool isChunkDone(ULONGLONG record, ULONGLONG index) const;
+
+  /**
+   * Record the given chunk as finished, and flush the journal
+   */
+  DWORD markChunkDone(ULONGLONG record, ULONGLONG index);
+
+  /**
+   * Write all records to disk. Returns 0 or a Windows error code.
+   */
+  DWORD flush();
+
+private:
+  DWORD append(const BYTE *data, ULONGLONG length, ULONGLONG &offset);
+  DWORD map(ULONGLONG capacity);
+  void unmap();
+
+  HANDLE file;
+  HANDLE mapping;
+  BYTE *view;
+  ULONGLONG capacity;
+  ULONGLONG used;
+
+  // The offset of the latest record for each destination path hash
+  std::unordered_map<ULONGLONG, ULONGLONG> latest;
+};
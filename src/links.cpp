@@ -0,0 +1,198 @@
+#include "links.h"
+
+// clang-format off
+#include <winioctl.h>
+// clang-format on
+
+#include <vector>
+
+// Tags for WSL's special files and Windows' own sockets, which are newer
+// than the SDK version this targets
+#ifndef IO_REPARSE_TAG_AF_UNIX
+#define IO_REPARSE_TAG_AF_UNIX (0x80000023L)
+#endif
+#ifndef IO_REPARSE_TAG_LX_SYMLINK
+#define IO_REPARSE_TAG_LX_SYMLINK (0xA000001DL)
+#endif
+#ifndef IO_REPARSE_TAG_LX_FIFO
+#define IO_REPARSE_TAG_LX_FIFO (0x80000024L)
+#endif
+#ifndef IO_REPARSE_TAG_LX_CHR
+#define IO_REPARSE_TAG_LX_CHR (0x80000025L)
+#endif
+#ifndef IO_REPARSE_TAG_LX_BLK
+#define IO_REPARSE_TAG_LX_BLK (0x80000026L)
+#endif
+
+bool parseSymlinkPolicy(const std::string &value, SymlinkPolicy &policy) {
+  if (value == "copy-link") {
+    policy = SymlinkPolicy::CopyLink;
+  } else if (value == "follow") {
+    policy = SymlinkPolicy::Follow;
+  } else if (value == "skip") {
+    policy = SymlinkPolicy::Skip;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+EntryKind entryKindOf(const WIN32_FIND_DATAW &data) {
+  if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+    return EntryKind::Regular;
+  }
+
+  // Listings give the reparse tag in place of the first reserved field
+  switch (data.dwReserved0) {
+  case IO_REPARSE_TAG_SYMLINK:
+  case IO_REPARSE_TAG_MOUNT_POINT:
+  case IO_REPARSE_TAG_LX_SYMLINK:
+    return EntryKind::Link;
+  case IO_REPARSE_TAG_AF_UNIX:
+  case IO_REPARSE_TAG_LX_FIFO:
+  case IO_REPARSE_TAG_LX_CHR:
+  case IO_REPARSE_TAG_LX_BLK:
+    return EntryKind::Special;
+  default:
+    return EntryKind::Regular;
+  }
+}
+
+bool canFollowLink(const WIN32_FIND_DATAW &data) {
+  return data.dwReserved0 != IO_REPARSE_TAG_LX_SYMLINK;
+}
+
+/**
+ * Open the given path, following links, and read its metadata
+ */
+static DWORD readFollowed(const std::wstring &path,
+                          BY_HANDLE_FILE_INFORMATION &info) {
+  HANDLE handle = CreateFileW(
+      path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  DWORD error = GetFileInformationByHandle(handle, &info) ? 0 : GetLastError();
+  CloseHandle(handle);
+
+  return error;
+}
+
+DWORD followLink(const std::wstring &path, WIN32_FIND_DATAW &data,
+                 ULONGLONG &volume, ULONGLONG &fileId) {
+  BY_HANDLE_FILE_INFORMATION info;
+  DWORD error = readFollowed(path, info);
+  if (error != 0) {
+    return error;
+  }
+
+  data.dwFileAttributes = info.dwFileAttributes;
+  data.ftCreationTime = info.ftCreationTime;
+  data.ftLastAccessTime = info.ftLastAccessTime;
+  data.ftLastWriteTime = info.ftLastWriteTime;
+  data.nFileSizeHigh = info.nFileSizeHigh;
+  data.nFileSizeLow = info.nFileSizeLow;
+  data.dwReserved0 = 0;
+
+  volume = info.dwVolumeSerialNumber;
+  fileId = ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+
+  return 0;
+}
+
+DWORD directoryIdentity(const std::wstring &path, ULONGLONG &volume,
+                        ULONGLONG &fileId) {
+  BY_HANDLE_FILE_INFORMATION info;
+  DWORD error = readFollowed(path, info);
+  if (error != 0) {
+    return error;
+  }
+
+  volume = info.dwVolumeSerialNumber;
+  fileId = ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+
+  return 0;
+}
+
+DWORD copyLink(const std::wstring &src, const std::wstring &dest,
+               bool isDirectory) {
+  HANDLE srcHandle = CreateFileW(
+      src.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_EXISTING,
+      FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (srcHandle == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  // The link's reparse data is copied as it is, so relative links stay
+  // relative and junctions stay junctions
+  std::vector<BYTE> reparseData(MAXIMUM_REPARSE_DATA_BUFFER_SIZE);
+  DWORD length = 0;
+  DWORD error = 0;
+
+  if (!DeviceIoControl(srcHandle, FSCTL_GET_REPARSE_POINT, NULL, 0,
+                       reparseData.data(), (DWORD)reparseData.size(), &length,
+                       NULL)) {
+    error = GetLastError();
+  }
+
+  CloseHandle(srcHandle);
+
+  if (error != 0) {
+    return error;
+  }
+
+  // Replace an earlier link or file. A directory that isn't empty fails to
+  // be removed, so nothing real is lost.
+  DWORD attributes = GetFileAttributesW(dest.c_str());
+  if (attributes != INVALID_FILE_ATTRIBUTES) {
+    BOOL removed = (attributes & FILE_ATTRIBUTE_DIRECTORY)
+                       ? RemoveDirectoryW(dest.c_str())
+                       : DeleteFileW(dest.c_str());
+    if (!removed) {
+      return GetLastError();
+    }
+  }
+
+  if (isDirectory) {
+    if (!CreateDirectoryW(dest.c_str(), NULL)) {
+      return GetLastError();
+    }
+  } else {
+    HANDLE created = CreateFileW(dest.c_str(), GENERIC_WRITE, 0, NULL,
+                                 CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (created == INVALID_HANDLE_VALUE) {
+      return GetLastError();
+    }
+    CloseHandle(created);
+  }
+
+  HANDLE destHandle = CreateFileW(
+      dest.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+      FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (destHandle == INVALID_HANDLE_VALUE) {
+    error = GetLastError();
+  } else {
+    DWORD returned = 0;
+    if (!DeviceIoControl(destHandle, FSCTL_SET_REPARSE_POINT,
+                         reparseData.data(), length, NULL, 0, &returned,
+                         NULL)) {
+      error = GetLastError();
+    }
+    CloseHandle(destHandle);
+  }
+
+  // Don't leave an empty file or directory where the link should be
+  if (error != 0) {
+    if (isDirectory) {
+      RemoveDirectoryW(dest.c_str());
+    } else {
+      DeleteFileW(dest.c_str());
+    }
+  }
+
+  return error;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+
+/**
+ * What the built-in copier does with symbolic links and junctions
+ */
+enum class SymlinkPolicy {
+  // Not set, which copies them as links
+  Default,
+  // Recreate the link itself at the destination
+  CopyLink,
+  // Copy whatever the link points to. A directory reached a second time is
+  // skipped, so links that loop back can't make the copy go on forever.
+  Follow,
+  // Leave links out of the copy
+  Skip,
+};
+
+/**
+ * Parse the value of the --symlinks option
+ */
+bool parseSymlinkPolicy(const std::string &value, SymlinkPolicy &policy);
+
+/**
+ * The kinds of entry the copier treats differently
+ */
+enum class EntryKind {
+  // A file or directory, including ones whose data is stored through a
+  // reparse point, such as deduplicated or cloud files
+  Regular,
+  // A symbolic link or junction
+  Link,
+  // A socket, FIFO, or device node (as created by WSL), which can't be
+  // copied and may block if read
+  Special,
+};
+
+/**
+ * Work out the kind of a listing entry from its reparse tag
+ */
+EntryKind entryKindOf(const WIN32_FIND_DATAW &data);
+
+/**
+ * Check if the given link can be followed by Windows. WSL's own symbolic
+ * links can only be copied as links.
+ */
+bool canFollowLink(const WIN32_FIND_DATAW &data);
+
+/**
+ * Read the metadata of what the link at `path` points to, keeping the link's
+ * name, along with the identity of the target on its volume. Returns 0 or a
+ * Windows error code.
+ */
+DWORD followLink(const std::wstring &path, WIN32_FIND_DATAW &data,
+                 ULONGLONG &volume, ULONGLONG &fileId);
+
+/**
+ * Get the identity of a directory on its volume, following links.
+ * Returns 0 or a Windows error code.
+ */
+DWORD directoryIdentity(const std::wstring &path, ULONGLONG &volume,
+                        ULONGLONG &fileId);
+
+/**
+ * Recreate the link at `src` at `dest`, pointing to the same place, and
+ * replace whatever link or file was at `dest`. Returns 0 or a Windows error
+ * code.
+ */
+DWORD copyLink(const std::wstring &src, const std::wstring &dest,
+               bool isDirectory);
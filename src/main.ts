@@ -1,3 +1,6 @@
+import { promises as fs } from 'fs';
+import net from 'net';
+import os from 'os';
 import path from 'path';
 import { commandsAsScript } from '@josephuspaye/powershell';
 
@@ -7,10 +10,541 @@ export interface FileOpOptions {
    * @default true
    */
   showDialogOnError?: boolean;
+
+  /**
+   * How hard to try to get the results onto disk before reporting success.
+   * `none` leaves it to the OS, `file` flushes each file and its folder,
+   * `batch` flushes files in parallel groups and each folder once, and `end`
+   * flushes each destination drive once (this needs admin rights, and falls
+   * back to `batch` without them)
+   * @default 'none'
+   */
+  durability?: 'none' | 'file' | 'batch' | 'end';
+
+  /**
+   * Write into a hidden folder at the destination first, and only move each
+   * item into place once it's complete, so anything watching the destination
+   * never sees a partially written file. Existing files are replaced.
+   * @default false
+   */
+  atomic?: boolean;
+
+  /**
+   * Path of a journal file to record progress in. If a copy with the same
+   * journal is interrupted, running it again skips the files that were
+   * finished and resumes large files from the last finished chunk. Only used
+   * when copying, and files are copied without the Explorer progress dialog.
+   */
+  journal?: string;
+
+  /**
+   * Path of a write-ahead log for moves. Each move is recorded before it
+   * starts, so if it's interrupted, the next move with the same log first
+   * finishes or undoes it (see `walRecovery`). Only used when moving, and
+   * not with `atomic`.
+   */
+  wal?: string;
+
+  /**
+   * What to do with an interrupted move found in the write-ahead log: `replay`
+   * finishes moving whatever is still at the source, and `rollback` moves
+   * whatever reached the destination back. Items moved into a folder that
+   * already existed are always finished, since they can't be told apart from
+   * what was there before.
+   * @default 'replay'
+   */
+  walRecovery?: 'replay' | 'rollback';
+
+  /**
+   * The id to save the job's undo log under, to reverse it later with
+   * `undo()`, made of letters, digits, `-`, and `_`. A new id is generated
+   * when this isn't set.
+   */
+  jobId?: string;
+
+  /**
+   * Only copy items that are missing at the destination, or whose size or
+   * modification time differs from the source. Changed files are replaced
+   * without asking. Only used when copying.
+   * @default false
+   */
+  sync?: boolean;
+
+  /**
+   * Sync (see `sync`), and also remove items at the destination that aren't
+   * in the source, once everything else has been copied. Removed items go to
+   * the Recycle Bin where the destination has one, and are put back by
+   * `undo()`. Only used when copying.
+   * @default false
+   */
+  mirror?: boolean;
+
+  /**
+   * How far apart, in milliseconds, modification times can be and still count
+   * as the same when syncing. Use 2000 for FAT drives, which store times to
+   * the nearest 2 seconds.
+   * @default 0
+   */
+  mtimeTolerance?: number;
+
+  /**
+   * Path of an index file that records what's at the destination. Syncs that
+   * use the same index compare the source against it instead of listing the
+   * destination, which helps when the destination is slow to list, such as a
+   * network share. The index assumes the destination is only changed by
+   * these syncs. Only used with `sync`; `mirror` still lists the destination
+   * to find what to remove, and keeps the index up to date.
+   */
+  index?: string;
+
+  /**
+   * When a large file already exists at the destination, only write the parts
+   * of it that changed, by finding the blocks of the old file in the new one.
+   * This still reads both files, but can save most of the writing when a
+   * large file changes a little. Only used when copying, and files are copied
+   * without the Explorer progress dialog.
+   * @default false
+   */
+  delta?: boolean;
+
+  /**
+   * Hash each file as it's copied, then read the copy back from disk and
+   * check it matches. A mismatch fails the copy. `xxh3` is the fastest,
+   * `crc32c` uses the CPU's CRC instructions where available, and `blake3`
+   * is a cryptographic hash. Only used when copying, and files are copied
+   * without the Explorer progress dialog.
+   */
+  verify?: 'xxh3' | 'crc32c' | 'blake3';
+
+  /**
+   * Path of a manifest to write, listing the path, size, modification time,
+   * and hash of each copied file. Files are hashed as they're copied, with
+   * the `verify` hash if set, otherwise `xxh3`. Paths are relative to the
+   * folder each source was copied into. Only used when copying, and files
+   * are copied without the Explorer progress dialog.
+   */
+  manifest?: string;
+
+  /**
+   * Copy files that are the same as one copied earlier in the same operation
+   * by cloning or linking that copy instead of writing them again. Files are
+   * matched by size, then hash, then their bytes. `reflink` clones the data,
+   * so the files share storage until one changes (this needs a ReFS
+   * destination). `hardlink` makes them the same file, so changing one
+   * changes all of them. Files are copied normally when the destination
+   * doesn't support either. Only used when copying, and files are copied
+   * without the Explorer progress dialog.
+   */
+  dedupe?: 'reflink' | 'hardlink';
+
+  /**
+   * Copy files that are hard links to each other as hard links at the
+   * destination too, instead of as separate files. Each linked file is only
+   * written once. Links are copied as separate files when they can't be
+   * made, such as across drives. Only used when copying, and files are
+   * copied without the Explorer progress dialog.
+   * @default false
+   */
+  hardlinks?: boolean;
+
+  /**
+   * How to copy symbolic links and junctions: `copy-link` recreates the link
+   * itself, `follow` copies what it points to, and `skip` leaves it out. When
+   * following, a folder reached a second time is skipped, so links that loop
+   * back can't make the copy go on forever, and links that point nowhere are
+   * skipped. Sockets and WSL's FIFOs and device files are always skipped. Only
+   * used when copying, and files are copied without the Explorer progress
+   * dialog.
+   */
+  symlinks?: 'copy-link' | 'follow' | 'skip';
+
+  /**
+   * What to do with a file whose destination already exists, without asking:
+   * `overwrite` replaces it, `skip` leaves it, `rename` copies to the first
+   * free name like `name (2).ext`, `newer` replaces it if the source was
+   * modified more recently, `larger` replaces it if the source is bigger, and
+   * `fail` stops the operation. Each destination folder is listed once to
+   * find what exists. How many files were overwritten, skipped, and renamed
+   * is printed in the output. Only used when copying, and files are copied
+   * without the Explorer progress dialog.
+   */
+  onConflict?: 'overwrite' | 'skip' | 'rename' | 'newer' | 'larger' | 'fail';
+
+  /**
+   * Metadata to copy along with the contents: `mode` for the read-only,
+   * hidden, system, and archive attributes, `owner` for the owner and group,
+   * `times` for the creation, access, and modification times, `xattr` for
+   * alternate data streams, and `acl` for the access control list. Folders get
+   * theirs once everything in them is copied. Copying the owner of another
+   * user needs admin rights. Only used when copying, and files are copied
+   * without the Explorer progress dialog.
+   */
+  preserve?: ('mode' | 'owner' | 'times' | 'xattr' | 'acl')[];
+
+  /**
+   * Only copy what matches one of these patterns. Globs without a slash match
+   * names at any depth, like `*.ts`, while globs with one match from each
+   * source down, like `src/**`. Patterns that start with `re:` are regular
+   * expressions matched against the whole path below the source, with `/`
+   * between names. Matching ignores case. Folders that nothing beneath could
+   * match are skipped without being read. Used when copying or deleting,
+   * but not with `sync` or `mirror`. Files are copied without the Explorer
+   * progress dialog, and deleting deletes the matching files one by one,
+   * leaving their folders.
+   */
+  include?: string[];
+
+  /**
+   * Leave out what matches any of these patterns, which are written the same
+   * way as `include`. A glob that ends in a slash, like `build/`, only matches
+   * folders. Excluded folders are skipped without being read, and exclusions
+   * win over inclusions. Used when copying or deleting, like `include`.
+   */
+  exclude?: string[];
+
+  /**
+   * The name of ignore files to look for, like `.gitignore`. Each one is
+   * written like a .gitignore and applies to the folder it's in and
+   * everything beneath, with nearer files taking precedence. Ignored folders
+   * are skipped without being read. Used when copying or deleting, like
+   * `include`.
+   */
+  ignoreFile?: string;
+
+  /**
+   * Only act on files of at least this size, in bytes or with a `K`, `M`,
+   * `G`, or `T` suffix, like `'10M'`. Sizes, ages, and types are checked
+   * against what each folder listing already says about its files, so they
+   * cost no extra disk access. Used when copying or deleting, like `include`.
+   */
+  minSize?: number | string;
+
+  /**
+   * Only act on files of at most this size, written like `minSize`
+   */
+  maxSize?: number | string;
+
+  /**
+   * Only act on files last changed within this age, like `'12h'` or `'30d'`,
+   * with a suffix of `s`, `m`, `h`, `d`, or `w`. A number on its own is in
+   * days. Used when copying or deleting, like `include`.
+   */
+  newerThan?: number | string;
+
+  /**
+   * Only act on files last changed longer ago than this age, written like
+   * `newerThan`. For example, deleting with `olderThan: '30d'` deletes files
+   * that haven't changed in 30 days.
+   */
+  olderThan?: number | string;
+
+  /**
+   * Only act on files (`f`) or symbolic links and junctions (`l`). Folders are
+   * always looked through. Used when copying or deleting, like `include`.
+   */
+  type?: ('f' | 'l')[];
+
+  /**
+   * Don't change anything, and list in the output what would be done instead:
+   * one line per item with how it would be carried out (`rename`, `hardlink`,
+   * `clone`, `link`, `delta`, `chunked`, `copyfile`, `explorer`, or `delete`),
+   * its paths, and its size, then how many existing files would be overwritten,
+   * the totals, and an estimate of how long it would take. The estimate comes
+   * from timing reads of the largest sources and opens of a sample of them.
+   * Items are found the same way a real run finds them, with the same filters,
+   * and with `mirror`, each destination item that would be removed is listed as
+   * `remove`. The space each destination drive would need is listed too, as
+   * with `preflight`.
+   * @default false
+   */
+  dryRun?: boolean;
+
+  /**
+   * Before starting, work out how much space the results need on each
+   * destination drive, rounded up to whole clusters and counting the file
+   * system's record for each file and folder, and compare it with the free
+   * space available to the user. Moves within a drive and hard links need no
+   * space, and files deduplicated by cloning on ReFS only need a record. If
+   * anything won't fit, nothing is changed, the shortfall for each drive is
+   * listed in the output, and the operation fails. Only used when copying or
+   * moving.
+   * @default false
+   */
+  preflight?: boolean;
+
+  /**
+   * When a destination drive, or the user's quota on it, fills up, pause
+   * instead of failing, and carry on once enough space is free. The drive's
+   * free space is checked after 1 second, then twice as long after each
+   * check, up to a minute apart. `paused <bytes needed> <drive>` and
+   * `resumed <seconds> <drive>` lines are printed in the output. Large files
+   * carry on from the first byte that wasn't written, while smaller ones are
+   * copied again. Only used when copying.
+   * @default false
+   */
+  waitForSpace?: boolean;
+
+  /**
+   * The most bytes per second to read and write, in bytes or with a `K`, `M`,
+   * `G`, or `T` suffix, like `'50M'`. The limit is shared by every thread of
+   * the operation, including the ones hashing and comparing files, so other
+   * programs using the same drives aren't starved. Only used when copying,
+   * and files are copied without the Explorer progress dialog.
+   */
+  bwlimit?: number | string;
+
+  /**
+   * The most reads and writes per second, shared like `bwlimit`
+   */
+  iopsLimit?: number;
+
+  /**
+   * A name to change `bwlimit` and `iopsLimit` through while the operation
+   * runs, with `setLimits()`. Must not be in use by another operation. Only
+   * used when copying.
+   */
+  control?: string;
+
+  /**
+   * How the operation's disk access is scheduled: `idle` runs its threads in
+   * background mode, so they only get the disk when other programs don't
+   * want it, while `best-effort:N` and `realtime:N` set their thread
+   * priority from a level N between 0 (highest) and 7 (lowest). The files
+   * they read and write get very low I/O priority with `idle`, and low I/O
+   * priority with `best-effort` levels 5 to 7. Applied to every thread that
+   * copies, hashes, or compares files.
+   */
+  ioPriority?: string;
+
+  /**
+   * The priority of the operation's process, from -20 (highest) to 19
+   * (lowest), mapped to the nearest Windows priority class
+   * @default 0
+   */
+  nice?: number;
+
+  /**
+   * The processors the operation's worker threads may run on, as a list of
+   * processor numbers and ranges like `'0-3,6'`, or a hex mask like `'0x4f'`
+   */
+  affinity?: string;
+}
+
+/**
+ * What a copy, move, or delete did, from `copy()`, `move()`, or `del()`
+ */
+export interface OperationResult {
+  exitCode: number | null;
+  // The id the job's undo log was saved under, to reverse it with `undo()`
+  jobId?: string;
+  // What would be done, when the `dryRun` option is set
+  plan?: DryRunPlan;
+}
+
+/**
+ * A step a dry run would take, from `DryRunPlan`. `method` is how it would be
+ * done: `rename`, `hardlink`, `clone`, `link`, `delta`, `chunked`,
+ * `copyfile`, `explorer`, or `delete`.
+ */
+export interface PlanStep {
+  method: string;
+  src: string;
+  dest?: string;
+  size: number;
+}
+
+/**
+ * What a destination drive would need and has, from `DryRunPlan`
+ */
+export interface PlanVolume {
+  volume: string;
+  required: number;
+  available: number;
+}
+
+/**
+ * What a copy, move, or delete would do with the `dryRun` option, from
+ * `copy()`, `move()`, or `del()`
+ */
+export interface DryRunPlan {
+  steps: PlanStep[];
+  // The destination items `mirror` would remove
+  removals: string[];
+  files: number;
+  directories: number;
+  bytes: number;
+  bytesToWrite: number;
+  // Files whose destinations already exist and would be replaced
+  overwrites: number;
+  // The estimated duration
+  seconds: number;
+  volumes: PlanVolume[];
+}
+
+/**
+ * The files that didn't match a manifest, from `verifyManifest()`
+ */
+export interface ManifestResult {
+  exitCode: number | null;
+  missing: string[];
+  changed: string[];
+}
+
+/**
+ * An entry that differs between two folders, from `diff()`
+ */
+export interface DiffEntry {
+  change: 'added' | 'removed' | 'modified';
+  path: string;
+}
+
+/**
+ * How two folders differ, from `diff()`
+ */
+export interface DiffResult {
+  exitCode: number | null;
+  changes: DiffEntry[];
 }
 
 const exe = path.join(__dirname, '..', 'bin', 'FileOps.exe');
 
+/**
+ * Run the executable with the given arguments and wait for it to finish.
+ * Resolves with its exit code and the lines it printed.
+ */
+async function runForOutput(args: string) {
+  const outputPath = path.join(
+    os.tmpdir(),
+    `fileops-${process.pid}-${Date.now()}.txt`
+  );
+
+  const output = await commandsAsScript(
+    `$process = Start-Process -WindowStyle Hidden -Wait -PassThru -FilePath "${exe}" -ArgumentList "${args}" -RedirectStandardOutput "${outputPath}"; exit $process.ExitCode`
+  );
+
+  let lines: string[] = [];
+  try {
+    const text = await fs.readFile(outputPath, 'utf8');
+    lines = text.split(/\r?\n/).filter((line) => line.length > 0);
+    await fs.unlink(outputPath);
+  } catch (err) {
+    // Nothing was printed if the executable couldn't be started
+  }
+
+  return { exitCode: output.exitCode, lines };
+}
+
+/**
+ * Get the plan a dry run printed
+ */
+function dryRunPlanOf(lines: string[]) {
+  const plan: DryRunPlan = {
+    steps: [],
+    removals: [],
+    files: 0,
+    directories: 0,
+    bytes: 0,
+    bytesToWrite: 0,
+    overwrites: 0,
+    seconds: 0,
+    volumes: [],
+  };
+  const methods = [
+    'rename',
+    'hardlink',
+    'clone',
+    'link',
+    'delta',
+    'chunked',
+    'copyfile',
+    'explorer',
+    'delete',
+  ];
+
+  for (const line of lines) {
+    const space = line.indexOf(' ');
+    const word = line.slice(0, space);
+    let match: RegExpExecArray | null;
+
+    if (word === 'remove') {
+      plan.removals.push(line.slice(space + 1));
+    } else if (methods.includes(word)) {
+      // The size comes last, and a destination follows an arrow
+      const sizeStart = line.lastIndexOf(' ');
+      const paths = line.slice(space + 1, sizeStart);
+      const arrow = paths.indexOf(' -> ');
+      const step: PlanStep = {
+        method: word,
+        src: arrow < 0 ? paths : paths.slice(0, arrow),
+        size: Number(line.slice(sizeStart + 1)),
+      };
+      if (arrow >= 0) {
+        step.dest = paths.slice(arrow + 4);
+      }
+      plan.steps.push(step);
+    } else if (
+      (match = /^(\d+) files, (\d+) directories, (\d+) bytes, (\d+) to write$/.exec(
+        line
+      ))
+    ) {
+      plan.files = Number(match[1]);
+      plan.directories = Number(match[2]);
+      plan.bytes = Number(match[3]);
+      plan.bytesToWrite = Number(match[4]);
+    } else if ((match = /^overwrites (\d+) existing files$/.exec(line))) {
+      plan.overwrites = Number(match[1]);
+    } else if ((match = /^estimated (\d+) s /.exec(line))) {
+      plan.seconds = Number(match[1]);
+    } else if (
+      (match = /^volume (.*) \(.*\) needs (\d+) bytes .* and has (\d+)/.exec(
+        line
+      ))
+    ) {
+      plan.volumes.push({
+        volume: match[1],
+        required: Number(match[2]),
+        available: Number(match[3]),
+      });
+    }
+  }
+
+  return plan;
+}
+
+/**
+ * Get the result of a copy, move, or delete from its exit code and output
+ */
+function operationResultOf(
+  exitCode: number | null,
+  lines: string[],
+  options: FileOpOptions
+) {
+  const result: OperationResult = { exitCode };
+
+  if (options.dryRun) {
+    result.plan = dryRunPlanOf(lines);
+    return result;
+  }
+
+  for (const line of lines) {
+    if (line.startsWith('job ')) {
+      result.jobId = line.slice(4);
+    }
+  }
+
+  return result;
+}
+
+/**
+ * Throw an error if the given job id could name a file outside the undo
+ * directory
+ */
+function validateJobId(jobId: string | undefined) {
+  if (jobId !== undefined && !/^[A-Za-z0-9_-]+$/.test(jobId)) {
+    throw new Error('a job id can only contain letters, digits, - and _');
+  }
+}
+
 /**
  * Check the given inputs and throw an error if they're not valid
  */
@@ -62,83 +596,245 @@ function validateInput(
   return { srcPaths, destPaths };
 }
 
+/**
+ * Convert the given options to arguments for the executable
+ */
+function optionsToArgs(options: FileOpOptions) {
+  const { showDialogOnError } = Object.assign(
+    { showDialogOnError: true },
+    options
+  );
+
+  const args: string[] = [];
+
+  if (showDialogOnError) {
+    args.push('--show-errors');
+  }
+
+  if (options.durability && options.durability !== 'none') {
+    args.push(`--durability=${options.durability}`);
+  }
+
+  if (options.atomic) {
+    args.push('--atomic');
+  }
+
+  if (options.journal) {
+    args.push('--journal `"' + options.journal + '`"');
+  }
+
+  if (options.wal) {
+    args.push('--wal `"' + options.wal + '`"');
+  }
+
+  if (options.walRecovery) {
+    args.push(`--wal-recover=${options.walRecovery}`);
+  }
+
+  if (options.sync) {
+    args.push('--sync');
+  }
+
+  if (options.mirror) {
+    args.push('--mirror');
+  }
+
+  if (options.index) {
+    args.push('--index `"' + options.index + '`"');
+  }
+
+  if (options.mtimeTolerance) {
+    args.push(`--mtime-tolerance=${Math.round(options.mtimeTolerance)}`);
+  }
+
+  if (options.delta) {
+    args.push('--delta');
+  }
+
+  if (options.verify) {
+    args.push(`--verify=${options.verify}`);
+  }
+
+  if (options.manifest) {
+    args.push('--manifest `"' + options.manifest + '`"');
+  }
+
+  if (options.dedupe) {
+    args.push(`--dedupe=${options.dedupe}`);
+  }
+
+  if (options.hardlinks) {
+    args.push('--hardlinks');
+  }
+
+  if (options.symlinks) {
+    args.push(`--symlinks=${options.symlinks}`);
+  }
+
+  if (options.onConflict) {
+    args.push(`--on-conflict=${options.onConflict}`);
+  }
+
+  if (options.preserve && options.preserve.length > 0) {
+    args.push(`--preserve=${options.preserve.join(',')}`);
+  }
+
+  for (const pattern of options.include || []) {
+    args.push('--include `"' + pattern + '`"');
+  }
+
+  for (const pattern of options.exclude || []) {
+    args.push('--exclude `"' + pattern + '`"');
+  }
+
+  if (options.ignoreFile) {
+    args.push('--ignore-file `"' + options.ignoreFile + '`"');
+  }
+
+  if (options.minSize !== undefined) {
+    args.push(`--min-size=${options.minSize}`);
+  }
+
+  if (options.maxSize !== undefined) {
+    args.push(`--max-size=${options.maxSize}`);
+  }
+
+  if (options.newerThan !== undefined) {
+    args.push(`--newer-than=${options.newerThan}`);
+  }
+
+  if (options.olderThan !== undefined) {
+    args.push(`--older-than=${options.olderThan}`);
+  }
+
+  if (options.type && options.type.length > 0) {
+    args.push(`--type=${options.type.join(',')}`);
+  }
+
+  if (options.dryRun) {
+    args.push('--dry-run');
+  }
+
+  if (options.preflight) {
+    args.push('--preflight');
+  }
+
+  if (options.waitForSpace) {
+    args.push('--wait-for-space');
+  }
+
+  if (options.bwlimit !== undefined) {
+    args.push(`--bwlimit=${options.bwlimit}`);
+  }
+
+  if (options.iopsLimit !== undefined) {
+    args.push(`--iops-limit=${options.iopsLimit}`);
+  }
+
+  if (options.control) {
+    args.push('--control `"' + options.control + '`"');
+  }
+
+  if (options.ioPriority) {
+    args.push(`--io-priority=${options.ioPriority}`);
+  }
+
+  if (options.nice !== undefined) {
+    args.push(`--nice=${options.nice}`);
+  }
+
+  if (options.affinity) {
+    args.push(`--affinity=${options.affinity}`);
+  }
+
+  if (options.jobId) {
+    args.push('--job-id `"' + options.jobId + '`"');
+  }
+
+  return args.join(' ');
+}
+
 /**
  * Copy the given source path(s) to the given destination path(s). All paths should be absolute.
- * Returns the exit code of the launcher process (not the launched explorer process).
+ * Resolves once the copy finishes, with its exit code and the id of its undo log.
+ * With the `dryRun` option, resolves with the plan instead.
  * @throws Throws on invalid input
  */
 export async function copy(
   src: string | string[],
   dest: string | string[],
   options: FileOpOptions = {}
-) {
+): Promise<OperationResult> {
   const { srcPaths, destPaths } = validateInput('copy', src, dest);
-  const { showDialogOnError } = Object.assign(
-    { showDialogOnError: true },
-    options
-  );
+  validateJobId(options.jobId);
 
   const from = srcPaths.map((p) => '`"' + p + '`"').join(' ');
   const to = destPaths.map((p) => '`"' + p + '`"').join(' ');
 
-  const args = `copy ${
-    showDialogOnError ? '--show-errors' : ''
-  } --from ${from} --to ${to}`;
+  const args = `copy ${optionsToArgs(options)} --from ${from} --to ${to}`;
 
-  const output = await commandsAsScript(
-    `Start-Process -WindowStyle Hidden -FilePath "${exe}" -ArgumentList "${args}"`
-  );
+  const { exitCode, lines } = await runForOutput(args);
 
-  return output.exitCode;
+  return operationResultOf(exitCode, lines, options);
 }
 
 /**
  * Move the given source path(s) to the given destination path(s). All paths should be absolute.
- * Returns the exit code of the launcher process (not the launched explorer process).
+ * Resolves once the move finishes, with its exit code and the id of its undo log.
+ * With the `dryRun` option, resolves with the plan instead.
  * @throws Throws on invalid input
  */
 export async function move(
   src: string | string[],
   dest: string | string[],
   options: FileOpOptions = {}
-) {
+): Promise<OperationResult> {
   const { srcPaths, destPaths } = validateInput('move', src, dest);
-  const { showDialogOnError } = Object.assign(
-    { showDialogOnError: true },
-    options
-  );
+  validateJobId(options.jobId);
 
   const from = srcPaths.map((p) => '`"' + p + '`"').join(' ');
   const to = destPaths.map((p) => '`"' + p + '`"').join(' ');
 
-  const args = `move ${
-    showDialogOnError ? '--show-errors' : ''
-  } --from ${from} --to ${to}`;
+  const args = `move ${optionsToArgs(options)} --from ${from} --to ${to}`;
 
-  const output = await commandsAsScript(
-    `Start-Process -WindowStyle Hidden -FilePath "${exe}" -ArgumentList "${args}"`
-  );
+  const { exitCode, lines } = await runForOutput(args);
 
-  return output.exitCode;
+  return operationResultOf(exitCode, lines, options);
 }
 
 /**
  * Delete the given source path(s). All paths should be absolute.
- * Returns the exit code of the launcher process (not the launched explorer process).
+ * Resolves once the delete finishes, with its exit code and the id of its undo log.
+ * With the `dryRun` option, resolves with the plan instead.
  * @throws Throws on invalid input
  */
-export async function del(src: string | string[], options: FileOpOptions = {}) {
+export async function del(
+  src: string | string[],
+  options: FileOpOptions = {}
+): Promise<OperationResult> {
   const { srcPaths } = validateInput('delete', src, []);
-  const { showDialogOnError } = Object.assign(
-    { showDialogOnError: true },
-    options
-  );
+  validateJobId(options.jobId);
 
   const from = srcPaths.map((p) => '`"' + p + '`"').join(' ');
 
-  const args = `delete ${
-    showDialogOnError ? '--show-errors' : ''
-  } --from ${from}`;
+  const args = `delete ${optionsToArgs(options)} --from ${from}`;
+
+  const { exitCode, lines } = await runForOutput(args);
+
+  return operationResultOf(exitCode, lines, options);
+}
+
+/**
+ * Reverse the copy, move, or delete saved under the given job id (see the
+ * `jobId` option). Moves are moved back, copies are deleted, and deleted
+ * items are restored from the Recycle Bin.
+ * Returns the exit code of the launcher process (not the launched explorer process).
+ * @throws Throws on an invalid job id
+ */
+export async function undo(jobId: string, options: FileOpOptions = {}) {
+  validateJobId(jobId);
+
+  const args = `undo ${optionsToArgs(options)} ` + '`"' + jobId + '`"';
 
   const output = await commandsAsScript(
     `Start-Process -WindowStyle Hidden -FilePath "${exe}" -ArgumentList "${args}"`
@@ -146,3 +842,114 @@ export async function del(src: string | string[], options: FileOpOptions = {}) {
 
   return output.exitCode;
 }
+
+/**
+ * Check the files in the given directory against a manifest written by the
+ * `manifest` option. Resolves with the files that are missing or changed,
+ * relative to the directory, and the exit code of the operation, which is
+ * non-zero if there are any.
+ */
+export async function verifyManifest(
+  manifestPath: string,
+  directory: string,
+  options: FileOpOptions = {}
+): Promise<ManifestResult> {
+  const args =
+    `verify-manifest ${optionsToArgs(options)} ` +
+    '`"' +
+    manifestPath +
+    '`" `"' +
+    directory +
+    '`"';
+
+  const { exitCode, lines } = await runForOutput(args);
+  const result: ManifestResult = { exitCode, missing: [], changed: [] };
+
+  for (const line of lines) {
+    const space = line.indexOf(' ');
+    const kind = line.slice(0, space);
+
+    if (kind === 'missing') {
+      result.missing.push(line.slice(space + 1));
+    } else if (kind === 'changed') {
+      result.changed.push(line.slice(space + 1));
+    }
+  }
+
+  return result;
+}
+
+/**
+ * Compare the folders at the given paths, and resolve with how `right`
+ * differs from `left`: one `added`, `removed`, or `modified` entry each, with
+ * paths relative to the folders and folders ending in a backslash. Files with
+ * the same size and modification time are taken as the same, and files with
+ * the same size but different times have their contents compared.
+ */
+export async function diff(
+  left: string,
+  right: string,
+  options: FileOpOptions = {}
+): Promise<DiffResult> {
+  const args =
+    `diff ${optionsToArgs(options)} ` + '`"' + left + '`" `"' + right + '`"';
+
+  const { exitCode, lines } = await runForOutput(args);
+  const result: DiffResult = { exitCode, changes: [] };
+
+  for (const line of lines) {
+    const space = line.indexOf(' ');
+    const change = line.slice(0, space);
+
+    if (change === 'added' || change === 'removed' || change === 'modified') {
+      result.changes.push({ change, path: line.slice(space + 1) });
+    }
+  }
+
+  return result;
+}
+
+/**
+ * Change the limits of a running operation started with the given `control`
+ * name. Only the limits given are changed, and 0 removes a limit. Resolves
+ * with the operation's reply to each change, starting with `ok` or `error`.
+ */
+export function setLimits(
+  control: string,
+  limits: { bwlimit?: number | string; iopsLimit?: number }
+): Promise<string[]> {
+  const commands: string[] = [];
+
+  if (limits.bwlimit !== undefined) {
+    commands.push(`bwlimit ${limits.bwlimit}\n`);
+  }
+
+  if (limits.iopsLimit !== undefined) {
+    commands.push(`iops-limit ${limits.iopsLimit}\n`);
+  }
+
+  return new Promise((resolve, reject) => {
+    const pipe = net.connect('\\\\.\\pipe\\' + control);
+    let replies = '';
+
+    pipe.setEncoding('utf8');
+    pipe.on('error', reject);
+    pipe.on('connect', () => {
+      if (commands.length === 0) {
+        pipe.end();
+        resolve([]);
+      } else {
+        pipe.write(commands.join(''));
+      }
+    });
+    pipe.on('data', (data: string) => {
+      replies += data;
+
+      const lines = replies.split('\n');
+      if (lines.length > commands.length) {
+        pipe.end();
+        resolve(lines.slice(0, commands.length));
+      }
+    });
+  });
+}
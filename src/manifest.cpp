@@ -0,0 +1,270 @@
+#include "manifest.h"
+#include "priority.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+static const char MANIFEST_HEADER[] = "# fileops manifest ";
+
+// How much of the manifest to collect before each write
+static const size_t MANIFEST_BUFFER_SIZE = 64 * 1024;
+
+/**
+ * Collects small writes into larger ones, since a manifest is written a line
+ * at a time
+ */
+class BufferedWriter {
+public:
+  BufferedWriter(HANDLE file) : file(file), error(0) {
+    buffer.reserve(MANIFEST_BUFFER_SIZE);
+  }
+
+  void write(const std::string &text) {
+    if (buffer.size() + text.size() > MANIFEST_BUFFER_SIZE) {
+      flush();
+    }
+    buffer.insert(buffer.end(), text.begin(), text.end());
+  }
+
+  /**
+   * Write out whatever is buffered, and return the first error so far
+   */
+  DWORD flush() {
+    if (error == 0 && !buffer.empty()) {
+      DWORD written = 0;
+      if (!WriteFile(file, buffer.data(), (DWORD)buffer.size(), &written,
+                     NULL)) {
+        error = GetLastError();
+      }
+    }
+
+    buffer.clear();
+    return error;
+  }
+
+private:
+  HANDLE file;
+  std::vector<char> buffer;
+  DWORD error;
+};
+
+/**
+ * Order paths by their directory, then by name, ignoring case
+ */
+static bool byDirectory(const ManifestEntry &a, const ManifestEntry &b) {
+  std::wstring aDir = parentPath(a.path);
+  std::wstring bDir = parentPath(b.path);
+
+  int order = CompareStringOrdinal(aDir.c_str(), (int)aDir.length(),
+                                   bDir.c_str(), (int)bDir.length(), TRUE);
+  if (order != CSTR_EQUAL) {
+    return order == CSTR_LESS_THAN;
+  }
+
+  return CompareStringOrdinal(a.path.c_str(), (int)a.path.length(),
+                              b.path.c_str(), (int)b.path.length(),
+                              TRUE) == CSTR_LESS_THAN;
+}
+
+DWORD writeManifest(const std::wstring &path, HashAlgorithm algorithm,
+                    std::vector<ManifestEntry> &entries) {
+  std::sort(entries.begin(), entries.end(), byDirectory);
+
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  BufferedWriter writer(file);
+  writer.write(MANIFEST_HEADER + hashAlgorithmName(algorithm) + "\r\n");
+
+  for (const ManifestEntry &entry : entries) {
+    writer.write(entry.digest + " " + std::to_string(entry.size) + " " +
+                 std::to_string(entry.lastWriteTime) + " " +
+                 toUtf8(entry.path) + "\r\n");
+  }
+
+  DWORD error = writer.flush();
+  CloseHandle(file);
+
+  return error;
+}
+
+/**
+ * Read the whole file at the given path
+ */
+static DWORD readWholeFile(const std::wstring &path, std::string &contents) {
+  HANDLE file =
+      CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  std::vector<char> buffer(MANIFEST_BUFFER_SIZE);
+  DWORD error = 0;
+
+  while (true) {
+    DWORD read = 0;
+    if (!ReadFile(file, buffer.data(), (DWORD)buffer.size(), &read, NULL)) {
+      error = GetLastError();
+      break;
+    }
+    if (read == 0) {
+      break;
+    }
+
+    contents.append(buffer.data(), read);
+  }
+
+  CloseHandle(file);
+
+  return error;
+}
+
+/**
+ * Parse a manifest into its hash algorithm and entries
+ */
+static DWORD parseManifest(const std::string &contents,
+                           HashAlgorithm &algorithm,
+                           std::vector<ManifestEntry> &entries) {
+  size_t start = 0;
+  bool isFirst = true;
+
+  while (start < contents.size()) {
+    size_t end = contents.find('\n', start);
+    if (end == std::string::npos) {
+      end = contents.size();
+    }
+
+    std::string line = contents.substr(start, end - start);
+    start = end + 1;
+
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    if (isFirst) {
+      if (line.rfind(MANIFEST_HEADER, 0) != 0 ||
+          !parseHashAlgorithm(line.substr(sizeof(MANIFEST_HEADER) - 1),
+                              algorithm)) {
+        return ERROR_BAD_FORMAT;
+      }
+      isFirst = false;
+      continue;
+    }
+
+    if (line.empty()) {
+      continue;
+    }
+
+    size_t sizeStart = line.find(' ') + 1;
+    size_t timeStart = line.find(' ', sizeStart) + 1;
+    size_t pathStart = line.find(' ', timeStart) + 1;
+
+    if (sizeStart == 0 || timeStart == 0 || pathStart == 0 ||
+        pathStart == line.size()) {
+      return ERROR_BAD_FORMAT;
+    }
+
+    ManifestEntry entry;
+    entry.digest = line.substr(0, sizeStart - 1);
+    entry.size = std::strtoull(line.c_str() + sizeStart, NULL, 10);
+    entry.lastWriteTime = std::strtoull(line.c_str() + timeStart, NULL, 10);
+    entry.path = toWide(line.substr(pathStart));
+    entries.push_back(entry);
+  }
+
+  return isFirst ? ERROR_BAD_FORMAT : 0;
+}
+
+enum class EntryStatus : char {
+  Matches,
+  Missing,
+  Changed,
+};
+
+DWORD verifyManifest(const std::wstring &path, const std::wstring &root,
+                     ManifestReport &report) {
+  std::string contents;
+  DWORD error = readWholeFile(path, contents);
+  if (error != 0) {
+    return error;
+  }
+
+  HashAlgorithm algorithm;
+  std::vector<ManifestEntry> entries;
+  error = parseManifest(contents, algorithm, entries);
+  if (error != 0) {
+    return error;
+  }
+
+  std::vector<EntryStatus> statuses(entries.size(), EntryStatus::Matches);
+  std::atomic<size_t> next(0);
+  std::atomic<DWORD> firstError(0);
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < entries.size() && firstError == 0;
+         i = next++) {
+      const ManifestEntry &entry = entries[i];
+      std::wstring file = joinPath(root, entry.path);
+      WIN32_FIND_DATAW data;
+
+      if (!statPath(file, data)) {
+        DWORD statError = GetLastError();
+        if (statError == ERROR_FILE_NOT_FOUND ||
+            statError == ERROR_PATH_NOT_FOUND) {
+          statuses[i] = EntryStatus::Missing;
+        } else {
+          DWORD none = 0;
+          firstError.compare_exchange_strong(none, statError);
+        }
+        continue;
+      }
+
+      // A size that differs means the contents do too, without reading them
+      if (fileSizeOf(data) != entry.size) {
+        statuses[i] = EntryStatus::Changed;
+        continue;
+      }
+
+      std::string digest;
+      ULONGLONG read = 0;
+      DWORD hashError = hashFile(file, algorithm, true, digest, read);
+
+      if (hashError != 0) {
+        DWORD none = 0;
+        firstError.compare_exchange_strong(none, hashError);
+      } else if (digest != entry.digest) {
+        statuses[i] = EntryStatus::Changed;
+      }
+    }
+  };
+
+  size_t threadCount = std::min<size_t>(
+      std::max(1U, std::thread::hardware_concurrency()), entries.size());
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i++) {
+    threads.push_back(startWorker(worker));
+  }
+  worker();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (statuses[i] == EntryStatus::Missing) {
+      report.missing.push_back(entries[i].path);
+    } else if (statuses[i] == EntryStatus::Changed) {
+      report.changed.push_back(entries[i].path);
+    }
+  }
+
+  return firstError;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "hash.h"
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * A copied file as recorded in a manifest
+ */
+struct ManifestEntry {
+  // Relative to the directory the file's target was copied into
+  std::wstring path;
+  ULONGLONG size;
+  ULONGLONG lastWriteTime;
+  std::string digest;
+};
+
+/**
+ * Write a manifest of the given files. Entries are sorted so each directory's
+ * files are listed together and in name order.
+ *
+ * Manifests are UTF-8 text. The first line names the hash used, as in
+ * "# fileops manifest xxh3", and each line after it is a file's hash, size,
+ * modification time (in 100ns ticks since 1601), and path, separated by
+ * spaces. The path is last, so it can contain spaces.
+ *
+ * Returns 0 or a Windows error code.
+ */
+DWORD writeManifest(const std::wstring &path, HashAlgorithm algorithm,
+                    std::vector<ManifestEntry> &entries);
+
+/**
+ * The files that didn't match when checking a tree against a manifest
+ */
+struct ManifestReport {
+  std::vector<std::wstring> missing;
+  std::vector<std::wstring> changed;
+};
+
+/**
+ * Check the files under `root` against the manifest at the given path, by
+ * size and hash. Files are checked on several threads at once, and read past
+ * the system cache. Returns 0 or a Windows error code, which doesn't include
+ * the files that didn't match.
+ */
+DWORD verifyManifest(const std::wstring &path, const std::wstring &root,
+                     ManifestReport &report);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "conflict.h"
+#include "dedupe.h"
+#include "durability.h"
+#include "filter.h"
+#include "hash.h"
+#include "links.h"
+#include "preserve.h"
+#include "priority.h"
+#include "selection.h"
+#include "wal.h"
+
+#include <string>
+
+/**
+ * Options that change how the file operation is carried out
+ */
+struct FileOpOptions {
+  bool showErrorDialog = false;
+  Durability durability = Durability::None;
+  bool atomic = false;
+  std::wstring journal;
+  std::wstring wal;
+  Recovery walRecovery = Recovery::Replay;
+  std::wstring jobId;
+  bool sync = false;
+  bool mirror = false;
+  ULONGLONG mtimeTolerance = 0;
+  bool delta = false;
+  std::wstring index;
+  HashAlgorithm verify = HashAlgorithm::None;
+  std::wstring manifest;
+  Dedupe dedupe = Dedupe::None;
+  bool hardlinks = false;
+  SymlinkPolicy symlinks = SymlinkPolicy::Default;
+  // A combination of PreserveFlags
+  DWORD preserve = 0;
+  PathFilter filter;
+  // The name of the ignore files to look for in each directory
+  std::wstring ignoreFile;
+  Selection selection;
+  bool dryRun = false;
+  bool preflight = false;
+  bool waitForSpace = false;
+  ConflictPolicy onConflict = ConflictPolicy::Default;
+  // Bytes and read or write calls per second, or 0 for no limit
+  ULONGLONG bwlimit = 0;
+  ULONGLONG iopsLimit = 0;
+  // The name of the pipe the limits can be changed through while running
+  std::wstring control;
+  SchedulingPolicy scheduling;
+};
@@ -0,0 +1,37 @@
+#include "parallel.h"
+#include "priority.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+DWORD runParallel(size_t count, const std::function<DWORD(size_t)> &task) {
+  std::atomic<size_t> next(0);
+  std::atomic<DWORD> firstError(0);
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < count && firstError == 0; i = next++) {
+      DWORD error = task(i);
+      if (error != 0) {
+        DWORD none = 0;
+        firstError.compare_exchange_strong(none, error);
+      }
+    }
+  };
+
+  size_t threadCount = std::min<size_t>(
+      std::max(1U, std::thread::hardware_concurrency()), count);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i++) {
+    threads.push_back(startWorker(worker));
+  }
+  worker();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  return firstError;
+}
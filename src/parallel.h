@@ -0,0 +1,12 @@
+#pragma once
+
+#include "platform.h"
+
+#include <functional>
+
+/**
+ * Run `task` for each index below `count`, on as many threads as there are
+ * processors. Tasks stop being started after the first one that fails.
+ * Returns the first error, or 0.
+ */
+DWORD runParallel(size_t count, const std::function<DWORD(size_t)> &task);
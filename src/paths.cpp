@@ -0,0 +1,152 @@
+#include "paths.h"
+
+// clang-format off
+#include <shlobj.h>
+// clang-format on
+
+#pragma comment(lib, "Shell32.lib")
+
+static bool isSeparator(wchar_t c) { return c == L'\\' || c == L'/'; }
+
+/**
+ * Strip trailing separators, keeping the one after a drive letter (e.g. "C:\")
+ */
+static std::wstring trimSeparators(const std::wstring &path) {
+  size_t end = path.length();
+  while (end > 0 && isSeparator(path[end - 1])) {
+    if (end >= 2 && path[end - 2] == L':') {
+      break;
+    }
+    end--;
+  }
+  return path.substr(0, end);
+}
+
+std::wstring toWide(const std::string &str) {
+  if (str.empty()) {
+    return std::wstring();
+  }
+
+  int length = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.length(),
+                                   NULL, 0);
+  std::wstring result(length, L'\0');
+  MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.length(), &result[0],
+                      length);
+
+  return result;
+}
+
+std::string toUtf8(const std::wstring &str) {
+  if (str.empty()) {
+    return std::string();
+  }
+
+  int length = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.length(),
+                                   NULL, 0, NULL, NULL);
+  std::string result(length, '\0');
+  WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.length(), &result[0],
+                      length, NULL, NULL);
+
+  return result;
+}
+
+std::wstring joinPath(const std::wstring &dir, const std::wstring &name) {
+  if (dir.empty()) {
+    return name;
+  }
+
+  if (isSeparator(dir[dir.length() - 1])) {
+    return dir + name;
+  }
+
+  return dir + L"\\" + name;
+}
+
+std::wstring parentPath(const std::wstring &path) {
+  std::wstring trimmed = trimSeparators(path);
+
+  size_t slash = trimmed.find_last_of(L"\\/");
+  if (slash == std::wstring::npos) {
+    return std::wstring();
+  }
+
+  // Keep the separator for drive roots so the result is still a directory
+  if (slash > 0 && trimmed[slash - 1] == L':') {
+    return trimmed.substr(0, slash + 1);
+  }
+
+  return trimmed.substr(0, slash);
+}
+
+std::wstring baseName(const std::wstring &path) {
+  std::wstring trimmed = trimSeparators(path);
+
+  size_t slash = trimmed.find_last_of(L"\\/");
+  if (slash == std::wstring::npos) {
+    return trimmed;
+  }
+
+  return trimmed.substr(slash + 1);
+}
+
+std::wstring volumeRoot(const std::wstring &path) {
+  wchar_t root[MAX_PATH + 1];
+
+  if (!GetVolumePathNameW(path.c_str(), root, MAX_PATH + 1)) {
+    return std::wstring();
+  }
+
+  return root;
+}
+
+ULONGLONG hashPath(const std::wstring &path) {
+  std::wstring upper = path;
+  if (!upper.empty()) {
+    CharUpperBuffW(&upper[0], (DWORD)upper.length());
+  }
+
+  // 64-bit FNV-1a
+  ULONGLONG hash = 14695981039346656037ULL;
+  for (wchar_t c : upper) {
+    hash = (hash ^ (c & 0xFF)) * 1099511628211ULL;
+    hash = (hash ^ ((c >> 8) & 0xFF)) * 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+DWORD createDirectories(const std::wstring &path) {
+  int result = SHCreateDirectoryExW(NULL, path.c_str(), NULL);
+
+  if (result == ERROR_ALREADY_EXISTS || result == ERROR_FILE_EXISTS) {
+    return 0;
+  }
+
+  return result;
+}
+
+bool isSameVolume(const std::wstring &a, const std::wstring &b) {
+  std::wstring rootA = volumeRoot(a);
+  return !rootA.empty() && _wcsicmp(rootA.c_str(), volumeRoot(b).c_str()) == 0;
+}
+
+std::vector<Target> resolveTargets(const std::vector<std::string> &srcPaths,
+                                   const std::vector<std::string> &destPaths) {
+  std::vector<Target> targets;
+
+  for (size_t i = 0; i < srcPaths.size(); i++) {
+    Target target;
+    target.src = trimSeparators(toWide(srcPaths[i]));
+
+    if (destPaths.size() > 1) {
+      target.dest = trimSeparators(toWide(destPaths[i]));
+    } else if (destPaths.size() == 1) {
+      target.dest =
+          joinPath(trimSeparators(toWide(destPaths[0])), baseName(target.src));
+    }
+
+    targets.push_back(target);
+  }
+
+  return targets;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * A top-level source path and the path it ends up at after the operation
+ */
+struct Target {
+  std::wstring src;
+  std::wstring dest;
+};
+
+/**
+ * A single file below a target, with the source metadata from the listing
+ */
+struct FileCopy {
+  std::wstring src;
+  std::wstring dest;
+  ULONGLONG size;
+  ULONGLONG lastWriteTime;
+  DWORD attributes;
+};
+
+/**
+ * Convert a UTF-8 std::string to a wide string
+ */
+std::wstring toWide(const std::string &str);
+
+/**
+ * Convert a wide string to a UTF-8 std::string
+ */
+std::string toUtf8(const std::wstring &str);
+
+/**
+ * Join the given directory and name with a single backslash
+ */
+std::wstring joinPath(const std::wstring &dir, const std::wstring &name);
+
+/**
+ * Get the parent directory of the given path, without a trailing backslash
+ */
+std::wstring parentPath(const std::wstring &path);
+
+/**
+ * Get the last component of the given path
+ */
+std::wstring baseName(const std::wstring &path);
+
+/**
+ * Get the root of the volume the given path is on (e.g. "C:\"), or an empty
+ * string if it can't be found
+ */
+std::wstring volumeRoot(const std::wstring &path);
+
+/**
+ * Hash the given path, ignoring case like the file system does
+ */
+ULONGLONG hashPath(const std::wstring &path);
+
+/**
+ * Create the given directory and any missing parents. Returns 0 or a Windows
+ * error code, and treats an existing directory as success.
+ */
+DWORD createDirectories(const std::wstring &path);
+
+/**
+ * Check if the given paths are on the same volume
+ */
+bool isSameVolume(const std::wstring &a, const std::wstring &b);
+
+/**
+ * Work out where each source will be placed, using the same rules as
+ * SHFileOperation: with multiple destinations each source maps to its
+ * matching destination, otherwise every source goes into the single
+ * destination directory.
+ */
+std::vector<Target> resolveTargets(const std::vector<std::string> &srcPaths,
+                                   const std::vector<std::string> &destPaths);
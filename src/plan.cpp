@@ -0,0 +1,290 @@
+#include "plan.h"
+#include "conflict.h"
+#include "dedupe.h"
+#include "engine.h"
+#include "hardlinks.h"
+#include "walker.h"
+
+#include <algorithm>
+
+// How much of the largest sources to read to measure their throughput
+static const ULONGLONG CALIBRATION_BYTES = 64ULL * 1024 * 1024;
+static const DWORD CALIBRATION_READ_SIZE = 1024 * 1024;
+
+// How many sources to open to measure what each file costs on its own
+static const size_t CALIBRATION_FILES = 256;
+
+const char *planMethodName(PlanMethod method) {
+  switch (method) {
+  case PlanMethod::Rename:
+    return "rename";
+  case PlanMethod::Hardlink:
+    return "hardlink";
+  case PlanMethod::Clone:
+    return "clone";
+  case PlanMethod::Link:
+    return "link";
+  case PlanMethod::Delta:
+    return "delta";
+  case PlanMethod::Chunked:
+    return "chunked";
+  case PlanMethod::CopyFile:
+    return "copyfile";
+  case PlanMethod::Explorer:
+    return "explorer";
+  case PlanMethod::Delete:
+    return "delete";
+  }
+  return "";
+}
+
+bool writesContents(PlanMethod method) {
+  return method == PlanMethod::Delta || method == PlanMethod::Chunked ||
+         method == PlanMethod::CopyFile || method == PlanMethod::Explorer;
+}
+
+static double secondsSince(const LARGE_INTEGER &start) {
+  LARGE_INTEGER now;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&frequency);
+  return (double)(now.QuadPart - start.QuadPart) / frequency.QuadPart;
+}
+
+/**
+ * Measure what opening a file costs, from a sample spread across the plan.
+ * Each file is opened once at its source and once at its destination, so
+ * the cost of opening a source is counted twice.
+ */
+static void calibrateFiles(const std::vector<PlanItem> &items,
+                           ThroughputModel &model) {
+  size_t step = std::max<size_t>(items.size() / CALIBRATION_FILES, 1);
+  size_t opened = 0;
+
+  LARGE_INTEGER start;
+  QueryPerformanceCounter(&start);
+
+  for (size_t i = 0; i < items.size(); i += step) {
+    HANDLE file = CreateFileW(
+        items[i].src.c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      continue;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info;
+    GetFileInformationByHandle(file, &info);
+    CloseHandle(file);
+    opened++;
+  }
+
+  if (opened > 0) {
+    model.secondsPerFile = 2 * secondsSince(start) / opened;
+  }
+}
+
+/**
+ * Measure how fast the sources can be read, by reading the start of the
+ * largest ones without the cache
+ */
+static DWORD calibrateBytes(const std::vector<PlanItem> &items,
+                            ThroughputModel &model) {
+  std::vector<size_t> largest;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (writesContents(items[i].method) && items[i].size > 0) {
+      largest.push_back(i);
+    }
+  }
+
+  std::sort(largest.begin(), largest.end(), [&](size_t a, size_t b) {
+    return items[a].size > items[b].size;
+  });
+
+  // Unbuffered reads have to go into sector-aligned memory
+  BYTE *buffer = (BYTE *)VirtualAlloc(NULL, CALIBRATION_READ_SIZE,
+                                      MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (buffer == NULL) {
+    return GetLastError();
+  }
+
+  ULONGLONG total = 0;
+  LARGE_INTEGER start;
+  QueryPerformanceCounter(&start);
+
+  for (size_t i = 0; i < largest.size() && total < CALIBRATION_BYTES; i++) {
+    HANDLE file = CreateFileW(items[largest[i]].src.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_NO_BUFFERING, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      continue;
+    }
+
+    DWORD read = 0;
+    while (total < CALIBRATION_BYTES &&
+           ReadFile(file, buffer, CALIBRATION_READ_SIZE, &read, NULL) &&
+           read > 0) {
+      total += read;
+    }
+
+    CloseHandle(file);
+  }
+
+  double seconds = secondsSince(start);
+  if (total > 0 && seconds > 0) {
+    model.bytesPerSecond = total / seconds;
+  }
+
+  VirtualFree(buffer, 0, MEM_RELEASE);
+
+  return 0;
+}
+
+/**
+ * Add an item to the plan and count it in the totals
+ */
+static void addItem(OperationPlan &plan, const std::wstring &src,
+                    const std::wstring &dest, PlanMethod method,
+                    ULONGLONG size) {
+  PlanItem item;
+  item.src = src;
+  item.dest = dest;
+  item.method = method;
+  item.size = size;
+  item.target = plan.targetDirectories.size() - 1;
+  plan.items.push_back(item);
+
+  if (writesContents(method)) {
+    plan.bytesWritten += size;
+  }
+}
+
+DWORD planOperation(const std::string &action,
+                    const std::vector<Target> &targets,
+                    const FileOpOptions &options, bool useEngine,
+                    OperationPlan &plan) {
+  for (const Target &target : targets) {
+    CopyList list;
+    DWORD error = expandTargets(std::vector<Target>(1, target), options, list);
+    if (error != 0) {
+      return error;
+    }
+
+    ULONGLONG size = 0;
+    for (const FileCopy &file : list.files) {
+      size += file.size;
+    }
+
+    plan.files += list.files.size() + list.links.size();
+    plan.directories += list.dirs.size();
+    plan.bytes += size;
+    plan.excluded += list.excluded;
+    plan.targetDirectories.push_back(0);
+
+    // Explorer deletes and renames whole targets at once
+    if (action == "delete") {
+      addItem(plan, target.src, L"", PlanMethod::Delete, size);
+      plan.operations += std::max<ULONGLONG>(
+          list.files.size() + list.links.size() + list.dirs.size(), 1);
+      continue;
+    }
+
+    // The destination doesn't exist yet, so its parent's volume is used
+    if (action == "move" && isSameVolume(target.src, parentPath(target.dest))) {
+      addItem(plan, target.src, target.dest, PlanMethod::Rename, size);
+      plan.operations++;
+      continue;
+    }
+
+    // Renamed trees keep their directories, and deleted ones don't need any
+    plan.targetDirectories.back() = list.dirs.size();
+
+    if (!useEngine) {
+      for (const FileCopy &file : list.files) {
+        addItem(plan, file.src, file.dest, PlanMethod::Explorer, file.size);
+      }
+      plan.operations += list.files.size();
+      continue;
+    }
+
+    for (const FileCopy &link : list.links) {
+      addItem(plan, link.src, link.dest, PlanMethod::Link, 0);
+    }
+    plan.operations += list.files.size() + list.links.size();
+
+    std::vector<size_t> links;
+    if (options.hardlinks) {
+      error = findHardLinks(list.files, links);
+      if (error != 0) {
+        return error;
+      }
+    }
+
+    // Repeats of an earlier file are cloned from its copy, as the engine does
+    std::vector<size_t> originals;
+    bool useDedupe = options.dedupe != Dedupe::None;
+    if (useDedupe) {
+      error = findDuplicates(list.files, originals);
+      if (error != 0) {
+        return error;
+      }
+    }
+
+    // Without --on-conflict, every way of copying replaces an existing
+    // destination without asking
+    DestinationListing destinations(list.files);
+    ConflictStats conflicts;
+
+    for (size_t i = 0; i < list.files.size(); i++) {
+      const FileCopy &file = list.files[i];
+
+      const DestinationEntry *existing = destinations.find(i);
+      if (existing != NULL && options.onConflict == ConflictPolicy::Default) {
+        plan.overwrites++;
+      } else {
+        resolveConflict(options.onConflict, file, existing, conflicts);
+      }
+
+      if (options.hardlinks && links[i] != i) {
+        addItem(plan, file.src, file.dest, PlanMethod::Hardlink, file.size);
+        continue;
+      }
+
+      if (useDedupe && originals[i] != i) {
+        addItem(plan, file.src, file.dest,
+                options.dedupe == Dedupe::Hardlink ? PlanMethod::Hardlink
+                                                   : PlanMethod::Clone,
+                file.size);
+        continue;
+      }
+
+      CopyMethod method = copyMethodFor(file, options);
+      addItem(plan, file.src, file.dest,
+              method == CopyMethod::Delta     ? PlanMethod::Delta
+              : method == CopyMethod::Chunked ? PlanMethod::Chunked
+                                              : PlanMethod::CopyFile,
+              file.size);
+    }
+
+    plan.overwrites += conflicts.overwritten;
+  }
+
+  return 0;
+}
+
+DWORD estimateDuration(OperationPlan &plan) {
+  calibrateFiles(plan.items, plan.model);
+  DWORD error = calibrateBytes(plan.items, plan.model);
+  if (error != 0) {
+    return error;
+  }
+
+  // Every operation costs a little, and copies also cost the time to write
+  // their contents
+  plan.seconds = plan.operations * plan.model.secondsPerFile;
+  if (plan.model.bytesPerSecond > 0) {
+    plan.seconds += plan.bytesWritten / plan.model.bytesPerSecond;
+  }
+
+  return 0;
+}
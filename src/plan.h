@@ -0,0 +1,96 @@
+#pragma once
+
+#include "options.h"
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * How a single item would be carried out
+ */
+enum class PlanMethod {
+  // Renamed in place, on the same volume
+  Rename,
+  // Hard linked to the copy of another name of the same file, or of a file
+  // with the same contents
+  Hardlink,
+  // Cloned from the copy of a file with the same contents, sharing its
+  // storage where the file system supports it
+  Clone,
+  // A symbolic link or junction, recreated as a link
+  Link,
+  // The built-in copier's ways of writing a file
+  Delta,
+  Chunked,
+  CopyFile,
+  // Copied or moved by Explorer
+  Explorer,
+  // Sent to the recycle bin by Explorer
+  Delete,
+};
+
+/**
+ * Get the name a method is shown with in a plan
+ */
+const char *planMethodName(PlanMethod method);
+
+/**
+ * Check if the given method writes the contents of the file
+ */
+bool writesContents(PlanMethod method);
+
+struct PlanItem {
+  std::wstring src;
+  std::wstring dest;
+  PlanMethod method;
+  ULONGLONG size;
+  // The index of the target the item belongs to
+  size_t target;
+};
+
+/**
+ * The throughput an operation is estimated with
+ */
+struct ThroughputModel {
+  double bytesPerSecond = 0;
+  double secondsPerFile = 0;
+};
+
+/**
+ * Everything an operation would do, without doing any of it
+ */
+struct OperationPlan {
+  std::vector<PlanItem> items;
+  ULONGLONG files = 0;
+  ULONGLONG directories = 0;
+  ULONGLONG bytes = 0;
+  // Bytes that would be written, leaving out renames and links
+  ULONGLONG bytesWritten = 0;
+  ULONGLONG excluded = 0;
+  // Files whose destinations already exist and would be replaced
+  ULONGLONG overwrites = 0;
+  // How many directories would be created for each target
+  std::vector<ULONGLONG> targetDirectories;
+  // How many separate operations the items take, since deleting a tree takes
+  // one for everything in it
+  ULONGLONG operations = 0;
+  ThroughputModel model;
+  double seconds = 0;
+};
+
+/**
+ * Work out what the given operation would do, walking the targets the same
+ * way a real run does and choosing each file's method the same way.
+ * Returns 0 or a Windows error code.
+ */
+DWORD planOperation(const std::string &action,
+                    const std::vector<Target> &targets,
+                    const FileOpOptions &options, bool useEngine,
+                    OperationPlan &plan);
+
+/**
+ * Estimate how long a plan would take, from a throughput model calibrated on
+ * its sources. Returns 0 or a Windows error code.
+ */
+DWORD estimateDuration(OperationPlan &plan);
@@ -0,0 +1,10 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN // Disables inclusion of many large headers
+#define _WIN32_WINNT 0x0601 // Defines the version of Windows for <windows.h>
+#define UNICODE
+#define NOMINMAX // Keeps std::min and std::max usable
+
+// clang-format off
+#include <windows.h>
+// clang-format on
@@ -0,0 +1,124 @@
+#include "preflight.h"
+#include "walker.h"
+
+#include <cstdint>
+
+// NTFS has no fixed number of files, but each file and directory takes a
+// record of this size in the master file table
+static const ULONGLONG NTFS_RECORD_SIZE = 1024;
+
+// Files up to about this size are stored inside their NTFS record, and take
+// no clusters of their own
+static const ULONGLONG NTFS_RESIDENT_SIZE = 512;
+
+/**
+ * Read the free space and layout of the volume at the given root
+ */
+static DWORD readVolume(const std::wstring &root, VolumeSpace &space) {
+  space.volume = root;
+
+  ULARGE_INTEGER available;
+  if (!GetDiskFreeSpaceExW(root.c_str(), &available, NULL, NULL)) {
+    return GetLastError();
+  }
+  space.available = available.QuadPart;
+
+  DWORD sectorsPerCluster;
+  DWORD bytesPerSector;
+  DWORD freeClusters;
+  DWORD totalClusters;
+  if (!GetDiskFreeSpaceW(root.c_str(), &sectorsPerCluster, &bytesPerSector,
+                         &freeClusters, &totalClusters)) {
+    return GetLastError();
+  }
+  space.clusterSize = sectorsPerCluster * bytesPerSector;
+
+  wchar_t fileSystem[MAX_PATH + 1];
+  if (!GetVolumeInformationW(root.c_str(), NULL, 0, NULL, NULL, NULL,
+                             fileSystem, MAX_PATH + 1)) {
+    return GetLastError();
+  }
+  space.fileSystem = fileSystem;
+
+  return 0;
+}
+
+/**
+ * Get how much space a file of the given size takes on the volume
+ */
+static ULONGLONG spaceForFile(const VolumeSpace &space, ULONGLONG size) {
+  ULONGLONG clusters = (size + space.clusterSize - 1) / space.clusterSize;
+
+  if (space.fileSystem == L"NTFS") {
+    return NTFS_RECORD_SIZE +
+           (size <= NTFS_RESIDENT_SIZE ? 0 : clusters * space.clusterSize);
+  }
+
+  return clusters * space.clusterSize;
+}
+
+/**
+ * Get how much space an empty directory takes on the volume
+ */
+static ULONGLONG spaceForDirectory(const VolumeSpace &space) {
+  return space.fileSystem == L"NTFS" ? NTFS_RECORD_SIZE : space.clusterSize;
+}
+
+DWORD measureSpace(const std::vector<Target> &targets,
+                   const OperationPlan &plan,
+                   std::vector<VolumeSpace> &volumes) {
+  // Everything from one target goes to the same volume, so the volume is
+  // only looked up once for each target
+  std::vector<size_t> volumeOf(targets.size(), SIZE_MAX);
+
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (targets[i].dest.empty()) {
+      continue;
+    }
+
+    std::wstring root = volumeRoot(parentPath(targets[i].dest));
+    if (root.empty()) {
+      return GetLastError();
+    }
+
+    size_t index = 0;
+    while (index < volumes.size() &&
+           compareNames(volumes[index].volume.c_str(), root.c_str()) != 0) {
+      index++;
+    }
+
+    if (index == volumes.size()) {
+      VolumeSpace space;
+      DWORD error = readVolume(root, space);
+      if (error != 0) {
+        return error;
+      }
+      volumes.push_back(space);
+    }
+
+    VolumeSpace &space = volumes[index];
+    space.directories += plan.targetDirectories[i];
+    space.required += plan.targetDirectories[i] * spaceForDirectory(space);
+    volumeOf[i] = index;
+  }
+
+  for (const PlanItem &item : plan.items) {
+    if (volumeOf[item.target] == SIZE_MAX ||
+        item.method == PlanMethod::Rename ||
+        item.method == PlanMethod::Hardlink) {
+      continue;
+    }
+
+    // Clones share their original's clusters on ReFS, and are copied where
+    // the file system can't clone
+    VolumeSpace &space = volumes[volumeOf[item.target]];
+    bool written = writesContents(item.method) ||
+                   (item.method == PlanMethod::Clone &&
+                    space.fileSystem != L"ReFS");
+
+    space.files++;
+    space.required += spaceForFile(space, written ? item.size : 0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "plan.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * What a plan needs from one destination volume, and what the volume has
+ */
+struct VolumeSpace {
+  // The volume's root path, like C:\ or a mount point
+  std::wstring volume;
+  std::wstring fileSystem;
+  DWORD clusterSize = 0;
+  // Bytes available to the current user, after any quota
+  ULONGLONG available = 0;
+  // Bytes the plan would use, rounded up to whole clusters and including the
+  // file system's record for each file and directory
+  ULONGLONG required = 0;
+  ULONGLONG files = 0;
+  ULONGLONG directories = 0;
+};
+
+/**
+ * Work out how much space the plan needs on each destination volume and how
+ * much each one has. Renames, hard links, and deletes need nothing, and
+ * clones on ReFS only need a record. Returns 0 or a Windows error code.
+ */
+DWORD measureSpace(const std::vector<Target> &targets,
+                   const OperationPlan &plan,
+                   std::vector<VolumeSpace> &volumes);
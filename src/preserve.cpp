@@ -0,0 +1,305 @@
+#include "preserve.h"
+
+// clang-format off
+#include <aclapi.h>
+// clang-format on
+
+#include <mutex>
+
+#pragma comment(lib, "Advapi32.lib")
+
+static const DWORD SHARE_ALL =
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+
+// The stream every file has, which holds its contents
+static const wchar_t DEFAULT_STREAM[] = L"::$DATA";
+
+bool parsePreserve(const std::string &value, DWORD &flags) {
+  flags = 0;
+  size_t start = 0;
+
+  while (start <= value.size()) {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+
+    std::string name = value.substr(start, end - start);
+
+    if (name == "mode") {
+      flags |= PRESERVE_MODE;
+    } else if (name == "owner") {
+      flags |= PRESERVE_OWNER;
+    } else if (name == "times") {
+      flags |= PRESERVE_TIMES;
+    } else if (name == "xattr") {
+      flags |= PRESERVE_XATTR;
+    } else if (name == "acl") {
+      flags |= PRESERVE_ACL;
+    } else {
+      return false;
+    }
+
+    start = end + 1;
+  }
+
+  return flags != 0;
+}
+
+/**
+ * Try to enable the privilege that allows setting any owner, which admins
+ * have but don't use by default. Without it, only the current user can be
+ * made the owner.
+ */
+static void enableRestorePrivilege() {
+  static std::once_flag once;
+
+  std::call_once(once, []() {
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES,
+                          &token)) {
+      return;
+    }
+
+    TOKEN_PRIVILEGES privileges;
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    if (LookupPrivilegeValueW(NULL, SE_RESTORE_NAME,
+                              &privileges.Privileges[0].Luid)) {
+      AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL);
+    }
+
+    CloseHandle(token);
+  });
+}
+
+/**
+ * Copy a single named stream of a file, like ":Zone.Identifier:$DATA"
+ */
+static DWORD copyStream(const std::wstring &src, const std::wstring &dest,
+                        const wchar_t *stream, std::vector<BYTE> &buffer,
+                        PreserveStats &stats) {
+  HANDLE srcStream =
+      CreateFileW((src + stream).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  stats.xattr++;
+  if (srcStream == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  HANDLE destStream = CreateFileW((dest + stream).c_str(), GENERIC_WRITE, 0,
+                                  NULL, CREATE_ALWAYS, 0, NULL);
+  stats.xattr++;
+  if (destStream == INVALID_HANDLE_VALUE) {
+    DWORD error = GetLastError();
+    CloseHandle(srcStream);
+    return error;
+  }
+
+  DWORD error = 0;
+
+  while (true) {
+    DWORD read = 0;
+    stats.xattr++;
+    if (!ReadFile(srcStream, buffer.data(), (DWORD)buffer.size(), &read,
+                  NULL)) {
+      error = GetLastError();
+      break;
+    }
+    if (read == 0) {
+      break;
+    }
+
+    DWORD written = 0;
+    stats.xattr++;
+    if (!WriteFile(destStream, buffer.data(), read, &written, NULL)) {
+      error = GetLastError();
+      break;
+    }
+  }
+
+  CloseHandle(srcStream);
+  CloseHandle(destStream);
+
+  return error;
+}
+
+/**
+ * Copy every named stream of `src` to `dest`
+ */
+static DWORD copyStreams(const std::wstring &src, const std::wstring &dest,
+                         std::vector<BYTE> &buffer, PreserveStats &stats) {
+  WIN32_FIND_STREAM_DATA data;
+
+  HANDLE find = FindFirstStreamW(src.c_str(), FindStreamInfoStandard, &data, 0);
+  stats.xattr++;
+  if (find == INVALID_HANDLE_VALUE) {
+    // Directories usually have no streams at all
+    DWORD error = GetLastError();
+    return error == ERROR_HANDLE_EOF ? 0 : error;
+  }
+
+  DWORD error = 0;
+
+  do {
+    if (wcscmp(data.cStreamName, DEFAULT_STREAM) != 0) {
+      // Stream names end in ":$DATA", which opening them accepts
+      error = copyStream(src, dest, data.cStreamName, buffer, stats);
+    }
+    stats.xattr++;
+  } while (error == 0 && FindNextStreamW(find, &data));
+
+  FindClose(find);
+
+  return error;
+}
+
+/**
+ * Copy the owner and access control list from one open handle to another
+ */
+static DWORD copySecurity(HANDLE src, HANDLE dest, DWORD flags,
+                          PreserveStats &stats) {
+  SECURITY_INFORMATION which = 0;
+  if (flags & PRESERVE_OWNER) {
+    which |= OWNER_SECURITY_INFORMATION | GROUP_SECURITY_INFORMATION;
+  }
+  if (flags & PRESERVE_ACL) {
+    which |= DACL_SECURITY_INFORMATION;
+  }
+
+  PSID owner = NULL;
+  PSID group = NULL;
+  PACL dacl = NULL;
+  PSECURITY_DESCRIPTOR descriptor = NULL;
+
+  DWORD error = GetSecurityInfo(src, SE_FILE_OBJECT, which, &owner, &group,
+                                &dacl, NULL, &descriptor);
+  stats.owner += (flags & PRESERVE_OWNER) ? 1 : 0;
+  stats.acl += (flags & PRESERVE_ACL) ? 1 : 0;
+  if (error != ERROR_SUCCESS) {
+    return error;
+  }
+
+  // Keep whether the list inherits from the destination's parent the same
+  // as at the source
+  if (flags & PRESERVE_ACL) {
+    WORD control = 0;
+    DWORD revision = 0;
+    GetSecurityDescriptorControl(descriptor, &control, &revision);
+    which |= (control & SE_DACL_PROTECTED)
+                 ? PROTECTED_DACL_SECURITY_INFORMATION
+                 : UNPROTECTED_DACL_SECURITY_INFORMATION;
+  }
+
+  error = SetSecurityInfo(dest, SE_FILE_OBJECT, which, owner, group, dacl,
+                          NULL);
+  stats.owner += (flags & PRESERVE_OWNER) ? 1 : 0;
+  stats.acl += (flags & PRESERVE_ACL) ? 1 : 0;
+
+  LocalFree(descriptor);
+
+  return error;
+}
+
+DWORD preserveMetadata(const std::wstring &src, const std::wstring &dest,
+                       DWORD flags, std::vector<BYTE> &buffer,
+                       PreserveStats &stats) {
+  bool basic = (flags & (PRESERVE_MODE | PRESERVE_TIMES)) != 0;
+  bool security = (flags & (PRESERVE_OWNER | PRESERVE_ACL)) != 0;
+  DWORD error = 0;
+
+  // Streams are written first, since writing them updates the times. The
+  // chunked and delta copies have already set the source's attributes, so a
+  // read-only destination is made writable while its streams are written.
+  if (flags & PRESERVE_XATTR) {
+    DWORD attributes = GetFileAttributesW(dest.c_str());
+    bool readOnly = attributes != INVALID_FILE_ATTRIBUTES &&
+                    (attributes & FILE_ATTRIBUTE_READONLY);
+
+    DWORD writable = attributes & ~FILE_ATTRIBUTE_READONLY;
+    if (readOnly && !SetFileAttributesW(dest.c_str(), writable)) {
+      return GetLastError();
+    }
+
+    error = copyStreams(src, dest, buffer, stats);
+
+    if (readOnly && !SetFileAttributesW(dest.c_str(), attributes) &&
+        error == 0) {
+      error = GetLastError();
+    }
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  if (!basic && !security) {
+    return 0;
+  }
+
+  if (flags & PRESERVE_OWNER) {
+    enableRestorePrivilege();
+  }
+
+  // Backup semantics lets directories be opened too
+  HANDLE srcHandle = CreateFileW(
+      src.c_str(), FILE_READ_ATTRIBUTES | (security ? READ_CONTROL : 0),
+      SHARE_ALL, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (srcHandle == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  DWORD destAccess = FILE_WRITE_ATTRIBUTES;
+  if (flags & PRESERVE_OWNER) {
+    destAccess |= WRITE_OWNER;
+  }
+  if (flags & PRESERVE_ACL) {
+    destAccess |= WRITE_DAC;
+  }
+
+  HANDLE destHandle = CreateFileW(dest.c_str(), destAccess, SHARE_ALL, NULL,
+                                  OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS,
+                                  NULL);
+  if (destHandle == INVALID_HANDLE_VALUE) {
+    error = GetLastError();
+    CloseHandle(srcHandle);
+    return error;
+  }
+
+  if (security) {
+    error = copySecurity(srcHandle, destHandle, flags, stats);
+  }
+
+  // Attributes and times are read and set in one call each. Zero leaves a
+  // field as it is.
+  if (error == 0 && basic) {
+    FILE_BASIC_INFO info;
+    if (!GetFileInformationByHandleEx(srcHandle, FileBasicInfo, &info,
+                                      sizeof(info))) {
+      error = GetLastError();
+    }
+
+    if (!(flags & PRESERVE_MODE)) {
+      info.FileAttributes = 0;
+    }
+    if (!(flags & PRESERVE_TIMES)) {
+      info.CreationTime.QuadPart = 0;
+      info.LastAccessTime.QuadPart = 0;
+      info.LastWriteTime.QuadPart = 0;
+    }
+    info.ChangeTime.QuadPart = 0;
+
+    if (error == 0 && !SetFileInformationByHandle(destHandle, FileBasicInfo,
+                                                  &info, sizeof(info))) {
+      error = GetLastError();
+    }
+
+    stats.mode += (flags & PRESERVE_MODE) ? 2 : 0;
+    stats.times += (flags & PRESERVE_TIMES) ? 2 : 0;
+  }
+
+  CloseHandle(srcHandle);
+  CloseHandle(destHandle);
+
+  return error;
+}
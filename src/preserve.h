@@ -0,0 +1,52 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * The kinds of metadata --preserve can copy, as bit flags
+ */
+enum PreserveFlags : DWORD {
+  // Read-only, hidden, system, and archive attributes
+  PRESERVE_MODE = 1,
+  // The owner and primary group
+  PRESERVE_OWNER = 2,
+  // Creation, last access, and last write times
+  PRESERVE_TIMES = 4,
+  // Alternate data streams, such as the Zone.Identifier of downloads
+  PRESERVE_XATTR = 8,
+  // The access control list
+  PRESERVE_ACL = 16,
+};
+
+/**
+ * Parse the value of the --preserve option, a comma separated list of mode,
+ * owner, times, xattr, and acl
+ */
+bool parsePreserve(const std::string &value, DWORD &flags);
+
+/**
+ * How many system calls were made to copy each kind of metadata. A call that
+ * copies more than one kind, such as setting attributes and times together,
+ * is counted for each.
+ */
+struct PreserveStats {
+  ULONGLONG mode = 0;
+  ULONGLONG owner = 0;
+  ULONGLONG times = 0;
+  ULONGLONG xattr = 0;
+  ULONGLONG acl = 0;
+};
+
+/**
+ * Copy the given kinds of metadata from `src` to `dest`, which can be files
+ * or directories. Each side is opened once, and attributes and times are set
+ * together, after the streams, so writing the streams doesn't change the
+ * times. `buffer` is reused for copying streams. Returns 0 or a Windows error
+ * code.
+ */
+DWORD preserveMetadata(const std::wstring &src, const std::wstring &dest,
+                       DWORD flags, std::vector<BYTE> &buffer,
+                       PreserveStats &stats);
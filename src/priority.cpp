@@ -0,0 +1,225 @@
+#include "priority.h"
+
+#include <sstream>
+
+// Set once before any workers start
+static SchedulingPolicy current;
+
+static const int MAX_IO_LEVEL = 7;
+static const int MAX_PROCESSORS = sizeof(DWORD_PTR) * 8;
+
+/**
+ * Parse a number made only of digits in the given base
+ */
+static bool parseDigits(const std::string &value, int base,
+                        unsigned long long &number) {
+  const char *digits = base == 16 ? "0123456789abcdefABCDEF" : "0123456789";
+  if (value.empty() || value.length() > 16 ||
+      value.find_first_not_of(digits) != std::string::npos) {
+    return false;
+  }
+
+  number = std::stoull(value, NULL, base);
+  return true;
+}
+
+bool parseIoPriority(const std::string &value, SchedulingPolicy &policy) {
+  if (value == "idle") {
+    policy.ioPriority = IoPriority::Idle;
+    return true;
+  }
+
+  size_t colon = value.find(':');
+  std::string name = value.substr(0, colon);
+  unsigned long long level = 4;
+
+  if (colon != std::string::npos &&
+      (!parseDigits(value.substr(colon + 1), 10, level) ||
+       level > MAX_IO_LEVEL)) {
+    return false;
+  }
+
+  if (name == "best-effort") {
+    policy.ioPriority = IoPriority::BestEffort;
+  } else if (name == "realtime") {
+    policy.ioPriority = IoPriority::Realtime;
+  } else {
+    return false;
+  }
+
+  policy.ioLevel = (int)level;
+  return true;
+}
+
+bool parseNice(const std::string &value, int &nice) {
+  bool negative = !value.empty() && value[0] == '-';
+  unsigned long long number;
+
+  if (!parseDigits(value.substr(negative ? 1 : 0), 10, number) ||
+      number > (negative ? 20U : 19U)) {
+    return false;
+  }
+
+  nice = negative ? -(int)number : (int)number;
+  return true;
+}
+
+bool parseAffinity(const std::string &value, DWORD_PTR &mask) {
+  mask = 0;
+
+  if (value.rfind("0x", 0) == 0) {
+    unsigned long long number;
+    if (!parseDigits(value.substr(2), 16, number) || number == 0 ||
+        (MAX_PROCESSORS < 64 && number >> MAX_PROCESSORS != 0)) {
+      return false;
+    }
+    mask = (DWORD_PTR)number;
+    return true;
+  }
+
+  std::istringstream ranges(value);
+  std::string range;
+
+  while (std::getline(ranges, range, ',')) {
+    size_t dash = range.find('-');
+    unsigned long long first;
+    unsigned long long last;
+
+    if (!parseDigits(range.substr(0, dash), 10, first)) {
+      return false;
+    }
+    last = first;
+    if (dash != std::string::npos &&
+        !parseDigits(range.substr(dash + 1), 10, last)) {
+      return false;
+    }
+
+    if (first > last || last >= MAX_PROCESSORS) {
+      return false;
+    }
+
+    for (unsigned long long i = first; i <= last; i++) {
+      mask |= (DWORD_PTR)1 << i;
+    }
+  }
+
+  return mask != 0;
+}
+
+/**
+ * Get the process priority class closest to a nice value
+ */
+static DWORD priorityClassFor(int nice) {
+  if (nice <= -15) {
+    return HIGH_PRIORITY_CLASS;
+  } else if (nice < 0) {
+    return ABOVE_NORMAL_PRIORITY_CLASS;
+  } else if (nice == 0) {
+    return NORMAL_PRIORITY_CLASS;
+  } else if (nice < 10) {
+    return BELOW_NORMAL_PRIORITY_CLASS;
+  }
+  return IDLE_PRIORITY_CLASS;
+}
+
+/**
+ * Get the thread priority for a class and level
+ */
+static int threadPriorityFor(const SchedulingPolicy &policy) {
+  static const int bestEffort[MAX_IO_LEVEL + 1] = {
+      THREAD_PRIORITY_HIGHEST,      THREAD_PRIORITY_ABOVE_NORMAL,
+      THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_NORMAL,
+      THREAD_PRIORITY_NORMAL,       THREAD_PRIORITY_BELOW_NORMAL,
+      THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_LOWEST,
+  };
+
+  // Time critical threads doing I/O in a tight loop can starve the rest of
+  // the system, including the threads that complete that I/O
+  if (policy.ioPriority == IoPriority::Realtime) {
+    return THREAD_PRIORITY_HIGHEST;
+  }
+  return bestEffort[policy.ioLevel];
+}
+
+/**
+ * Get the I/O priority hint for a class and level
+ */
+static PRIORITY_HINT ioPriorityHintFor(const SchedulingPolicy &policy) {
+  if (policy.ioPriority == IoPriority::Idle) {
+    return IoPriorityHintVeryLow;
+  } else if (policy.ioPriority == IoPriority::BestEffort &&
+             policy.ioLevel > 4) {
+    return IoPriorityHintLow;
+  }
+  return IoPriorityHintNormal;
+}
+
+/**
+ * Apply the I/O priority and affinity to the calling thread
+ */
+static DWORD applyToThread(const SchedulingPolicy &policy) {
+  HANDLE thread = GetCurrentThread();
+
+  if (policy.ioPriority == IoPriority::Idle) {
+    if (!SetThreadPriority(thread, THREAD_MODE_BACKGROUND_BEGIN)) {
+      return GetLastError();
+    }
+  } else if (policy.ioPriority != IoPriority::Default) {
+    if (!SetThreadPriority(thread, threadPriorityFor(policy))) {
+      return GetLastError();
+    }
+  }
+
+  if (policy.affinity != 0 &&
+      SetThreadAffinityMask(thread, policy.affinity) == 0) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+DWORD setSchedulingPolicy(const SchedulingPolicy &policy) {
+  current = policy;
+
+  // Only processors the process may use can be given to its threads
+  if (current.affinity != 0) {
+    DWORD_PTR processMask;
+    DWORD_PTR systemMask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask,
+                                &systemMask)) {
+      return GetLastError();
+    }
+
+    current.affinity &= processMask;
+    if (current.affinity == 0) {
+      return ERROR_INVALID_PARAMETER;
+    }
+  }
+
+  if (current.nice != 0 &&
+      !SetPriorityClass(GetCurrentProcess(), priorityClassFor(current.nice))) {
+    return GetLastError();
+  }
+
+  return applyToThread(current);
+}
+
+void setIoPriorityHint(HANDLE file) {
+  if (current.ioPriority == IoPriority::Default) {
+    return;
+  }
+
+  // Only a hint, so a file system that doesn't take it still does the I/O
+  FILE_IO_PRIORITY_HINT_INFO hint;
+  hint.PriorityHint = ioPriorityHintFor(current);
+  SetFileInformationByHandle(file, FileIoPriorityHintInfo, &hint,
+                             sizeof(hint));
+}
+
+std::thread startWorker(std::function<void()> work) {
+  return std::thread([work]() {
+    // The settings were checked when they were set on the main thread
+    applyToThread(current);
+    work();
+  });
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "platform.h"
+
+#include <functional>
+#include <string>
+#include <thread>
+
+/**
+ * The I/O scheduling class of the operation's threads
+ */
+enum class IoPriority {
+  // Not set, which leaves threads as they are
+  Default,
+  // Background mode, which makes the thread's I/O very low priority, so it
+  // only gets the disk when nothing else wants it
+  Idle,
+  // A thread priority at or around normal, with low priority I/O for the
+  // lowest levels
+  BestEffort,
+  // The highest thread priority that doesn't starve the system
+  Realtime,
+};
+
+/**
+ * How the operation's threads are scheduled
+ */
+struct SchedulingPolicy {
+  IoPriority ioPriority = IoPriority::Default;
+  // From 0 (highest) to 7 (lowest), within the class
+  int ioLevel = 4;
+  // From -20 (highest) to 19 (lowest), like Unix nice values
+  int nice = 0;
+  // The processors workers may run on, or 0 for any
+  DWORD_PTR affinity = 0;
+};
+
+/**
+ * Parse the value of the --io-priority option: idle, best-effort:N, or
+ * realtime:N, where N is a level from 0 to 7
+ */
+bool parseIoPriority(const std::string &value, SchedulingPolicy &policy);
+
+/**
+ * Parse the value of the --nice option, from -20 to 19
+ */
+bool parseNice(const std::string &value, int &nice);
+
+/**
+ * Parse the value of the --affinity option: a list of processor numbers and
+ * ranges, like 0-3,6, or a hex mask, like 0x4f. Only processors in the first
+ * group of 64 can be used.
+ */
+bool parseAffinity(const std::string &value, DWORD_PTR &mask);
+
+/**
+ * Set how the process and the threads started with startWorker() are
+ * scheduled, and apply it to the calling thread. The nice value sets the
+ * priority class of the whole process. Returns 0 or a Windows error code.
+ */
+DWORD setSchedulingPolicy(const SchedulingPolicy &policy);
+
+/**
+ * Give a file opened for copying, hashing, or comparing the I/O priority set
+ * with setSchedulingPolicy(). Windows only lets a handle's I/O priority be
+ * lowered, so higher levels leave it at normal.
+ */
+void setIoPriorityHint(HANDLE file);
+
+/**
+ * Start a thread that runs `work` with the I/O priority and affinity given
+ * to setSchedulingPolicy()
+ */
+std::thread startWorker(std::function<void()> work);
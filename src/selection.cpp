@@ -0,0 +1,146 @@
+#include "selection.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+// 100ns ticks in a second
+static const ULONGLONG TICKS_PER_SECOND = 10000000;
+
+// Any number this long fits in 64 bits
+static const size_t MAX_DIGITS = 19;
+
+bool Selection::empty() const {
+  return minSize == 0 && maxSize == ~0ULL && newerThan == 0 &&
+         olderThan == ~0ULL && types == 0;
+}
+
+bool Selection::selects(const WIN32_FIND_DATAW &data, bool isLink) const {
+  if (types != 0 && !(types & (isLink ? TYPE_LINK : TYPE_FILE))) {
+    return false;
+  }
+
+  ULONGLONG size = fileSizeOf(data);
+  ULONGLONG time = fileTimeToTicks(data.ftLastWriteTime);
+
+  return size >= minSize && size <= maxSize && time >= newerThan &&
+         time < olderThan;
+}
+
+/**
+ * Split a value into its number and a single letter suffix, if it has one
+ */
+static bool splitNumber(const std::string &value, ULONGLONG &number,
+                        char &suffix) {
+  size_t digits = value.find_first_not_of("0123456789");
+  if (digits == 0 || value.empty() ||
+      std::min(digits, value.size()) > MAX_DIGITS) {
+    return false;
+  }
+
+  suffix = 0;
+  if (digits != std::string::npos) {
+    if (digits + 1 != value.size()) {
+      return false;
+    }
+    suffix = (char)tolower(value[digits]);
+  }
+
+  number = std::stoull(value.substr(0, digits));
+  return true;
+}
+
+bool parseSize(const std::string &value, ULONGLONG &bytes) {
+  ULONGLONG number;
+  char suffix;
+  if (!splitNumber(value, number, suffix)) {
+    return false;
+  }
+
+  const char *units = "kmgt";
+  int shift = 0;
+  if (suffix != 0) {
+    const char *unit = strchr(units, suffix);
+    if (unit == NULL) {
+      return false;
+    }
+    shift = 10 * (int)(unit - units + 1);
+  }
+
+  if (number > ~0ULL >> shift) {
+    return false;
+  }
+
+  bytes = number << shift;
+  return true;
+}
+
+bool parseAge(const std::string &value, ULONGLONG &time) {
+  ULONGLONG number;
+  char suffix;
+  if (!splitNumber(value, number, suffix)) {
+    return false;
+  }
+
+  ULONGLONG seconds;
+  switch (suffix) {
+  case 's':
+    seconds = 1;
+    break;
+  case 'm':
+    seconds = 60;
+    break;
+  case 'h':
+    seconds = 60 * 60;
+    break;
+  case 0:
+  case 'd':
+    seconds = 24 * 60 * 60;
+    break;
+  case 'w':
+    seconds = 7 * 24 * 60 * 60;
+    break;
+  default:
+    return false;
+  }
+
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+
+  if (number > ~0ULL / (seconds * TICKS_PER_SECOND)) {
+    return false;
+  }
+
+  ULONGLONG age = number * seconds * TICKS_PER_SECOND;
+  ULONGLONG current = fileTimeToTicks(now);
+  time = age < current ? current - age : 0;
+
+  return true;
+}
+
+bool parseEntryTypes(const std::string &value, DWORD &types) {
+  types = 0;
+  size_t start = 0;
+
+  while (start <= value.size()) {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+
+    std::string name = value.substr(start, end - start);
+
+    if (name == "f") {
+      types |= TYPE_FILE;
+    } else if (name == "l") {
+      types |= TYPE_LINK;
+    } else {
+      return false;
+    }
+
+    start = end + 1;
+  }
+
+  return types != 0;
+}
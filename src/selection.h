@@ -0,0 +1,55 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+
+/**
+ * The kinds of entry --type can select, as bit flags
+ */
+enum EntryTypes : DWORD {
+  TYPE_FILE = 1,
+  TYPE_LINK = 2,
+};
+
+/**
+ * Which files and links to act on, by size, age, and type. These are checked
+ * against the metadata that comes with each directory listing, so selecting
+ * costs nothing beyond the walk itself. Directories are always walked.
+ */
+struct Selection {
+  ULONGLONG minSize = 0;
+  ULONGLONG maxSize = ~0ULL;
+  // Bounds on the last write time, in 100ns ticks
+  ULONGLONG newerThan = 0;
+  ULONGLONG olderThan = ~0ULL;
+  // A combination of EntryTypes, or 0 for any
+  DWORD types = 0;
+
+  /**
+   * Check if nothing is left out
+   */
+  bool empty() const;
+
+  /**
+   * Check if the given file or link is selected
+   */
+  bool selects(const WIN32_FIND_DATAW &data, bool isLink) const;
+};
+
+/**
+ * Parse a size in bytes, with an optional K, M, G, or T suffix for binary
+ * multiples
+ */
+bool parseSize(const std::string &value, ULONGLONG &bytes);
+
+/**
+ * Parse an age like 30d, with a suffix of s, m, h, d, or w (days when there's
+ * none), and get the time that long before now, in 100ns ticks
+ */
+bool parseAge(const std::string &value, ULONGLONG &time);
+
+/**
+ * Parse the value of the --type option, a comma separated list of f and l
+ */
+bool parseEntryTypes(const std::string &value, DWORD &types);
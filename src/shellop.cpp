@@ -0,0 +1,92 @@
+#include "shellop.h"
+
+#pragma comment(lib, "Shell32.lib")
+
+/**
+ * Convert an std::string to LPCWSTR
+ * See https://stackoverflow.com/a/27296
+ */
+LPWSTR stringToLpwstr(const std::string &str) {
+  int stringLength = (int)str.length() + 1;
+
+  // The first call with a 0 target string returns the buffer length needed
+  int bufferLength = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, 0, 0);
+
+  wchar_t *buffer = new wchar_t[bufferLength];
+
+  // The second call actually does the conversion
+  MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, buffer, bufferLength);
+
+  return buffer;
+}
+
+/**
+ * Combine the given file names into a single LPWSTR string, with a null
+ * terminator character used as separator, with double null terminators at the
+ * end of the string.
+ * All this to create a string for pFrom and pTo in the SHFILEOPSTRUCT:
+ *   https://docs.microsoft.com/en-us/windows/win32/api/shellapi/ns-shellapi-shfileopstructw#members
+ */
+LPWSTR combileFileNames(const std::vector<std::string> &files) {
+  // Combine the file names into an std::string with '\t' as separator
+  std::string combinedStr = "";
+  for (std::string file : files) {
+    combinedStr += file + "\t";
+  }
+
+  // Convert the combined string to LPWSTR
+  LPWSTR combined = stringToLpwstr(combinedStr);
+
+  // Replace each '\t' separator with a null terminator '\0'
+  int length = wcslen(combined);
+  for (int i = 0; i < length; i++) {
+    if (combined[i] == L'\t') {
+      combined[i] = L'\0';
+    }
+  }
+
+  return combined;
+}
+
+/**
+ * Run SHFileOperation with the given paths and return its status
+ */
+int runShellOperation(const std::string &action,
+                      const std::vector<std::string> &srcPaths,
+                      const std::vector<std::string> &destPaths,
+                      bool multipleDestinations, BOOL &wasAborted,
+                      FILEOP_FLAGS extraFlags) {
+  SHFILEOPSTRUCTW op;
+
+  // Set the file flags
+  op.fFlags = FOF_ALLOWUNDO | FOF_NOCONFIRMMKDIR | FOF_WANTNUKEWARNING;
+  op.fFlags = op.fFlags | extraFlags;
+  if (multipleDestinations) {
+    op.fFlags = op.fFlags | FOF_MULTIDESTFILES;
+  }
+
+  // Set the source
+  LPWSTR pFrom = combileFileNames(srcPaths);
+  op.pFrom = pFrom;
+
+  // Set the destination
+  LPWSTR pTo = combileFileNames(destPaths);
+  op.pTo = pTo;
+
+  // Set the action
+  if (action == "copy") {
+    op.wFunc = FO_COPY;
+  } else if (action == "move") {
+    op.wFunc = FO_MOVE;
+  } else if (action == "delete") {
+    op.wFunc = FO_DELETE;
+  }
+
+  int status = SHFileOperationW(&op);
+  wasAborted = op.fAnyOperationsAborted;
+
+  delete[] pFrom;
+  delete[] pTo;
+
+  return status;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "platform.h"
+
+// clang-format off
+#include <shellapi.h>
+// clang-format on
+
+#include <string>
+#include <vector>
+
+/**
+ * Convert an std::string to LPCWSTR. The result must be freed with delete[].
+ */
+LPWSTR stringToLpwstr(const std::string &str);
+
+/**
+ * Combine the given file names into a double null-terminated list, as used by
+ * SHFileOperation. The result must be freed with delete[].
+ */
+LPWSTR combileFileNames(const std::vector<std::string> &files);
+
+/**
+ * Run SHFileOperation with the given paths and return its status. The given
+ * flags are added to the ones always used.
+ */
+int runShellOperation(const std::string &action,
+                      const std::vector<std::string> &srcPaths,
+                      const std::vector<std::string> &destPaths,
+                      bool multipleDestinations, BOOL &wasAborted,
+                      FILEOP_FLAGS extraFlags = 0);
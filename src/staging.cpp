@@ -0,0 +1,201 @@
+#include "staging.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+
+/**
+ * Get the hidden staging directory used for the given final destination
+ */
+static std::wstring stagingDirFor(const std::wstring &dest) {
+  return joinPath(parentPath(dest),
+                  L".fileops-" + std::to_wstring(GetCurrentProcessId()));
+}
+
+DWORD stageTargets(const std::string &action, const std::vector<Target> &targets,
+                   std::vector<Target> &staged) {
+  staged = targets;
+
+  for (Target &target : staged) {
+    // A move within a volume is a rename, which readers already see
+    // atomically, so there's nothing to gain from staging it
+    if (action == "move" && isSameVolume(target.src, target.dest)) {
+      continue;
+    }
+
+    std::wstring stagingDir = stagingDirFor(target.dest);
+
+    DWORD error = createDirectories(stagingDir);
+    if (error != 0) {
+      return error;
+    }
+
+    SetFileAttributesW(stagingDir.c_str(), FILE_ATTRIBUTE_HIDDEN);
+
+    target.dest = joinPath(stagingDir, baseName(target.dest));
+  }
+
+  return 0;
+}
+
+/**
+ * Rename the given staged file into its final place, creating its parent
+ * directory if needed
+ */
+static DWORD publishFile(const std::wstring &stagedPath,
+                         const std::wstring &finalPath) {
+  if (MoveFileExW(stagedPath.c_str(), finalPath.c_str(),
+                  MOVEFILE_REPLACE_EXISTING)) {
+    return 0;
+  }
+
+  DWORD error = GetLastError();
+  if (error != ERROR_PATH_NOT_FOUND) {
+    return error;
+  }
+
+  error = createDirectories(parentPath(finalPath));
+  if (error != 0) {
+    return error;
+  }
+
+  return MoveFileExW(stagedPath.c_str(), finalPath.c_str(),
+                     MOVEFILE_REPLACE_EXISTING)
+             ? 0
+             : GetLastError();
+}
+
+/**
+ * Publish the files in the staged tree for which `shouldPublish` returns true,
+ * given the path relative to the staged root. When `includeDirectories` is set,
+ * empty directories are recreated too.
+ */
+static DWORD publishTree(
+    const std::wstring &stagedRoot, const std::wstring &finalRoot,
+    bool includeDirectories,
+    const std::function<bool(const std::wstring &relative)> &shouldPublish) {
+  std::vector<std::wstring> files;
+  std::vector<std::wstring> dirs;
+
+  // List everything first, so the tree isn't changing while it's being read
+  DWORD error = walkTree(stagedRoot, [&](const std::wstring &path,
+                                         const WIN32_FIND_DATAW &data) {
+    std::wstring relative = path.substr(stagedRoot.length());
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      dirs.push_back(relative);
+    } else {
+      files.push_back(relative);
+    }
+    return true;
+  });
+  if (error != 0) {
+    return error == ERROR_FILE_NOT_FOUND ? 0 : error;
+  }
+
+  if (includeDirectories) {
+    for (const std::wstring &relative : dirs) {
+      error = createDirectories(finalRoot + relative);
+      if (error != 0) {
+        return error;
+      }
+    }
+  }
+
+  for (const std::wstring &relative : files) {
+    if (!shouldPublish(relative)) {
+      continue;
+    }
+
+    error = publishFile(stagedRoot + relative, finalRoot + relative);
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  return 0;
+}
+
+DWORD publishTargets(const std::vector<Target> &targets,
+                     const std::vector<Target> &staged) {
+  for (size_t i = 0; i < targets.size(); i++) {
+    const std::wstring &stagedPath = staged[i].dest;
+    const std::wstring &finalPath = targets[i].dest;
+
+    if (stagedPath == finalPath) {
+      continue;
+    }
+
+    // A new file or directory appears complete with one rename. Only an
+    // existing directory needs its contents published one by one.
+    DWORD finalAttributes = GetFileAttributesW(finalPath.c_str());
+    if (finalAttributes == INVALID_FILE_ATTRIBUTES ||
+        !(finalAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      DWORD error = publishFile(stagedPath, finalPath);
+      if (error != 0) {
+        return error;
+      }
+      continue;
+    }
+
+    DWORD error = publishTree(stagedPath, finalPath, true,
+                              [](const std::wstring &) { return true; });
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  return 0;
+}
+
+DWORD discardStaging(const std::string &action,
+                     const std::vector<Target> &targets,
+                     const std::vector<Target> &staged,
+                     std::vector<std::wstring> &kept) {
+  DWORD firstError = 0;
+  std::set<std::wstring> failed;
+
+  // Explorer only deletes a moved file's source once it has been copied in
+  // full, so a staged file without a source is complete
+  if (action == "move") {
+    for (size_t i = 0; i < targets.size(); i++) {
+      const Target &target = targets[i];
+
+      if (staged[i].dest == target.dest) {
+        continue;
+      }
+
+      DWORD error = publishTree(staged[i].dest, target.dest, false,
+                                [&](const std::wstring &relative) {
+                                  return GetFileAttributesW(
+                                             (target.src + relative).c_str()) ==
+                                         INVALID_FILE_ATTRIBUTES;
+                                });
+
+      // The staged copy may be the only one left, so it stays where it is
+      if (error != 0) {
+        failed.insert(stagingDirFor(target.dest));
+        if (firstError == 0) {
+          firstError = error;
+        }
+      }
+    }
+  }
+
+  // Targets can share a staging directory, so only remove them once every
+  // target has been dealt with
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (staged[i].dest == targets[i].dest) {
+      continue;
+    }
+
+    std::wstring stagingDir = stagingDirFor(targets[i].dest);
+    if (failed.count(stagingDir) == 0) {
+      removeTree(stagingDir);
+    } else if (std::find(kept.begin(), kept.end(), stagingDir) == kept.end()) {
+      kept.push_back(stagingDir);
+    }
+  }
+
+  return firstError;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Work out where each target should be written before it's published, and
+ * create the hidden staging directories for them. Staging directories sit
+ * next to the final destination so publishing is a rename on the same volume.
+ * Targets that already appear atomically (moves within a volume) keep their
+ * destination. Returns 0 or a Windows error code.
+ */
+DWORD stageTargets(const std::string &action, const std::vector<Target> &targets,
+                   std::vector<Target> &staged);
+
+/**
+ * Move each staged target into its final place. A directory that doesn't exist
+ * yet is published with a single rename, otherwise each file is renamed into
+ * place on its own, replacing any existing file.
+ * Returns 0 or a Windows error code.
+ */
+DWORD publishTargets(const std::vector<Target> &targets,
+                     const std::vector<Target> &staged);
+
+/**
+ * Remove the staging directories and anything left in them. For a move that
+ * didn't finish, files whose source is already gone are published first,
+ * since the staged copy is the only one left. A staging directory whose files
+ * couldn't be published is kept, and added to `kept`, so nothing is lost.
+ * Returns 0 or the first Windows error code from publishing.
+ */
+DWORD discardStaging(const std::string &action,
+                     const std::vector<Target> &targets,
+                     const std::vector<Target> &staged,
+                     std::vector<std::wstring> &kept);
@@ -0,0 +1,351 @@
+#include "sync.h"
+#include "priority.h"
+#include "shellop.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// 100ns ticks in a millisecond
+static const ULONGLONG TICKS_PER_MILLISECOND = 10000;
+
+// Milliseconds this long still fit in 64 bits as ticks
+static const size_t MAX_TOLERANCE_DIGITS = 15;
+
+/**
+ * Directories waiting to be compared, shared by the worker threads. New
+ * directories are taken from the back, so the walk goes depth first and the
+ * queue stays small.
+ */
+struct SyncQueue {
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<Target> pending;
+  size_t busy = 0;
+  DWORD error = 0;
+};
+
+/**
+ * The settings and shared state every directory comparison uses
+ */
+struct SyncContext {
+  ULONGLONG mtimeTolerance;
+  bool mirror;
+  FileIndex *index;
+  // Whether destination entries are looked up in the index instead of
+  // listed. Otherwise, the index is updated from the listings.
+  bool useIndex;
+  std::mutex indexMutex;
+};
+
+bool parseTolerance(const std::string &value, ULONGLONG &ticks) {
+  if (value.empty() || value.size() > MAX_TOLERANCE_DIGITS ||
+      value.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+
+  ticks = std::stoull(value) * TICKS_PER_MILLISECOND;
+  return true;
+}
+
+/**
+ * Check if a destination entry is out of date with its source entry
+ */
+static bool differs(const WIN32_FIND_DATAW &src, const WIN32_FIND_DATAW &dest,
+                    ULONGLONG mtimeTolerance) {
+  if (isWalkableDirectory(src) != isWalkableDirectory(dest)) {
+    return true;
+  }
+
+  if (isWalkableDirectory(src)) {
+    return false;
+  }
+
+  ULONGLONG srcTime = fileTimeToTicks(src.ftLastWriteTime);
+  ULONGLONG destTime = fileTimeToTicks(dest.ftLastWriteTime);
+  ULONGLONG delta = srcTime > destTime ? srcTime - destTime : destTime - srcTime;
+
+  return fileSizeOf(src) != fileSizeOf(dest) || delta > mtimeTolerance;
+}
+
+/**
+ * Get what the index knows about a destination entry, in the same shape as a
+ * listing entry
+ */
+static bool findInIndex(const FileIndex &index, const std::wstring &dir,
+                        const WIN32_FIND_DATAW &src, WIN32_FIND_DATAW &dest) {
+  IndexEntry entry;
+  if (!index.find(joinPath(dir, src.cFileName), entry)) {
+    return false;
+  }
+
+  ZeroMemory(&dest, sizeof(dest));
+  dest.dwFileAttributes = entry.attributes;
+  dest.ftLastWriteTime.dwLowDateTime = (DWORD)entry.lastWriteTime;
+  dest.ftLastWriteTime.dwHighDateTime = (DWORD)(entry.lastWriteTime >> 32);
+  dest.nFileSizeLow = (DWORD)entry.size;
+  dest.nFileSizeHigh = (DWORD)(entry.size >> 32);
+  memcpy(dest.cFileName, src.cFileName, sizeof(dest.cFileName));
+
+  return true;
+}
+
+/**
+ * Record a listed destination entry in the index
+ */
+static DWORD addToIndex(FileIndex &index, const std::wstring &path,
+                        const WIN32_FIND_DATAW &data) {
+  IndexEntry entry;
+  entry.size = fileSizeOf(data);
+  entry.lastWriteTime = fileTimeToTicks(data.ftLastWriteTime);
+  entry.attributes = data.dwFileAttributes;
+
+  return index.put(path, entry);
+}
+
+DWORD removeFromDestination(const std::vector<std::wstring> &paths,
+                            FileIndex *index, ULONGLONG &removed,
+                            BOOL &wasAborted) {
+  removed = 0;
+  wasAborted = FALSE;
+  if (paths.empty()) {
+    return 0;
+  }
+
+  // The only walk of the removed items, which counts them and takes them out
+  // of the index. Explorer does the removing.
+  std::vector<std::string> shellPaths;
+  for (const std::wstring &path : paths) {
+    DWORD error = walkTree(
+        path, [&](const std::wstring &entry, const WIN32_FIND_DATAW &) {
+          if (index != NULL) {
+            index->erase(entry);
+          }
+          removed++;
+          return true;
+        });
+
+    // Something else may have removed it since the plan was made
+    if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) {
+      continue;
+    } else if (error != 0) {
+      return error;
+    }
+
+    shellPaths.push_back(toUtf8(path));
+  }
+
+  if (shellPaths.empty()) {
+    return 0;
+  }
+
+  return runShellOperation("delete", shellPaths, std::vector<std::string>(),
+                           false, wasAborted, FOF_NOCONFIRMATION);
+}
+
+/**
+ * Compare the listings of a source directory and its destination. Both are
+ * sorted by name and walked together, so each entry is matched in a single
+ * pass. Directories on both sides are added to `subdirs` to be compared next.
+ * When mirroring, entries to remove from the destination are added to
+ * `replaced` and `extras`. With an index, the destination's entries come
+ * from the index instead of a listing.
+ */
+static DWORD compareDirectory(const Target &dir, SyncContext &context,
+                              std::vector<Target> &copies,
+                              std::vector<Target> &subdirs,
+                              std::vector<std::wstring> &replaced,
+                              std::vector<std::wstring> &extras) {
+  std::vector<WIN32_FIND_DATAW> srcEntries;
+  std::vector<WIN32_FIND_DATAW> destEntries;
+
+  DWORD error = listDirectory(dir.src, srcEntries);
+  if (error != 0) {
+    return error;
+  }
+
+  sortByName(srcEntries);
+
+  if (context.useIndex) {
+    WIN32_FIND_DATAW dest;
+    for (const WIN32_FIND_DATAW &src : srcEntries) {
+      if (findInIndex(*context.index, dir.dest, src, dest)) {
+        destEntries.push_back(dest);
+      }
+    }
+  } else {
+    error = listDirectory(dir.dest, destEntries);
+    if (error != 0) {
+      return error;
+    }
+
+    sortByName(destEntries);
+  }
+
+  if (context.index != NULL && !context.useIndex) {
+    std::lock_guard<std::mutex> lock(context.indexMutex);
+    for (const WIN32_FIND_DATAW &dest : destEntries) {
+      error = addToIndex(*context.index, joinPath(dir.dest, dest.cFileName),
+                         dest);
+      if (error != 0) {
+        return error;
+      }
+    }
+  }
+
+  size_t i = 0;
+  size_t j = 0;
+
+  while (error == 0 && (i < srcEntries.size() || j < destEntries.size())) {
+    int order = i == srcEntries.size()    ? 1
+                : j == destEntries.size() ? -1
+                                          : compareNames(srcEntries[i].cFileName,
+                                                         destEntries[j].cFileName);
+
+    if (order > 0) {
+      if (context.mirror) {
+        extras.push_back(joinPath(dir.dest, destEntries[j].cFileName));
+      }
+      j++;
+      continue;
+    }
+
+    const WIN32_FIND_DATAW &src = srcEntries[i];
+
+    Target item;
+    item.src = joinPath(dir.src, src.cFileName);
+    item.dest = joinPath(dir.dest, src.cFileName);
+
+    if (order < 0) {
+      copies.push_back(item);
+    } else if (differs(src, destEntries[j], context.mtimeTolerance)) {
+      // A file can't be copied over a directory or the other way around, so
+      // when mirroring, whatever is in the way goes first
+      if (context.mirror && isWalkableDirectory(src) !=
+                                isWalkableDirectory(destEntries[j])) {
+        replaced.push_back(item.dest);
+      }
+      copies.push_back(item);
+    } else if (isWalkableDirectory(src)) {
+      subdirs.push_back(item);
+    }
+
+    i++;
+    if (order == 0) {
+      j++;
+    }
+  }
+
+  return error;
+}
+
+DWORD planSync(const std::vector<Target> &targets, ULONGLONG mtimeTolerance,
+               bool mirror, FileIndex *index, SyncPlan &plan) {
+  SyncQueue queue;
+  SyncContext context;
+  context.mtimeTolerance = mtimeTolerance;
+  context.mirror = mirror;
+  context.index = index;
+
+  // Mirroring has to list the destination to find what to remove, and an
+  // empty index has to be filled from the listings first
+  context.useIndex = index != NULL && !mirror && !index->empty();
+
+  // Targets are compared like the entries of a directory, except that each
+  // one is looked up on its own
+  for (const Target &target : targets) {
+    WIN32_FIND_DATAW src;
+    WIN32_FIND_DATAW dest;
+
+    if (!statPath(target.src, src)) {
+      return GetLastError();
+    }
+
+    bool destExists = statPath(target.dest, dest);
+
+    if (destExists && index != NULL) {
+      DWORD error = addToIndex(*index, target.dest, dest);
+      if (error != 0) {
+        return error;
+      }
+    }
+
+    if (!destExists || differs(src, dest, mtimeTolerance)) {
+      if (mirror && destExists &&
+          isWalkableDirectory(src) != isWalkableDirectory(dest)) {
+        plan.replaced.push_back(target.dest);
+      }
+      plan.copies.push_back(target);
+    } else if (isWalkableDirectory(src)) {
+      queue.pending.push_back(target);
+    }
+  }
+
+  auto worker = [&]() {
+    std::vector<Target> copies;
+    std::vector<Target> subdirs;
+    std::vector<std::wstring> replaced;
+    std::vector<std::wstring> extras;
+
+    std::unique_lock<std::mutex> lock(queue.mutex);
+
+    while (true) {
+      queue.changed.wait(lock, [&]() {
+        return !queue.pending.empty() || queue.busy == 0 || queue.error != 0;
+      });
+
+      if (queue.pending.empty() || queue.error != 0) {
+        break;
+      }
+
+      Target dir = queue.pending.back();
+      queue.pending.pop_back();
+      queue.busy++;
+      lock.unlock();
+
+      copies.clear();
+      subdirs.clear();
+      replaced.clear();
+      extras.clear();
+      DWORD error =
+          compareDirectory(dir, context, copies, subdirs, replaced, extras);
+
+      lock.lock();
+      queue.busy--;
+
+      if (error != 0 && queue.error == 0) {
+        queue.error = error;
+      }
+
+      plan.copies.insert(plan.copies.end(), copies.begin(), copies.end());
+      plan.replaced.insert(plan.replaced.end(), replaced.begin(),
+                           replaced.end());
+      plan.extras.insert(plan.extras.end(), extras.begin(), extras.end());
+      queue.pending.insert(queue.pending.end(), subdirs.begin(), subdirs.end());
+      queue.changed.notify_all();
+    }
+  };
+
+  size_t threadCount = std::max(1U, std::thread::hardware_concurrency());
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i++) {
+    threads.push_back(startWorker(worker));
+  }
+  worker();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // Threads finish directories in any order, so sort the copies to keep the
+  // operation the same from run to run
+  std::sort(plan.copies.begin(), plan.copies.end(),
+            [](const Target &a, const Target &b) { return a.src < b.src; });
+  std::sort(plan.replaced.begin(), plan.replaced.end());
+  std::sort(plan.extras.begin(), plan.extras.end());
+
+  return queue.error;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "index.h"
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * What a sync needs to do to bring each destination up to date with its
+ * source
+ */
+struct SyncPlan {
+  // The items that are missing or different at the destination, with the
+  // exact path each one is copied to. Missing directories are copied whole.
+  std::vector<Target> copies;
+  // When mirroring, destination items in the way of a copy, like a file
+  // where the source has a directory, to remove before copying
+  std::vector<std::wstring> replaced;
+  // When mirroring, destination items that aren't in the source, to remove
+  // once everything is copied
+  std::vector<std::wstring> extras;
+};
+
+/**
+ * Parse the value of the --mtime-tolerance option, in milliseconds, into
+ * 100ns ticks
+ */
+bool parseTolerance(const std::string &value, ULONGLONG &ticks);
+
+/**
+ * Compare each target with its destination and work out what needs copying.
+ * Files are the same when their sizes match and their modification times are
+ * within the given tolerance. Directories are compared from several threads
+ * at once, using the sizes and times from each directory's listing instead of
+ * looking up every file. With `mirror`, items at the destination that would
+ * have to be removed are added to the plan, but nothing is removed. With an
+ * `index`, destinations are looked up in it instead of listed, or when it's
+ * empty or mirroring, it's filled in from the listings. Returns 0 or a
+ * Windows error code.
+ */
+DWORD planSync(const std::vector<Target> &targets, ULONGLONG mtimeTolerance,
+               bool mirror, FileIndex *index, SyncPlan &plan);
+
+/**
+ * Remove the given destination items, through the Recycle Bin where the
+ * volume has one, and take them and everything in them out of the index, if
+ * there is one. `removed` is set to the number of files and directories
+ * removed. Returns 0 or a Windows error code.
+ */
+DWORD removeFromDestination(const std::vector<std::wstring> &paths,
+                            FileIndex *index, ULONGLONG &removed,
+                            BOOL &wasAborted);
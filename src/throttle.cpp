@@ -0,0 +1,249 @@
+#include "throttle.h"
+#include "selection.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// Each thread takes this fraction of a second's worth of tokens at a time and
+// spends them from its own cache, so threads rarely meet on the bucket's lock
+static const ULONGLONG CACHE_FRACTION = 100;
+
+static const DWORD PIPE_BUFFER_SIZE = 4096;
+
+/**
+ * The tokens a thread has taken from a bucket but not spent yet
+ */
+struct TokenCache {
+  ULONGLONG tokens = 0;
+  ULONGLONG generation = 0;
+};
+
+// One cache for each bucket
+static thread_local TokenCache caches[2];
+
+static LONGLONG currentTicks() {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return now.QuadPart;
+}
+
+static double ticksPerSecond() {
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  return (double)frequency.QuadPart;
+}
+
+/**
+ * A token bucket that refills at a fixed rate and holds up to a second's
+ * worth. Tokens are handed out even when it's empty, and the taker sleeps off
+ * the debt, so waiting threads are served in turn without polling.
+ */
+class TokenBucket {
+public:
+  explicit TokenBucket(size_t cache) : cache(cache) {}
+
+  void setRate(ULONGLONG perSecond) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rate = perSecond;
+    tokens = 0;
+    lastRefill = currentTicks();
+    // Tokens cached at the old rate could let threads run ahead of the new one
+    generation++;
+  }
+
+  ULONGLONG getRate() const { return rate; }
+
+  void take(ULONGLONG amount) {
+    ULONGLONG perSecond = rate;
+    if (perSecond == 0 || amount == 0) {
+      return;
+    }
+
+    TokenCache &cached = caches[cache];
+    ULONGLONG current = generation;
+    if (cached.generation != current) {
+      cached.tokens = 0;
+      cached.generation = current;
+    }
+
+    if (cached.tokens >= amount) {
+      cached.tokens -= amount;
+      return;
+    }
+
+    amount -= cached.tokens;
+    cached.tokens = 0;
+
+    ULONGLONG batch = std::max(amount, perSecond / CACHE_FRACTION);
+    double wait = 0;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      LONGLONG now = currentTicks();
+      tokens = std::min(tokens + (now - lastRefill) * (double)perSecond /
+                                     frequency,
+                        (double)perSecond);
+      lastRefill = now;
+
+      tokens -= batch;
+      if (tokens < 0) {
+        wait = -tokens / perSecond;
+      }
+    }
+
+    cached.tokens = batch - amount;
+
+    // Waits under a millisecond stay owed, and are slept off with the next
+    if (wait >= 0.001) {
+      Sleep((DWORD)(wait * 1000));
+    }
+  }
+
+private:
+  // Which of each thread's caches belongs to this bucket
+  size_t cache;
+  std::atomic<ULONGLONG> rate{0};
+  std::atomic<ULONGLONG> generation{0};
+  std::mutex mutex;
+  // Negative when more has been handed out than has come in
+  double tokens = 0;
+  LONGLONG lastRefill = currentTicks();
+  double frequency = ticksPerSecond();
+};
+
+static TokenBucket bytesBucket(0);
+static TokenBucket operationsBucket(1);
+
+void setBandwidthLimit(ULONGLONG bytesPerSecond) {
+  bytesBucket.setRate(bytesPerSecond);
+}
+
+void setIopsLimit(ULONGLONG operationsPerSecond) {
+  operationsBucket.setRate(operationsPerSecond);
+}
+
+void throttleIo(ULONGLONG bytes, ULONGLONG operations) {
+  operationsBucket.take(operations);
+  bytesBucket.take(bytes);
+}
+
+bool parseCount(const std::string &value, ULONGLONG &count) {
+  if (value.empty() ||
+      value.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+
+  count = 0;
+  for (char digit : value) {
+    if (count > (ULLONG_MAX - (digit - '0')) / 10) {
+      return false;
+    }
+    count = count * 10 + (digit - '0');
+  }
+
+  return true;
+}
+
+/**
+ * Run one command from the control channel and get its reply
+ */
+static std::string runCommand(const std::string &line) {
+  std::istringstream words(line);
+  std::string command;
+  std::string value;
+  words >> command >> value;
+
+  ULONGLONG number;
+
+  // This runs on the pipe's own thread, where anything thrown would end the
+  // whole process
+  try {
+    if (command == "bwlimit" && parseSize(value, number)) {
+      setBandwidthLimit(number);
+    } else if (command == "iops-limit" && parseCount(value, number)) {
+      setIopsLimit(number);
+    } else if (command == "limits") {
+      return "ok bwlimit " + std::to_string(bytesBucket.getRate()) +
+             " iops-limit " + std::to_string(operationsBucket.getRate());
+    } else {
+      return "error: unknown command: " + line;
+    }
+  } catch (const std::exception &) {
+    return "error: invalid value: " + line;
+  }
+
+  return "ok";
+}
+
+/**
+ * Answer the commands from one client until it disconnects
+ */
+static void serveClient(HANDLE pipe) {
+  char buffer[PIPE_BUFFER_SIZE];
+  std::string pending;
+  DWORD read = 0;
+
+  while (ReadFile(pipe, buffer, sizeof(buffer), &read, NULL) && read > 0) {
+    pending.append(buffer, read);
+
+    size_t end;
+    while ((end = pending.find('\n')) != std::string::npos) {
+      std::string line = pending.substr(0, end);
+      pending.erase(0, end + 1);
+
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (line.empty()) {
+        continue;
+      }
+
+      std::string reply = runCommand(line) + "\n";
+      DWORD written = 0;
+      WriteFile(pipe, reply.data(), (DWORD)reply.size(), &written, NULL);
+    }
+  }
+
+  // A last command without a newline, from a client that only writes
+  if (!pending.empty()) {
+    runCommand(pending);
+  }
+}
+
+static HANDLE createPipe(const std::wstring &path) {
+  return CreateNamedPipeW(
+      path.c_str(), PIPE_ACCESS_DUPLEX,
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT |
+          PIPE_REJECT_REMOTE_CLIENTS,
+      1, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, NULL);
+}
+
+DWORD startControlChannel(const std::wstring &name) {
+  std::wstring path = L"\\\\.\\pipe\\" + name;
+
+  // The pipe is created here, so a name that's taken fails the operation
+  // before it starts
+  HANDLE pipe = createPipe(path);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  // Clients are served one at a time for as long as the process runs
+  std::thread([pipe]() {
+    while (ConnectNamedPipe(pipe, NULL) ||
+           GetLastError() == ERROR_PIPE_CONNECTED) {
+      serveClient(pipe);
+      FlushFileBuffers(pipe);
+      DisconnectNamedPipe(pipe);
+    }
+    CloseHandle(pipe);
+  }).detach();
+
+  return 0;
+}
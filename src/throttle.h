@@ -0,0 +1,41 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+
+/**
+ * Limit the bytes per second read and written by the built-in copier and its
+ * workers. 0 removes the limit.
+ */
+void setBandwidthLimit(ULONGLONG bytesPerSecond);
+
+/**
+ * Limit the read and write calls per second made by the built-in copier and
+ * its workers. 0 removes the limit.
+ */
+void setIopsLimit(ULONGLONG operationsPerSecond);
+
+/**
+ * Parse a plain count without a suffix, like the value of --iops-limit
+ */
+bool parseCount(const std::string &value, ULONGLONG &count);
+
+/**
+ * Wait until the limits allow `operations` read or write calls moving `bytes`
+ * bytes in total. Returns straight away when there are no limits.
+ */
+void throttleIo(ULONGLONG bytes, ULONGLONG operations = 1);
+
+/**
+ * Serve the named pipe \\.\pipe\<name> on a background thread, so the limits
+ * can be changed while an operation runs. Each line sent to the pipe is a
+ * command, answered with a line starting with `ok` or `error`:
+ *
+ *   bwlimit <bytes>      like --bwlimit, with 0 for no limit
+ *   iops-limit <count>   like --iops-limit, with 0 for no limit
+ *   limits               print the current limits
+ *
+ * Returns 0 or a Windows error code, such as when the pipe is already in use.
+ */
+DWORD startControlChannel(const std::wstring &name);
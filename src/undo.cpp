@@ -0,0 +1,625 @@
+#include "undo.h"
+#include "shellop.h"
+#include "walker.h"
+
+// clang-format off
+#include <sddl.h>
+#include <shlobj.h>
+// clang-format on
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+static const char UNDO_MAGIC[8] = {'F', 'O', 'P', 'S', 'U', 'N', 'D', 'O'};
+static const DWORD UNDO_VERSION = 1;
+
+// Only this many of the most recent logs are kept
+static const size_t MAX_UNDO_LOGS = 50;
+
+enum UndoAction : DWORD {
+  UNDO_COPY = 1,
+  UNDO_MOVE = 2,
+  UNDO_DELETE = 3,
+};
+
+struct UndoHeader {
+  char magic[8];
+  DWORD version;
+  DWORD action;
+  ULONGLONG startTime;
+  DWORD entryCount;
+  DWORD nameCount;
+};
+
+// Each path component in the name table points at the one before it, so
+// paths that share a parent directory only store it once. Indexes are offset
+// by one so that zero means no parent.
+struct UndoName {
+  DWORD parent;
+  DWORD length;
+};
+
+struct UndoEntry {
+  DWORD src;
+  DWORD dest;
+};
+
+/**
+ * A deleted item found in the Recycle Bin
+ */
+struct RecycledItem {
+  std::wstring infoPath;
+  std::wstring dataPath;
+  ULONGLONG deletedAt;
+};
+
+static bool pathExists(const std::wstring &path) {
+  return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+static std::wstring toUpper(const std::wstring &str) {
+  std::wstring upper = str;
+  if (!upper.empty()) {
+    CharUpperBuffW(&upper[0], (DWORD)upper.length());
+  }
+  return upper;
+}
+
+/**
+ * Get the directory undo logs are kept in, creating it if needed
+ */
+static DWORD undoDirectory(std::wstring &dir) {
+  wchar_t appData[MAX_PATH];
+  HRESULT result =
+      SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA | CSIDL_FLAG_CREATE, NULL,
+                       SHGFP_TYPE_CURRENT, appData);
+  if (FAILED(result)) {
+    return HRESULT_CODE(result);
+  }
+
+  dir = joinPath(appData, L"FileOps\\undo");
+  return createDirectories(dir);
+}
+
+/**
+ * Add the given path to the name table, and return its index plus one
+ */
+static DWORD addName(const std::wstring &path,
+                     std::map<std::pair<DWORD, std::wstring>, DWORD> &indexes,
+                     std::vector<std::pair<DWORD, std::wstring>> &names) {
+  if (path.empty()) {
+    return 0;
+  }
+
+  DWORD parent = 0;
+  size_t start = 0;
+
+  while (true) {
+    size_t end = path.find(L'\\', start);
+    std::wstring component = path.substr(
+        start, end == std::wstring::npos ? std::wstring::npos : end - start);
+
+    std::pair<DWORD, std::wstring> key(parent, component);
+    auto found = indexes.find(key);
+    if (found == indexes.end()) {
+      names.push_back(key);
+      found = indexes.insert(std::make_pair(key, (DWORD)names.size())).first;
+    }
+    parent = found->second;
+
+    if (end == std::wstring::npos) {
+      return parent;
+    }
+    start = end + 1;
+  }
+}
+
+/**
+ * Rebuild the path at the given name table index plus one
+ */
+static std::wstring pathAt(DWORD index,
+                           const std::vector<std::pair<DWORD, std::wstring>> &names) {
+  std::wstring path;
+
+  while (index != 0 && index <= names.size()) {
+    const std::pair<DWORD, std::wstring> &name = names[index - 1];
+    path = path.empty() ? name.second : name.second + L"\\" + path;
+
+    // Parents are always added before their children
+    if (name.first >= index) {
+      break;
+    }
+    index = name.first;
+  }
+
+  return path;
+}
+
+std::wstring newJobId() {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+
+  std::wstringstream id;
+  id << std::hex << fileTimeToTicks(now) << L"-" << GetCurrentProcessId();
+  return id.str();
+}
+
+// Items the job sends to the Recycle Bin are found by being deleted after
+// this, including any removed before prepare() is called
+bool isValidJobId(const std::wstring &jobId) {
+  if (jobId.empty()) {
+    return false;
+  }
+
+  for (wchar_t c : jobId) {
+    if (!(c >= L'a' && c <= L'z') && !(c >= L'A' && c <= L'Z') &&
+        !(c >= L'0' && c <= L'9') && c != L'-' && c != L'_') {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+UndoLog::UndoLog() {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  startTime = fileTimeToTicks(now);
+}
+
+DWORD UndoLog::prepare(const std::string &action,
+                       const std::vector<Target> &targets) {
+  this->action = action;
+
+  for (const Target &target : targets) {
+    Target entry = target;
+    if (action == "delete") {
+      entry.dest.clear();
+    }
+
+    DWORD destAttributes = action == "delete"
+                               ? INVALID_FILE_ATTRIBUTES
+                               : GetFileAttributesW(target.dest.c_str());
+
+    if (destAttributes == INVALID_FILE_ATTRIBUTES) {
+      entries.push_back(entry);
+      continue;
+    }
+
+    // A copy onto an existing file may have been skipped, and undoing it
+    // deletes for good, so the file is left alone. Moving back never replaces
+    // what's at the source without asking, so moves are still recorded.
+    if (!(destAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      if (action == "move") {
+        entries.push_back(entry);
+      }
+      continue;
+    }
+
+    // The target is merged into an existing directory, so record only what
+    // it adds: new directories as a whole, and files one by one. Copies
+    // only record files that don't exist yet, while moves record every file
+    // since each one has to go back to its source.
+    DWORD error = walkTree(target.src, [&](const std::wstring &path,
+                                           const WIN32_FIND_DATAW &data) {
+      Target item;
+      item.src = path;
+      item.dest = target.dest + path.substr(target.src.length());
+
+      bool exists = pathExists(item.dest);
+      bool isDirectory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+      if (isDirectory && exists) {
+        return true;
+      }
+
+      if (!exists || action == "move") {
+        entries.push_back(item);
+      }
+
+      return false;
+    });
+
+    if (error != 0) {
+      return error;
+    }
+  }
+
+  return 0;
+}
+
+void UndoLog::add(const std::vector<Target> &created) {
+  entries.insert(entries.end(), created.begin(), created.end());
+}
+
+void UndoLog::addRemoved(const std::vector<std::wstring> &removed) {
+  // Deleted items are the ones without a destination, like every entry of a
+  // delete job
+  for (const std::wstring &path : removed) {
+    Target entry;
+    entry.src = path;
+    entries.push_back(entry);
+  }
+}
+
+DWORD UndoLog::save(const std::wstring &jobId) {
+  if (!isValidJobId(jobId)) {
+    return ERROR_INVALID_NAME;
+  }
+
+  std::wstring dir;
+  DWORD error = undoDirectory(dir);
+  if (error != 0) {
+    return error;
+  }
+
+  std::map<std::pair<DWORD, std::wstring>, DWORD> indexes;
+  std::vector<std::pair<DWORD, std::wstring>> names;
+  std::vector<UndoEntry> packed;
+
+  for (const Target &entry : entries) {
+    UndoEntry item;
+    item.src = addName(entry.src, indexes, names);
+    item.dest = addName(entry.dest, indexes, names);
+    packed.push_back(item);
+  }
+
+  UndoHeader header;
+  memcpy(header.magic, UNDO_MAGIC, sizeof(UNDO_MAGIC));
+  header.version = UNDO_VERSION;
+  header.action = action == "copy"   ? UNDO_COPY
+                  : action == "move" ? UNDO_MOVE
+                                     : UNDO_DELETE;
+  header.startTime = startTime;
+  header.entryCount = (DWORD)packed.size();
+  header.nameCount = (DWORD)names.size();
+
+  std::string data((const char *)&header, sizeof(header));
+
+  for (const std::pair<DWORD, std::wstring> &name : names) {
+    UndoName packedName;
+    packedName.parent = name.first;
+    packedName.length = (DWORD)name.second.length();
+
+    data.append((const char *)&packedName, sizeof(packedName));
+    data.append((const char *)name.second.data(),
+                name.second.length() * sizeof(wchar_t));
+  }
+
+  if (!packed.empty()) {
+    data.append((const char *)packed.data(), packed.size() * sizeof(UndoEntry));
+  }
+
+  HANDLE file =
+      CreateFileW(joinPath(dir, jobId + L".log").c_str(), GENERIC_WRITE, 0,
+                  NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  DWORD written = 0;
+  error = WriteFile(file, data.data(), (DWORD)data.length(), &written, NULL)
+              ? 0
+              : GetLastError();
+  CloseHandle(file);
+
+  if (error != 0) {
+    return error;
+  }
+
+  // Remove the oldest logs, so they don't pile up forever
+  std::vector<std::pair<ULONGLONG, std::wstring>> logs;
+  walkTree(dir, [&](const std::wstring &path, const WIN32_FIND_DATAW &data) {
+    if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      logs.push_back(
+          std::make_pair(fileTimeToTicks(data.ftLastWriteTime), path));
+    }
+    return path == dir;
+  });
+
+  if (logs.size() > MAX_UNDO_LOGS) {
+    std::sort(logs.begin(), logs.end());
+    for (size_t i = 0; i < logs.size() - MAX_UNDO_LOGS; i++) {
+      DeleteFileW(logs[i].second.c_str());
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Read the log of the given job. Returns 0 or a Windows error code.
+ */
+static DWORD readLog(const std::wstring &path, UndoHeader &header,
+                     std::vector<Target> &entries) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  LARGE_INTEGER size;
+  DWORD read = 0;
+  std::string data;
+
+  DWORD error = 0;
+  if (!GetFileSizeEx(file, &size)) {
+    error = GetLastError();
+  } else {
+    data.resize((size_t)size.QuadPart);
+    if (!data.empty() &&
+        !ReadFile(file, &data[0], (DWORD)data.length(), &read, NULL)) {
+      error = GetLastError();
+    }
+  }
+  CloseHandle(file);
+
+  if (error != 0) {
+    return error;
+  }
+
+  if (read < sizeof(header)) {
+    return ERROR_BAD_FORMAT;
+  }
+
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, UNDO_MAGIC, sizeof(UNDO_MAGIC)) != 0 ||
+      header.version != UNDO_VERSION) {
+    return ERROR_BAD_FORMAT;
+  }
+
+  std::vector<std::pair<DWORD, std::wstring>> names;
+  size_t offset = sizeof(header);
+
+  for (DWORD i = 0; i < header.nameCount; i++) {
+    UndoName name;
+    if (offset + sizeof(name) > read) {
+      return ERROR_BAD_FORMAT;
+    }
+    memcpy(&name, data.data() + offset, sizeof(name));
+    offset += sizeof(name);
+
+    if (offset + name.length * sizeof(wchar_t) > read) {
+      return ERROR_BAD_FORMAT;
+    }
+    std::wstring component(name.length, L'\0');
+    memcpy(&component[0], data.data() + offset, name.length * sizeof(wchar_t));
+    offset += name.length * sizeof(wchar_t);
+
+    names.push_back(std::make_pair(name.parent, component));
+  }
+
+  if (offset + header.entryCount * sizeof(UndoEntry) > read) {
+    return ERROR_BAD_FORMAT;
+  }
+
+  for (DWORD i = 0; i < header.entryCount; i++) {
+    UndoEntry entry;
+    memcpy(&entry, data.data() + offset + i * sizeof(UndoEntry),
+           sizeof(entry));
+
+    Target target;
+    target.src = pathAt(entry.src, names);
+    target.dest = pathAt(entry.dest, names);
+    entries.push_back(target);
+  }
+
+  return 0;
+}
+
+/**
+ * Get the current user's SID as a string, which names their folder in the
+ * Recycle Bin of each volume. Returns an empty string if it can't be read.
+ */
+static std::wstring currentUserSid() {
+  HANDLE token;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) {
+    return L"";
+  }
+
+  DWORD size = 0;
+  GetTokenInformation(token, TokenUser, NULL, 0, &size);
+
+  std::vector<BYTE> info(size);
+  std::wstring sid;
+  LPWSTR text = NULL;
+
+  if (size > 0 &&
+      GetTokenInformation(token, TokenUser, info.data(), size, &size) &&
+      ConvertSidToStringSidW(((TOKEN_USER *)info.data())->User.Sid, &text)) {
+    sid = text;
+    LocalFree(text);
+  }
+
+  CloseHandle(token);
+  return sid;
+}
+
+/**
+ * Find the items in the Recycle Bin of the given volume that were deleted
+ * after the given time, by their original path in upper case
+ */
+static void indexRecycleBin(const std::wstring &volume, ULONGLONG deletedAfter,
+                            std::map<std::wstring, RecycledItem> &items) {
+  // Each user has their own folder in the bin, and other users' folders
+  // can't be listed, so only the current user's is read
+  std::wstring sid = currentUserSid();
+  if (sid.empty()) {
+    return;
+  }
+  std::wstring bin = joinPath(joinPath(volume, L"$Recycle.Bin"), sid);
+
+  // Each deleted item has an $I file with its original path and an $R file
+  // or folder with its data
+  walkTree(bin, [&](const std::wstring &path, const WIN32_FIND_DATAW &data) {
+    if (path == bin) {
+      return true;
+    }
+
+    std::wstring name = data.cFileName;
+    if (name.compare(0, 2, L"$I") != 0 ||
+        (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      return false;
+    }
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, 0, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+
+    std::string info(28 + 32768 * sizeof(wchar_t), '\0');
+    DWORD read = 0;
+    BOOL ok = ReadFile(file, &info[0], (DWORD)info.length(), &read, NULL);
+    CloseHandle(file);
+
+    if (!ok || read < 28) {
+      return false;
+    }
+
+    // Version 1 files have a fixed MAX_PATH name, version 2 files have the
+    // name's length (including the null terminator) before it
+    ULONGLONG version = *(const ULONGLONG *)info.data();
+    ULONGLONG deletedAt = *(const ULONGLONG *)(info.data() + 16);
+    const wchar_t *original = NULL;
+    size_t maxLength = 0;
+
+    if (version == 1) {
+      original = (const wchar_t *)(info.data() + 24);
+      maxLength = std::min<size_t>(MAX_PATH, (read - 24) / sizeof(wchar_t));
+    } else if (version == 2) {
+      original = (const wchar_t *)(info.data() + 28);
+      maxLength = std::min<size_t>(*(const DWORD *)(info.data() + 24),
+                                   (read - 28) / sizeof(wchar_t));
+    } else {
+      return false;
+    }
+
+    std::wstring originalPath(original, maxLength);
+    originalPath.resize(wcsnlen(originalPath.c_str(), maxLength));
+
+    if (deletedAt < deletedAfter) {
+      return false;
+    }
+
+    // Keep the most recent deletion when a path was deleted more than once
+    std::wstring key = toUpper(originalPath);
+    auto found = items.find(key);
+    if (found == items.end() || found->second.deletedAt < deletedAt) {
+      RecycledItem item;
+      item.infoPath = path;
+      item.dataPath = joinPath(parentPath(path), L"$R" + name.substr(2));
+      item.deletedAt = deletedAt;
+      items[key] = item;
+    }
+
+    return false;
+  });
+}
+
+DWORD undoJob(const std::wstring &jobId, BOOL &wasAborted) {
+  if (!isValidJobId(jobId)) {
+    return ERROR_INVALID_NAME;
+  }
+
+  std::wstring dir;
+  DWORD error = undoDirectory(dir);
+  if (error != 0) {
+    return error;
+  }
+
+  std::wstring logPath = joinPath(dir, jobId + L".log");
+  UndoHeader header;
+  std::vector<Target> entries;
+
+  error = readLog(logPath, header, entries);
+  if (error != 0) {
+    return error;
+  }
+
+  std::map<std::wstring, std::map<std::wstring, RecycledItem>> recycleBins;
+  std::vector<std::string> shellSrcPaths;
+  std::vector<std::string> shellDestPaths;
+  DWORD firstError = 0;
+
+  // Undo in reverse, so merged items are dealt with before their parents.
+  // Deleted items, which have no destination, are restored after the rest, so
+  // whatever was copied in their place has been removed by then.
+  std::vector<size_t> order;
+  for (size_t i = entries.size(); i-- > 0;) {
+    if (!entries[i].dest.empty()) {
+      order.push_back(i);
+    }
+  }
+  for (size_t i = entries.size(); i-- > 0;) {
+    if (entries[i].dest.empty()) {
+      order.push_back(i);
+    }
+  }
+
+  for (size_t i : order) {
+    const Target &entry = entries[i];
+    error = 0;
+
+    if (entry.dest.empty()) {
+      std::wstring volume = toUpper(volumeRoot(entry.src));
+      if (recycleBins.find(volume) == recycleBins.end()) {
+        indexRecycleBin(volume, header.startTime, recycleBins[volume]);
+      }
+
+      std::map<std::wstring, RecycledItem> &items = recycleBins[volume];
+      auto found = items.find(toUpper(entry.src));
+
+      if (found == items.end()) {
+        error = ERROR_FILE_NOT_FOUND;
+      } else {
+        error = createDirectories(parentPath(entry.src));
+        if (error == 0 && MoveFileExW(found->second.dataPath.c_str(),
+                                      entry.src.c_str(), 0)) {
+          DeleteFileW(found->second.infoPath.c_str());
+        } else if (error == 0) {
+          error = GetLastError();
+        }
+      }
+    } else if (header.action == UNDO_COPY) {
+      error = removeTree(entry.dest);
+    } else if (header.action == UNDO_MOVE) {
+      if (!pathExists(entry.dest)) {
+        continue;
+      }
+
+      // Within a volume, moving back is a single rename however much the
+      // item contains. Other moves are left to Explorer below.
+      if (isSameVolume(entry.dest, entry.src)) {
+        error = createDirectories(parentPath(entry.src));
+        if (error == 0 &&
+            !MoveFileExW(entry.dest.c_str(), entry.src.c_str(), 0)) {
+          error = GetLastError();
+        }
+      } else {
+        shellSrcPaths.push_back(toUtf8(entry.dest));
+        shellDestPaths.push_back(toUtf8(entry.src));
+      }
+    }
+
+    if (error != 0 && firstError == 0) {
+      firstError = error;
+    }
+  }
+
+  if (!shellSrcPaths.empty()) {
+    int status = runShellOperation("move", shellSrcPaths, shellDestPaths, true,
+                                   wasAborted);
+    if (status != 0 && firstError == 0) {
+      firstError = status;
+    }
+  }
+
+  // A job can only be undone once
+  if (firstError == 0 && !wasAborted) {
+    DeleteFileW(logPath.c_str());
+  }
+
+  return firstError;
+}
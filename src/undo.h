@@ -0,0 +1,67 @@
+#pragma once
+
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * A record of what an operation did, saved so it can be reversed later with
+ * the cheapest operation available: moves are renamed back, copies are
+ * deleted, and deleted items are restored from the Recycle Bin. Deleted items
+ * are restored last, so anything copied in their place is gone by then.
+ *
+ * Logs are saved to %LOCALAPPDATA%\FileOps\undo\<job id>.log, as a small
+ * binary file with a table of path components shared between entries.
+ */
+class UndoLog {
+public:
+  UndoLog();
+
+  /**
+   * Note what's at each target before the operation, so undoing it only
+   * touches what the operation did. When a target is merged into an existing
+   * directory, the items it adds are recorded one by one. Files a copy would
+   * replace aren't recorded, since undoing a copy deletes for good.
+   */
+  DWORD prepare(const std::string &action, const std::vector<Target> &targets);
+
+  /**
+   * Record items the operation created that couldn't be known beforehand,
+   * such as copies renamed to avoid a conflict
+   */
+  void add(const std::vector<Target> &created);
+
+  /**
+   * Record items the operation sent to the Recycle Bin along the way, such as
+   * those a mirror removed, to be restored when it's undone
+   */
+  void addRemoved(const std::vector<std::wstring> &removed);
+
+  /**
+   * Save the log for the given job. Returns 0 or a Windows error code.
+   */
+  DWORD save(const std::wstring &jobId);
+
+private:
+  std::string action;
+  std::vector<Target> entries;
+  ULONGLONG startTime;
+};
+
+/**
+ * Create an id for a new job
+ */
+std::wstring newJobId();
+
+/**
+ * Check if a job id is made only of letters, digits, `-`, and `_`, so it
+ * can't name a log outside the undo directory
+ */
+bool isValidJobId(const std::wstring &jobId);
+
+/**
+ * Reverse the job with the given id, and remove its log once done.
+ * Returns 0 or a Windows error code.
+ */
+DWORD undoJob(const std::wstring &jobId, BOOL &wasAborted);
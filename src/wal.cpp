@@ -0,0 +1,301 @@
+#include "wal.h"
+#include "hash.h"
+#include "walker.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+
+enum WalRecordType : DWORD {
+  WAL_INTENT = 1,
+  WAL_COMMIT = 2,
+  WAL_END = 3,
+};
+
+// Set on an intent when its destination already existed before the move, so
+// what's there can't be told apart from what was moved
+static const DWORD WAL_DEST_EXISTED = 1;
+
+struct WalRecord {
+  DWORD type;
+  DWORD length;
+  ULONGLONG batch;
+  // A hash of the fields above and the payload, to spot records torn by a
+  // crash
+  ULONGLONG check;
+};
+
+// Intent records are followed by the source and destination paths
+struct WalIntent {
+  DWORD flags;
+  DWORD srcLength;
+  DWORD destLength;
+  DWORD reserved;
+};
+
+/**
+ * A batch read back from the log
+ */
+struct WalBatch {
+  std::vector<Target> moves;
+  std::vector<DWORD> flags;
+  ULONGLONG committed = 0;
+  bool ended = false;
+};
+
+/**
+ * Hash a record and the payload that follows it, leaving out the check itself
+ */
+static ULONGLONG checkOf(const WalRecord &record, const char *payload,
+                         size_t payloadLength) {
+  ULONGLONG hash = xxh64(&record, offsetof(WalRecord, check));
+  return xxh64(payload, payloadLength, hash);
+}
+
+static void appendRecord(std::string &data, DWORD type, ULONGLONG batch,
+                         const void *payload, size_t payloadLength) {
+  // Records are padded so each one starts 8-byte aligned
+  size_t padding = (8 - payloadLength % 8) % 8;
+
+  WalRecord record;
+  record.type = type;
+  record.length = (DWORD)(sizeof(record) + payloadLength + padding);
+  record.batch = batch;
+
+  std::string padded;
+  if (payloadLength > 0) {
+    padded.assign((const char *)payload, payloadLength);
+  }
+  padded.append(padding, '\0');
+  record.check = checkOf(record, padded.data(), padded.length());
+
+  data.append((const char *)&record, sizeof(record));
+  data.append(padded);
+}
+
+static bool pathExists(const std::wstring &path) {
+  return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+bool parseRecovery(const std::string &value, Recovery &mode) {
+  if (value == "replay") {
+    mode = Recovery::Replay;
+  } else if (value == "rollback") {
+    mode = Recovery::Rollback;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+WriteAheadLog::WriteAheadLog() : file(INVALID_HANDLE_VALUE), batch(0) {}
+
+WriteAheadLog::~WriteAheadLog() {
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+}
+
+DWORD WriteAheadLog::open(const std::wstring &path) {
+  file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                     FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                     NULL);
+  return file == INVALID_HANDLE_VALUE ? GetLastError() : 0;
+}
+
+DWORD WriteAheadLog::write(const std::string &data) {
+  LARGE_INTEGER zero;
+  zero.QuadPart = 0;
+
+  DWORD written = 0;
+  if (!SetFilePointerEx(file, zero, NULL, FILE_END) ||
+      !WriteFile(file, data.data(), (DWORD)data.length(), &written, NULL) ||
+      !FlushFileBuffers(file)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+/**
+ * Work out how to move an interrupted move's destination back to its source.
+ * Whatever is only at the destination is moved back, and whatever is at both
+ * is a copy made before the source was removed, possibly a partial one, so
+ * it's deleted. Directories are compared file by file.
+ */
+static DWORD rollBack(const Target &move, std::vector<Target> &moves,
+                      std::vector<std::wstring> &files,
+                      std::vector<std::wstring> &directories) {
+  if (!pathExists(move.src)) {
+    Target back;
+    back.src = move.dest;
+    back.dest = move.src;
+    moves.push_back(back);
+    return 0;
+  }
+
+  return walkTree(move.dest, [&](const std::wstring &path,
+                                 const WIN32_FIND_DATAW &data) {
+    std::wstring src = move.src + path.substr(move.dest.length());
+    bool isDirectory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+    if (!pathExists(src)) {
+      Target back;
+      back.src = path;
+      back.dest = src;
+      moves.push_back(back);
+      return false;
+    }
+
+    if (isDirectory) {
+      directories.push_back(path);
+      return true;
+    }
+
+    files.push_back(path);
+    return false;
+  });
+}
+
+DWORD WriteAheadLog::pendingMoves(Recovery mode, std::vector<Target> &moves,
+                                  std::vector<std::wstring> &leftovers) {
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    return GetLastError();
+  }
+
+  std::string data((size_t)size.QuadPart, '\0');
+  DWORD read = 0;
+  if (!data.empty() &&
+      !ReadFile(file, &data[0], (DWORD)data.length(), &read, NULL)) {
+    return GetLastError();
+  }
+  data.resize(read);
+
+  // Read every record up to the end, or up to a record torn by a crash
+  std::map<ULONGLONG, WalBatch> batches;
+  size_t offset = 0;
+
+  while (offset + sizeof(WalRecord) <= data.length()) {
+    const WalRecord *record = (const WalRecord *)(data.data() + offset);
+    if (record->length < sizeof(WalRecord) ||
+        offset + record->length > data.length()) {
+      break;
+    }
+
+    const char *payload = data.data() + offset + sizeof(WalRecord);
+    size_t payloadLength = record->length - sizeof(WalRecord);
+    if (record->check != checkOf(*record, payload, payloadLength)) {
+      break;
+    }
+    WalBatch &walBatch = batches[record->batch];
+
+    if (record->type == WAL_INTENT && payloadLength >= sizeof(WalIntent)) {
+      const WalIntent *intent = (const WalIntent *)payload;
+      const wchar_t *paths = (const wchar_t *)(intent + 1);
+
+      if (sizeof(WalIntent) + (intent->srcLength + intent->destLength) *
+                                  sizeof(wchar_t) >
+          payloadLength) {
+        break;
+      }
+
+      Target move;
+      move.src.assign(paths, intent->srcLength);
+      move.dest.assign(paths + intent->srcLength, intent->destLength);
+      walBatch.moves.push_back(move);
+      walBatch.flags.push_back(intent->flags);
+    } else if (record->type == WAL_COMMIT &&
+               payloadLength >= sizeof(ULONGLONG)) {
+      walBatch.committed = *(const ULONGLONG *)payload;
+    } else if (record->type == WAL_END) {
+      walBatch.ended = true;
+    }
+
+    batch = std::max(batch, record->batch);
+    offset += record->length;
+  }
+
+  // Directories left behind by rolling back, removed after the files
+  std::vector<std::wstring> directories;
+
+  for (auto &entry : batches) {
+    const WalBatch &walBatch = entry.second;
+
+    // A batch without a complete commit was never started, since moves only
+    // start once the commit is on disk
+    if (walBatch.ended || walBatch.committed == 0 ||
+        walBatch.committed != walBatch.moves.size()) {
+      continue;
+    }
+
+    for (size_t i = 0; i < walBatch.moves.size(); i++) {
+      const Target &move = walBatch.moves[i];
+
+      // Moving back into a destination that already existed can't tell its
+      // old contents from moved ones, so those are always finished instead
+      bool rollback = mode == Recovery::Rollback &&
+                      !(walBatch.flags[i] & WAL_DEST_EXISTED);
+
+      if (rollback && pathExists(move.dest)) {
+        DWORD error = rollBack(move, moves, leftovers, directories);
+        if (error != 0) {
+          return error;
+        }
+      } else if (!rollback && pathExists(move.src)) {
+        moves.push_back(move);
+      }
+    }
+  }
+
+  leftovers.insert(leftovers.end(), directories.rbegin(), directories.rend());
+
+  return 0;
+}
+
+DWORD WriteAheadLog::clear() {
+  LARGE_INTEGER zero;
+  zero.QuadPart = 0;
+
+  if (!SetFilePointerEx(file, zero, NULL, FILE_BEGIN) || !SetEndOfFile(file) ||
+      !FlushFileBuffers(file)) {
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+DWORD WriteAheadLog::begin(const std::vector<Target> &targets) {
+  batch++;
+
+  std::string data;
+
+  for (const Target &target : targets) {
+    WalIntent intent;
+    intent.flags = pathExists(target.dest) ? WAL_DEST_EXISTED : 0;
+    intent.srcLength = (DWORD)target.src.length();
+    intent.destLength = (DWORD)target.dest.length();
+    intent.reserved = 0;
+
+    std::string payload((const char *)&intent, sizeof(intent));
+    payload.append((const char *)target.src.data(),
+                   target.src.length() * sizeof(wchar_t));
+    payload.append((const char *)target.dest.data(),
+                   target.dest.length() * sizeof(wchar_t));
+
+    appendRecord(data, WAL_INTENT, batch, payload.data(), payload.length());
+  }
+
+  ULONGLONG count = targets.size();
+  appendRecord(data, WAL_COMMIT, batch, &count, sizeof(count));
+
+  return write(data);
+}
+
+DWORD WriteAheadLog::end() {
+  std::string data;
+  appendRecord(data, WAL_END, batch, NULL, 0);
+
+  return write(data);
+}
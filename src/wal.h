@@ -0,0 +1,73 @@
+#pragma once
+
+#include "paths.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * What to do with moves that an earlier run started but didn't finish
+ */
+enum class Recovery {
+  // Finish moving whatever is still at the source
+  Replay,
+  // Move whatever reached the destination back to the source
+  Rollback,
+};
+
+/**
+ * Parse the value of the --wal-recover option
+ */
+bool parseRecovery(const std::string &value, Recovery &mode);
+
+/**
+ * A write-ahead log of moves. Before a move starts, every source and
+ * destination is recorded and followed by a commit record, and the whole
+ * batch is flushed to disk at once. An end record is added once the move
+ * finishes. A batch with a commit but no end record was interrupted, and the
+ * next run can finish or undo it by looking at what's left at each source
+ * and destination.
+ */
+class WriteAheadLog {
+public:
+  WriteAheadLog();
+  ~WriteAheadLog();
+
+  /**
+   * Open the log at the given path, creating it if it doesn't exist.
+   * Returns 0 or a Windows error code.
+   */
+  DWORD open(const std::wstring &path);
+
+  /**
+   * Get the moves needed to finish or undo interrupted batches, as sources
+   * and exact destination paths. When undoing, copies at the destination of
+   * items still at their source are added to `leftovers` to be deleted
+   * instead, followed by the directories the moves back leave empty,
+   * children before parents. Returns 0 or a Windows error code.
+   */
+  DWORD pendingMoves(Recovery mode, std::vector<Target> &moves,
+                     std::vector<std::wstring> &leftovers);
+
+  /**
+   * Clear the log once every interrupted batch has been dealt with
+   */
+  DWORD clear();
+
+  /**
+   * Record the moves about to be made, and flush them to disk with a single
+   * flush. Returns 0 or a Windows error code.
+   */
+  DWORD begin(const std::vector<Target> &targets);
+
+  /**
+   * Record that the moves recorded by the last `begin` have finished
+   */
+  DWORD end();
+
+private:
+  DWORD write(const std::string &data);
+
+  HANDLE file;
+  ULONGLONG batch;
+};
@@ -0,0 +1,159 @@
+#include "walker.h"
+#include "paths.h"
+
+#include <algorithm>
+#include <vector>
+
+bool isWalkableDirectory(const WIN32_FIND_DATAW &data) {
+  return (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+         !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+}
+
+ULONGLONG fileSizeOf(const WIN32_FIND_DATAW &data) {
+  return ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+}
+
+ULONGLONG fileTimeToTicks(const FILETIME &time) {
+  return ((ULONGLONG)time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+
+int compareNames(const wchar_t *a, const wchar_t *b) {
+  return CompareStringOrdinal(a, -1, b, -1, TRUE) - CSTR_EQUAL;
+}
+
+void sortByName(std::vector<WIN32_FIND_DATAW> &entries) {
+  std::sort(entries.begin(), entries.end(),
+            [](const WIN32_FIND_DATAW &a, const WIN32_FIND_DATAW &b) {
+              return compareNames(a.cFileName, b.cFileName) < 0;
+            });
+}
+
+bool statPath(const std::wstring &path, WIN32_FIND_DATAW &data) {
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+  if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard,
+                            &attributes)) {
+    return false;
+  }
+
+  ZeroMemory(&data, sizeof(data));
+  data.dwFileAttributes = attributes.dwFileAttributes;
+  data.ftCreationTime = attributes.ftCreationTime;
+  data.ftLastAccessTime = attributes.ftLastAccessTime;
+  data.ftLastWriteTime = attributes.ftLastWriteTime;
+  data.nFileSizeHigh = attributes.nFileSizeHigh;
+  data.nFileSizeLow = attributes.nFileSizeLow;
+
+  std::wstring name = baseName(path);
+  wcsncpy_s(data.cFileName, MAX_PATH, name.c_str(), _TRUNCATE);
+
+  // Only listings give the reparse tag, so list the path on its own to get it
+  if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+    WIN32_FIND_DATAW found;
+    HANDLE find = FindFirstFileExW(path.c_str(), FindExInfoBasic, &found,
+                                   FindExSearchNameMatch, NULL, 0);
+    if (find != INVALID_HANDLE_VALUE) {
+      data.dwReserved0 = found.dwReserved0;
+      FindClose(find);
+    }
+  }
+
+  return true;
+}
+
+DWORD listDirectory(const std::wstring &dir,
+                    std::vector<WIN32_FIND_DATAW> &entries) {
+  WIN32_FIND_DATAW data;
+
+  // The basic info level skips short names, and the large fetch flag asks
+  // for bigger batches per call, which adds up on large directories
+  HANDLE find = FindFirstFileExW(joinPath(dir, L"*").c_str(), FindExInfoBasic,
+                                 &data, FindExSearchNameMatch, NULL,
+                                 FIND_FIRST_EX_LARGE_FETCH);
+  if (find == INVALID_HANDLE_VALUE) {
+    return GetLastError();
+  }
+
+  do {
+    if (wcscmp(data.cFileName, L".") != 0 &&
+        wcscmp(data.cFileName, L"..") != 0) {
+      entries.push_back(data);
+    }
+  } while (FindNextFileW(find, &data));
+
+  FindClose(find);
+
+  return 0;
+}
+
+DWORD walkTree(const std::wstring &root, const WalkCallback &callback) {
+  WIN32_FIND_DATAW data;
+
+  if (!statPath(root, data)) {
+    return GetLastError();
+  }
+
+  if (!callback(root, data) || !isWalkableDirectory(data)) {
+    return 0;
+  }
+
+  std::vector<std::wstring> pending;
+  pending.push_back(root);
+
+  std::vector<WIN32_FIND_DATAW> entries;
+
+  while (!pending.empty()) {
+    std::wstring dir = pending.back();
+    pending.pop_back();
+
+    entries.clear();
+    DWORD error = listDirectory(dir, entries);
+    if (error == ERROR_FILE_NOT_FOUND) {
+      continue;
+    } else if (error != 0) {
+      return error;
+    }
+
+    for (const WIN32_FIND_DATAW &entry : entries) {
+      std::wstring path = joinPath(dir, entry.cFileName);
+      if (callback(path, entry) && isWalkableDirectory(entry)) {
+        pending.push_back(path);
+      }
+    }
+  }
+
+  return 0;
+}
+
+DWORD removeTree(const std::wstring &root) {
+  std::vector<std::wstring> paths;
+  std::vector<DWORD> attributes;
+
+  DWORD error = walkTree(
+      root, [&](const std::wstring &path, const WIN32_FIND_DATAW &data) {
+        paths.push_back(path);
+        attributes.push_back(data.dwFileAttributes);
+        return true;
+      });
+  if (error != 0) {
+    return error == ERROR_FILE_NOT_FOUND ? 0 : error;
+  }
+
+  // Entries are listed parents first, so go backwards to empty each
+  // directory before removing it
+  for (size_t i = paths.size(); i-- > 0;) {
+    if (attributes[i] & FILE_ATTRIBUTE_READONLY) {
+      SetFileAttributesW(paths[i].c_str(),
+                         attributes[i] & ~FILE_ATTRIBUTE_READONLY);
+    }
+
+    BOOL removed = (attributes[i] & FILE_ATTRIBUTE_DIRECTORY)
+                       ? RemoveDirectoryW(paths[i].c_str())
+                       : DeleteFileW(paths[i].c_str());
+    if (!removed) {
+      return GetLastError();
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "platform.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Called for each entry found while walking a tree, with the entry's full path
+ * and the metadata returned by the directory listing. Returning false for a
+ * directory skips its contents.
+ */
+typedef std::function<bool(const std::wstring &path,
+                           const WIN32_FIND_DATAW &data)>
+    WalkCallback;
+
+/**
+ * Check if the given listing entry is a directory that should be descended
+ * into. Reparse points (symlinks, junctions) are not followed.
+ */
+bool isWalkableDirectory(const WIN32_FIND_DATAW &data);
+
+/**
+ * Get the size of a listing entry in bytes
+ */
+ULONGLONG fileSizeOf(const WIN32_FIND_DATAW &data);
+
+/**
+ * Convert a FILETIME to a single count of 100ns ticks
+ */
+ULONGLONG fileTimeToTicks(const FILETIME &time);
+
+/**
+ * Compare two names the way the file system does, ignoring case. Returns a
+ * negative number, zero, or a positive number like strcmp.
+ */
+int compareNames(const wchar_t *a, const wchar_t *b);
+
+/**
+ * Sort listing entries by name, using compareNames
+ */
+void sortByName(std::vector<WIN32_FIND_DATAW> &entries);
+
+/**
+ * Read the metadata of a single path into the same shape as a listing entry,
+ * including the reparse tag of reparse points
+ */
+bool statPath(const std::wstring &path, WIN32_FIND_DATAW &data);
+
+/**
+ * List the entries of a single directory, without "." and "..".
+ * Returns 0 or a Windows error code.
+ */
+DWORD listDirectory(const std::wstring &dir,
+                    std::vector<WIN32_FIND_DATAW> &entries);
+
+/**
+ * Walk the tree at the given root, calling the callback for the root itself
+ * and then every entry beneath it. Returns 0 or a Windows error code.
+ */
+DWORD walkTree(const std::wstring &root, const WalkCallback &callback);
+
+/**
+ * Delete the tree at the given root, including read-only files.
+ * Returns 0 or a Windows error code.
+ */
+DWORD removeTree(const std::wstring &root);
@@ -0,0 +1,324 @@
+#include "hash.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XXH3_USE_SSE2
+#endif
+
+static const UINT32 PRIME32_1 = 0x9E3779B1U;
+static const UINT32 PRIME32_2 = 0x85EBCA77U;
+static const UINT32 PRIME32_3 = 0xC2B2AE3DU;
+static const ULONGLONG PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const ULONGLONG PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const ULONGLONG PRIME64_3 = 0x165667B19E3779F9ULL;
+static const ULONGLONG PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const ULONGLONG PRIME64_5 = 0x27D4EB2F165667C5ULL;
+static const ULONGLONG PRIME_MX1 = 0x165667919E3779F9ULL;
+static const ULONGLONG PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+static const size_t STRIPE_LENGTH = 64;
+static const size_t SECRET_SIZE = 192;
+static const size_t STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LENGTH) / 8;
+static const size_t MAX_SHORT_LENGTH = 240;
+
+// The default secret from the XXH3 specification
+alignas(16) static const BYTE SECRET[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline ULONGLONG read64(const BYTE *data) {
+  ULONGLONG value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline UINT32 read32(const BYTE *data) {
+  UINT32 value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline ULONGLONG rotateLeft(ULONGLONG value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline UINT32 swap32(UINT32 value) {
+  return ((value << 24) & 0xFF000000U) | ((value << 8) & 0x00FF0000U) |
+         ((value >> 8) & 0x0000FF00U) | ((value >> 24) & 0x000000FFU);
+}
+
+static inline ULONGLONG swap64(ULONGLONG value) {
+  return ((ULONGLONG)swap32((UINT32)value) << 32) |
+         swap32((UINT32)(value >> 32));
+}
+
+/**
+ * Multiply two 64-bit values into 128 bits, and fold the halves together
+ */
+static inline ULONGLONG multiplyFold64(ULONGLONG a, ULONGLONG b) {
+  ULONGLONG aLow = (UINT32)a;
+  ULONGLONG aHigh = a >> 32;
+  ULONGLONG bLow = (UINT32)b;
+  ULONGLONG bHigh = b >> 32;
+
+  ULONGLONG lowLow = aLow * bLow;
+  ULONGLONG highLow = aHigh * bLow;
+  ULONGLONG lowHigh = aLow * bHigh;
+  ULONGLONG highHigh = aHigh * bHigh;
+
+  ULONGLONG cross = (lowLow >> 32) + (UINT32)highLow + lowHigh;
+  ULONGLONG upper = (highLow >> 32) + (cross >> 32) + highHigh;
+  ULONGLONG lower = (cross << 32) | (UINT32)lowLow;
+
+  return lower ^ upper;
+}
+
+static inline ULONGLONG xxh64Avalanche(ULONGLONG hash) {
+  hash ^= hash >> 33;
+  hash *= PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= PRIME64_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+static inline ULONGLONG xxh3Avalanche(ULONGLONG hash) {
+  hash ^= hash >> 37;
+  hash *= PRIME_MX1;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+static inline ULONGLONG rrmxmx(ULONGLONG hash, ULONGLONG length) {
+  hash ^= rotateLeft(hash, 49) ^ rotateLeft(hash, 24);
+  hash *= PRIME_MX2;
+  hash ^= (hash >> 35) + length;
+  hash *= PRIME_MX2;
+  hash ^= hash >> 28;
+  return hash;
+}
+
+static inline ULONGLONG mix16(const BYTE *input, const BYTE *secret) {
+  return multiplyFold64(read64(input) ^ read64(secret),
+                        read64(input + 8) ^ read64(secret + 8));
+}
+
+/**
+ * Hash an input of up to 240 bytes, which XXH3 handles without stripes
+ */
+static ULONGLONG hashShort(const BYTE *input, size_t length) {
+  if (length == 0) {
+    return xxh64Avalanche(read64(SECRET + 56) ^ read64(SECRET + 64));
+  }
+
+  if (length <= 3) {
+    UINT32 combined = ((UINT32)input[0] << 16) |
+                      ((UINT32)input[length >> 1] << 24) |
+                      (UINT32)input[length - 1] | ((UINT32)length << 8);
+    ULONGLONG bitflip = read32(SECRET) ^ read32(SECRET + 4);
+    return xxh64Avalanche((ULONGLONG)combined ^ bitflip);
+  }
+
+  if (length <= 8) {
+    ULONGLONG bitflip = read64(SECRET + 8) ^ read64(SECRET + 16);
+    ULONGLONG combined =
+        read32(input + length - 4) + ((ULONGLONG)read32(input) << 32);
+    return rrmxmx(combined ^ bitflip, length);
+  }
+
+  if (length <= 16) {
+    ULONGLONG low = read64(input) ^ (read64(SECRET + 24) ^ read64(SECRET + 32));
+    ULONGLONG high =
+        read64(input + length - 8) ^ (read64(SECRET + 40) ^ read64(SECRET + 48));
+    return xxh3Avalanche(length + swap64(low) + high +
+                         multiplyFold64(low, high));
+  }
+
+  ULONGLONG acc = length * PRIME64_1;
+
+  if (length <= 128) {
+    if (length > 32) {
+      if (length > 64) {
+        if (length > 96) {
+          acc += mix16(input + 48, SECRET + 96);
+          acc += mix16(input + length - 64, SECRET + 112);
+        }
+        acc += mix16(input + 32, SECRET + 64);
+        acc += mix16(input + length - 48, SECRET + 80);
+      }
+      acc += mix16(input + 16, SECRET + 32);
+      acc += mix16(input + length - 32, SECRET + 48);
+    }
+    acc += mix16(input, SECRET);
+    acc += mix16(input + length - 16, SECRET + 16);
+    return xxh3Avalanche(acc);
+  }
+
+  size_t rounds = length / 16;
+  for (size_t i = 0; i < 8; i++) {
+    acc += mix16(input + 16 * i, SECRET + 16 * i);
+  }
+  acc = xxh3Avalanche(acc);
+
+  for (size_t i = 8; i < rounds; i++) {
+    acc += mix16(input + 16 * i, SECRET + 16 * (i - 8) + 3);
+  }
+  acc += mix16(input + length - 16, SECRET + 136 - 17);
+
+  return xxh3Avalanche(acc);
+}
+
+static void accumulateStripe(ULONGLONG *acc, const BYTE *input,
+                             const BYTE *secret) {
+#ifdef XXH3_USE_SSE2
+  __m128i *lanes = (__m128i *)acc;
+
+  for (size_t i = 0; i < 4; i++) {
+    __m128i data = _mm_loadu_si128((const __m128i *)(input + 16 * i));
+    __m128i key = _mm_loadu_si128((const __m128i *)(secret + 16 * i));
+    __m128i dataKey = _mm_xor_si128(data, key);
+    __m128i dataKeyHigh = _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+    __m128i product = _mm_mul_epu32(dataKey, dataKeyHigh);
+    __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    __m128i sum = _mm_add_epi64(_mm_loadu_si128(lanes + i), swapped);
+    _mm_storeu_si128(lanes + i, _mm_add_epi64(product, sum));
+  }
+#else
+  for (size_t i = 0; i < 8; i++) {
+    ULONGLONG data = read64(input + 8 * i);
+    ULONGLONG dataKey = data ^ read64(secret + 8 * i);
+    acc[i ^ 1] += data;
+    acc[i] += (ULONGLONG)(UINT32)dataKey * (dataKey >> 32);
+  }
+#endif
+}
+
+static void scramble(ULONGLONG *acc, const BYTE *secret) {
+  for (size_t i = 0; i < 8; i++) {
+    ULONGLONG value = acc[i];
+    value ^= value >> 47;
+    value ^= read64(secret + 8 * i);
+    acc[i] = value * PRIME32_1;
+  }
+}
+
+Xxh3Hasher::Xxh3Hasher() : stripesInBlock(0), total(0), buffered(0) {
+  acc[0] = PRIME32_3;
+  acc[1] = PRIME64_1;
+  acc[2] = PRIME64_2;
+  acc[3] = PRIME64_3;
+  acc[4] = PRIME64_4;
+  acc[5] = PRIME32_2;
+  acc[6] = PRIME64_5;
+  acc[7] = PRIME32_1;
+}
+
+void Xxh3Hasher::consumeStripe(const BYTE *stripe) {
+  accumulateStripe(acc, stripe, SECRET + stripesInBlock * 8);
+
+  if (++stripesInBlock == STRIPES_PER_BLOCK) {
+    scramble(acc, SECRET + SECRET_SIZE - STRIPE_LENGTH);
+    stripesInBlock = 0;
+  }
+}
+
+void Xxh3Hasher::update(const void *data, size_t length) {
+  const BYTE *input = (const BYTE *)data;
+  total += length;
+
+  // Short inputs are hashed in one go at the end, so keep all of it until
+  // there's too much
+  if (total <= MAX_SHORT_LENGTH) {
+    memcpy(buffer + buffered, input, length);
+    buffered += length;
+    return;
+  }
+
+  // A stripe is only consumed once there's input after it, since the last
+  // stripe is treated differently
+  while (length > 0) {
+    if (buffered > 0) {
+      size_t take = std::min(length, STRIPE_LENGTH - buffered % STRIPE_LENGTH);
+      memcpy(buffer + buffered, input, take);
+      buffered += take;
+      input += take;
+      length -= take;
+
+      if (length == 0) {
+        break;
+      }
+
+      for (size_t offset = 0; offset < buffered; offset += STRIPE_LENGTH) {
+        consumeStripe(buffer + offset);
+      }
+      memcpy(lastStripe, buffer + buffered - STRIPE_LENGTH, STRIPE_LENGTH);
+      buffered = 0;
+    }
+
+    if (length > STRIPE_LENGTH) {
+      while (length > STRIPE_LENGTH) {
+        consumeStripe(input);
+        input += STRIPE_LENGTH;
+        length -= STRIPE_LENGTH;
+      }
+      memcpy(lastStripe, input - STRIPE_LENGTH, STRIPE_LENGTH);
+    }
+
+    memcpy(buffer, input, length);
+    buffered = length;
+    length = 0;
+  }
+}
+
+ULONGLONG Xxh3Hasher::digest64() const {
+  if (total <= MAX_SHORT_LENGTH) {
+    return hashShort(buffer, (size_t)total);
+  }
+
+  Xxh3Hasher state = *this;
+  size_t offset = 0;
+
+  for (; offset + STRIPE_LENGTH < state.buffered; offset += STRIPE_LENGTH) {
+    state.consumeStripe(state.buffer + offset);
+  }
+
+  // The last stripe is always the last 64 bytes of the input, even if some
+  // of them were consumed already
+  BYTE last[STRIPE_LENGTH];
+  if (buffered >= STRIPE_LENGTH) {
+    memcpy(last, buffer + buffered - STRIPE_LENGTH, STRIPE_LENGTH);
+  } else {
+    size_t fromBefore = STRIPE_LENGTH - buffered;
+    memcpy(last, lastStripe + STRIPE_LENGTH - fromBefore, fromBefore);
+    memcpy(last + fromBefore, buffer, buffered);
+  }
+  accumulateStripe(state.acc, last, SECRET + SECRET_SIZE - STRIPE_LENGTH - 7);
+
+  ULONGLONG result = total * PRIME64_1;
+  for (size_t i = 0; i < 4; i++) {
+    result += multiplyFold64(state.acc[2 * i] ^ read64(SECRET + 11 + 16 * i),
+                             state.acc[2 * i + 1] ^
+                                 read64(SECRET + 11 + 16 * i + 8));
+  }
+
+  return xxh3Avalanche(result);
+}
+
+std::string Xxh3Hasher::digest() const { return toHex64(digest64()); }